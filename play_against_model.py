@@ -12,5 +12,5 @@ if __name__ == "__main__":
     p1 = PolicyPlayer(model, None) # no training model required
     p2 = PolicyPlayer(model, None)
     human = pyskat.HumanPlayer()
-    game = pyskat.Game(p1, p2, human, max_rounds=args.rounds, retry_on_illegal_action=True)
+    game = pyskat.Game(p1, p2, human, max_rounds=args.rounds, expect_legal_actions=True)
     game.run_new_game()
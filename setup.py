@@ -7,10 +7,13 @@ if platform.system() == "Windows":
     boost_flag = []
 else:
     boost_flag = ["-DBOOST_ALL_DYN_LINK"]
+libraries = ["gtest", "boost_thread", "boost_log", "boost_system"]
+if platform.system() == "Linux":
+    libraries.append("rt") # shm_open of the actor/learner pipeline
 
 ext = Pybind11Extension("pyskat_cpp", 
     sorted(glob("src/*.cpp")),
-    libraries=["gtest", "boost_thread", "boost_log", "boost_system"],
+    libraries=libraries,
     extra_compile_args=boost_flag,
     test_suite='tests',
     cxx_std=14)
@@ -0,0 +1,132 @@
+#include "bots.hpp"
+
+using namespace HalfSkat;
+
+namespace {
+
+bool is_trump(Cards::Card const& card, Contract const& contract) {
+    return (get_trumps(contract) & Cards::get_card_bit(card)) != 0;
+}
+
+int get_points(Cards::Card const& card) {
+    return Cards::get_card_points(Cards::get_card_bit(card));
+}
+
+// Calls f for each card contained in mask
+template<typename F>
+void for_each_card(Cards::CardMask const mask, F f) {
+    for (int id=0; id<32; id++) {
+        if (mask & (Cards::CardMask(1) << id)) {
+            f(Cards::AllCards[id]);
+        }
+    }
+}
+
+// Returns card of mask maximizing key, first one wins ties
+template<typename F>
+Cards::Card select_max(Cards::CardMask const mask, F key) {
+    Cards::Card best;
+    bool found = false;
+    decltype(key(best)) best_key{};
+    for_each_card(mask, [&](Cards::Card const& c) {
+        auto const k = key(c);
+        if ((not found) or (k > best_key)) {
+            best = c;
+            best_key = k;
+            found = true;
+        }
+    });
+    assert(found);
+    return best;
+}
+
+Cards::Card play_highest(PlayerState const& state) {
+    Trick const& trick = state.trick;
+    Contract const& contract = state.contract;
+    Cards::Card const strongest = select_max(state.legal_cards, [&](Cards::Card const& c) { return get_card_strength(c, trick, contract); });
+    if (trick.empty() or (get_card_strength(strongest, trick, contract) > get_card_strength(trick[get_leading_index(trick, contract)], trick, contract))) {
+        return strongest;
+    }
+    // Trick is lost anyway, give away as few points as possible
+    return select_max(state.legal_cards, [&](Cards::Card const& c) { return -100*get_points(c) - get_card_strength(c, trick, contract); });
+}
+
+bool friend_wins_trick(PlayerState const& state) {
+    return (not state.trick.empty()) and state.trick_played_by_friend[get_leading_index(state.trick, state.contract)];
+}
+
+Cards::Card play_smear(PlayerState const& state) {
+    Trick const& trick = state.trick;
+    if ((not state.is_declarer) and friend_wins_trick(state)) {
+        // Smear if the trick is safe: all others played or partner plays a high trump (jack or trump ace)
+        Cards::Card const& leading = trick[get_leading_index(trick, state.contract)];
+        bool const high_trump = is_trump(leading, state.contract) and ((leading.rank == Cards::Rank::Jack) or (leading.rank == Cards::Rank::Ace));
+        if ((trick.size() == 2) or high_trump) {
+            return select_max(state.legal_cards, [&](Cards::Card const& c) { return 100*get_points(c) - get_card_strength(c, trick, state.contract); });
+        }
+    }
+    return play_highest(state);
+}
+
+} // namespace
+
+int HalfSkat::get_card_strength(Cards::Card const& card, Trick const& trick, Contract const& contract) {
+    int const id = Cards::get_card_id(card);
+    int const lead = trick.empty() ? id : Cards::get_card_id(trick.front());
+    return 1 + with_rules(contract, [&](auto rules) { return decltype(rules)::get_key(id, lead); });
+}
+
+size_t HalfSkat::get_leading_index(Trick const& trick, Contract const& contract) {
+    size_t leading = 0;
+    for (size_t i=1; i<trick.size(); i++) {
+        if (get_card_strength(trick[i], trick, contract) > get_card_strength(trick[leading], trick, contract)) {
+            leading = i;
+        }
+    }
+    return leading;
+}
+
+Cards::Card HighestCardPlayer::query_policy() {
+    return play_highest(m_last_state);
+}
+
+Cards::Card SmearPlayer::query_policy() {
+    return play_smear(m_last_state);
+}
+
+Cards::Card TrumpPullingPlayer::query_policy() {
+    PlayerState const& state = m_last_state;
+    if (state.is_declarer and state.trick.empty()) {
+        Cards::CardMask const trump_mask = get_trumps(state.contract);
+        Cards::CardMask const own_trumps = state.hole_cards & trump_mask;
+        Cards::CardMask const gone_trumps = (state.won_friendly | state.won_hostile) & trump_mask;
+        bool const opponents_may_hold_trumps = (Cards::count_cards(own_trumps | gone_trumps) < Cards::count_cards(trump_mask));
+        if ((own_trumps & state.legal_cards) and opponents_may_hold_trumps) {
+            return select_max(own_trumps & state.legal_cards, [&](Cards::Card const& c) { return get_card_strength(c, state.trick, state.contract); });
+        }
+    }
+    return play_smear(state);
+}
+
+Cards::Card WeightedHeuristicPlayer::query_policy() {
+    PlayerState const& state = m_last_state;
+    Trick const& trick = state.trick;
+    Contract const& contract = state.contract;
+    int const leading_strength = trick.empty() ? 0 : get_card_strength(trick[get_leading_index(trick, contract)], trick, contract);
+    int const trick_points = Cards::get_card_points(trick.get_mask());
+    bool const friend_winning = friend_wins_trick(state);
+    return select_max(state.legal_cards, [&](Cards::Card const& c) {
+        int const strength = get_card_strength(c, trick, contract);
+        bool const wins = trick.empty() or (strength > leading_strength);
+        int const points = get_points(c);
+        float score = 0.f;
+        score += weights.wins_trick * wins;
+        score += weights.card_points * points;
+        score += weights.trick_points_won * (wins ? (trick_points + points) : 0);
+        score += weights.smear_points * (friend_winning ? points : 0);
+        score += weights.strength * strength;
+        score += weights.trump * is_trump(c, contract);
+        score += weights.lead_trump_as_declarer * (state.is_declarer and trick.empty() and is_trump(c, contract));
+        return score;
+    });
+}
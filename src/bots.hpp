@@ -0,0 +1,57 @@
+#pragma once
+
+#include <array>
+
+#include "cards.hpp"
+#include "halfskat.hpp"
+
+// Rule-based players that only look at their PlayerState, cheap enough to be used as opponents in training
+namespace HalfSkat {
+
+// Rank of card within the current trick under the rules of contract: higher beats lower, 0 can't win the trick.
+// The first card of the trick (if any) determines which color may win.
+int get_card_strength(Cards::Card const& card, Trick const& trick, Contract const& contract = Contract());
+// Index of the card currently winning the trick
+size_t get_leading_index(Trick const& trick, Contract const& contract = Contract());
+
+// Plays its strongest card if that wins the trick, otherwise the card worth the fewest points
+class HighestCardPlayer : public Player {
+    public:
+        using Player::Player;
+        Cards::Card query_policy() override;
+};
+
+// Defender that smears its most valuable card if the partner currently wins the trick, otherwise like HighestCardPlayer
+class SmearPlayer : public Player {
+    public:
+        using Player::Player;
+        Cards::Card query_policy() override;
+};
+
+// Declarer that leads its highest trump as long as opponents may hold trumps, otherwise like SmearPlayer
+class TrumpPullingPlayer : public Player {
+    public:
+        using Player::Player;
+        Cards::Card query_policy() override;
+};
+
+// Weights of the card features scored by WeightedHeuristicPlayer
+struct HeuristicWeights {
+    float wins_trick = 10.f; // Card would currently win the trick
+    float card_points = -0.5f; // Points of the card itself
+    float trick_points_won = 1.f; // Points in the trick if the card wins it
+    float smear_points = 1.f; // Points of the card if a friendly player currently wins the trick
+    float strength = -0.1f; // Strength of card relative to lead, spends weak winners first
+    float trump = -2.f; // Card is a trump
+    float lead_trump_as_declarer = 5.f; // Card is a trump led by the declarer
+};
+
+// Scores every legal card as weighted sum of features and plays the best one
+class WeightedHeuristicPlayer : public Player {
+    public:
+        WeightedHeuristicPlayer(HeuristicWeights const& weights = HeuristicWeights()) : weights(weights) {}
+        Cards::Card query_policy() override;
+        HeuristicWeights weights;
+};
+
+} // namespace HalfSkat
@@ -1,18 +1,18 @@
 #include <algorithm>
+#include <bitset>
 #include <cassert>
 #include <vector>
 #include <random>
-#include <chrono>
 #include <stdexcept>
 
 #include "cards.hpp"
 
 using namespace Cards;
 
-static auto rng = std::default_random_engine {};
+// One engine per thread, games may be played concurrently
+static thread_local auto rng = std::default_random_engine {std::random_device{}()};
 
 std::vector<Card> Cards::get_full_shuffled_deck() {
-    rng.seed(std::chrono::system_clock::now().time_since_epoch().count());
     std::vector<Card> deck;
     for (const Color c : AllColors) {
         for (const Rank r : AllRanks) {
@@ -76,8 +76,7 @@ Card::Card(int const card_id) {
 std::array<bool, 32> Cards::Card::to_one_hot() const {
     std::array<bool, 32> result;
     result.fill(false);
-    int idx = std::distance(AllCards.begin(), std::find(AllCards.begin(), AllCards.end(), *this));
-    result.at(idx) = true;
+    result.at(get_card_id(*this)) = true;
     return result;
 }
 
@@ -86,8 +85,49 @@ std::array<bool, 32> Cards::get_multi_hot(std::vector<Card> const& cards) {
     std::array<bool, 32> result;
     result.fill(false);
     for (auto const c: cards) {
-        int idx = std::distance(AllCards.begin(), std::find(AllCards.begin(), AllCards.end(), c));
-        result.at(idx) = true;
+        result.at(get_card_id(c)) = true;
     }
     return result;
 }
+
+
+int Cards::count_cards(CardMask const mask) {
+    return std::bitset<32>(mask).count();
+}
+
+CardMask Cards::get_card_mask(std::vector<Card> const& cards) {
+    CardMask mask = 0;
+    for (auto const& c: cards) {
+        mask |= get_card_bit(c);
+    }
+    return mask;
+}
+
+// Returns cards contained in mask, ordered as in AllCards
+std::vector<Card> Cards::get_cards_from_mask(CardMask const mask) {
+    std::vector<Card> cards;
+    for (int i=0; i<32; i++) {
+        if (mask & (CardMask(1) << i)) {
+            cards.push_back(AllCards[i]);
+        }
+    }
+    return cards;
+}
+
+std::array<bool, 32> Cards::get_multi_hot(CardMask const mask) {
+    std::array<bool, 32> result;
+    for (int i=0; i<32; i++) {
+        result[i] = mask & (CardMask(1) << i);
+    }
+    return result;
+}
+
+int Cards::get_card_points(CardMask const mask) {
+    // Masks of all cards of a rank, points of each rank
+    static const std::array<std::pair<CardMask, int>, 5> rank_masks = {{{0x10101010, 2}, {0x80808080, 11}, {0x08080808, 10}, {0x40404040, 4}, {0x20202020, 3}}};
+    int sum = 0;
+    for (auto const& rm : rank_masks) {
+        sum += count_cards(mask & rm.first) * rm.second;
+    }
+    return sum;
+}
\ No newline at end of file
@@ -1,9 +1,11 @@
 #pragma once
 
 #include <array>
+#include <cstdint>
 #include <map>
 #include <iostream>
 #include <string>
+#include <vector>
 
 namespace Cards {
 
@@ -48,4 +50,20 @@ int get_suit_base_value(Card const& card);
 int get_suit_base_value(Color const& color);
 std::array<bool, 32> get_multi_hot(std::vector<Card> const& cards);
 
+static const int rank_offsets[] = {0, 1, 2, 5, 6, 3, 7, 4}; // Position of each Rank within a color block of AllCards
+
+// Returns index of card in AllCards, which is also its position in one-hot representations
+inline int get_card_id(Card const& card) { return 8*(3 - card.color) + rank_offsets[card.rank]; }
+
+using CardMask = uint32_t; // Bit i is set if AllCards[i] is contained
+inline CardMask get_card_bit(Card const& card) { return CardMask(1) << get_card_id(card); }
+inline bool in_mask(CardMask const mask, Card const& card) { return mask & get_card_bit(card); }
+inline CardMask get_color_mask(Color const color) { return CardMask(0xff) << 8*(3 - color); }
+static const CardMask jacks_mask = 0x10101010;
+int count_cards(CardMask const mask);
+CardMask get_card_mask(std::vector<Card> const& cards);
+std::vector<Card> get_cards_from_mask(CardMask const mask);
+std::array<bool, 32> get_multi_hot(CardMask const mask);
+int get_card_points(CardMask const mask);
+
 } // namespace Cards
\ No newline at end of file
@@ -0,0 +1,145 @@
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include "dataset.hpp"
+#include "halfskat.hpp"
+#include "cards.hpp"
+
+using namespace Dataset;
+
+namespace {
+
+struct FileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+};
+static const char file_magic[8] = {'P', 'Y', 'S', 'K', 'A', 'T', 'R', 'R'};
+static const uint32_t file_version = 1;
+
+// Plays back the recorded cards of a round, all three seats share the cursor
+class ReplayPlayer : public HalfSkat::Player {
+    public:
+        ReplayPlayer(RoundRecord const*& record, int& cursor, std::vector<HalfSkat::PlayerState>& states) : record(record), cursor(cursor), states(states) {}
+        Cards::Card query_policy() override {
+            states.push_back(m_last_state);
+            return Cards::Card(record->plays[cursor++]);
+        }
+    private:
+        RoundRecord const*& record;
+        int& cursor;
+        std::vector<HalfSkat::PlayerState>& states;
+};
+
+void write_multi_hot(Cards::CardMask const mask, float* out) {
+    for (int i=0; i<32; i++) {
+        out[i] = (mask & (Cards::CardMask(1) << i)) ? 1.f : 0.f;
+    }
+}
+
+} // namespace
+
+RecordWriter::RecordWriter(std::string const& path) {
+    file = std::fopen(path.c_str(), "ab");
+    if (file == nullptr) {
+        throw std::runtime_error("Could not open record file " + path);
+    }
+    if (std::ftell(file) == 0) { // New file, starts with header
+        FileHeader header;
+        std::memcpy(header.magic, file_magic, sizeof(file_magic));
+        header.version = file_version;
+        header.record_size = sizeof(RoundRecord);
+        std::fwrite(&header, sizeof(header), 1, file);
+    }
+}
+
+RecordWriter::~RecordWriter() {
+    std::fclose(file);
+}
+
+void RecordWriter::write(RoundRecord const& record) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (std::fwrite(&record, sizeof(record), 1, file) != 1) {
+        throw std::runtime_error("Could not write round record");
+    }
+    written++;
+}
+
+void RecordWriter::flush() {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::fflush(file);
+}
+
+RecordFile::RecordFile(std::string const& path) : file(path, "record file", sizeof(FileHeader)) {
+    FileHeader const* header = reinterpret_cast<FileHeader const*>(file.data());
+    if ((std::memcmp(header->magic, file_magic, sizeof(file_magic)) != 0) or (header->version != file_version) or (header->record_size != sizeof(RoundRecord))) {
+        throw std::runtime_error("Not a record file: " + path);
+    }
+    // Records are accessed in shuffled order
+    file.advise_random();
+    records = reinterpret_cast<RoundRecord const*>(file.data() + sizeof(FileHeader));
+    num_records = (file.size() - sizeof(FileHeader)) / sizeof(RoundRecord); // Ignore partially written trailing record
+}
+
+RoundRecord const& RecordFile::at(size_t const idx) const {
+    if (idx >= num_records) {
+        throw std::out_of_range("Record index out of range");
+    }
+    return records[idx];
+}
+
+void Dataset::encode_state(HalfSkat::PlayerState const& state, float* out) {
+    std::fill(out, out + state_size, 0.f);
+    write_multi_hot(state.hole_cards, out);
+    if (state.trick.size() > 0) {
+        out[32 + Cards::get_card_id(state.trick[0])] = 1.f;
+    }
+    if (state.trick.size() > 1) {
+        out[64 + Cards::get_card_id(state.trick[1])] = 1.f;
+    }
+    write_multi_hot(state.won_friendly, out + 96);
+    write_multi_hot(state.won_hostile, out + 128);
+    out[160] = state.is_declarer ? 1.f : 0.f;
+}
+
+void Dataset::decode_rounds(RecordFile const& file, std::vector<size_t> const& indices, float* states, float* actions, float* returns, float* legal_masks) {
+    RoundRecord const* record = nullptr;
+    int cursor = 0;
+    std::vector<HalfSkat::PlayerState> decisions;
+    decisions.reserve(decisions_per_round);
+    auto first = std::make_shared<ReplayPlayer>(record, cursor, decisions);
+    auto second = std::make_shared<ReplayPlayer>(record, cursor, decisions);
+    auto third = std::make_shared<ReplayPlayer>(record, cursor, decisions);
+    HalfSkat::Game game(first, second, third, 0, false);
+    std::vector<Cards::Card> deck(32);
+    std::fill(actions, actions + 32*decisions_per_round*indices.size(), 0.f);
+    for (size_t const idx : indices) {
+        record = &file.at(idx);
+        cursor = 0;
+        decisions.clear();
+        for (size_t i=0; i<deck.size(); i++) {
+            deck[i] = Cards::Card(record->deal[i]);
+        }
+        game.deal_round(deck, record->declarer, record->dealer);
+        int const points_before = game.get_points()[record->declarer];
+        game.step_by_round();
+        if ((game.get_state() == HalfSkat::early_abort) or (decisions.size() != decisions_per_round)) {
+            throw std::runtime_error("Round record does not replay legally");
+        }
+        bool const declarer_won = (game.get_points()[record->declarer] > points_before);
+        for (auto const& state : decisions) {
+            encode_state(state, states);
+            actions[record->plays[&state - decisions.data()]] = 1.f;
+            write_multi_hot(state.legal_cards, legal_masks);
+            *returns = (state.is_declarer == declarer_won) ? 1.f : -1.f;
+            states += state_size;
+            actions += 32;
+            legal_masks += 32;
+            returns++;
+        }
+        first->clear_transitions();
+        second->clear_transitions();
+        third->clear_transitions();
+    }
+}
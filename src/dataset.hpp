@@ -0,0 +1,66 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "mapping.hpp"
+
+namespace HalfSkat {
+struct PlayerState;
+} // namespace HalfSkat
+
+namespace Dataset {
+
+static const int state_size = 32 + 32 + 32 + 32 + 32 + 1; // Same layout as PolicyPlayer.convert_state_for_model
+static const int decisions_per_round = 30;
+
+// Compact record of a single finished round: the deal and the order in which cards were played
+struct RoundRecord {
+    std::array<uint8_t, 32> deal; // Card ids, ten per seat in seat order, followed by the skat
+    uint8_t declarer;
+    uint8_t dealer;
+    std::array<uint8_t, decisions_per_round> plays; // Card ids in the order they were played
+};
+static_assert(sizeof(RoundRecord) == 64, "RoundRecord must stay 64 bytes");
+
+// Appends round records to a file, may be shared by several games
+class RecordWriter {
+    public:
+        RecordWriter(std::string const& path);
+        ~RecordWriter();
+        RecordWriter(RecordWriter const&) = delete;
+        RecordWriter& operator=(RecordWriter const&) = delete;
+        void write(RoundRecord const& record);
+        void flush();
+        size_t get_written() const { return written; }
+    private:
+        std::FILE* file = nullptr;
+        std::mutex mutex;
+        size_t written = 0;
+};
+
+// Read-only memory mapping of a file written by RecordWriter
+class RecordFile {
+    public:
+        RecordFile(std::string const& path);
+        size_t size() const { return num_records; }
+        RoundRecord const& at(size_t const idx) const;
+    private:
+        Mapping::File file;
+        size_t num_records = 0;
+        RoundRecord const* records = nullptr;
+};
+
+// Writes model input representation of state to out, which must hold state_size floats
+void encode_state(HalfSkat::PlayerState const& state, float* out);
+
+// Replays the given rounds through the rules engine and writes one row per decision.
+// Buffers must hold decisions_per_round rows per round; rows are state_size (states) or 32 (actions, legal masks) floats wide.
+// Returns are +1 for decisions of the party that won the round, -1 otherwise.
+void decode_rounds(RecordFile const& file, std::vector<size_t> const& indices, float* states, float* actions, float* returns, float* legal_masks);
+
+} // namespace Dataset
@@ -0,0 +1,679 @@
+#include <algorithm>
+#include <atomic>
+#include <limits>
+#include <mutex>
+#include <random>
+#include <sstream>
+
+#include "differential.hpp"
+#include "parallel.hpp"
+
+using namespace Differential;
+
+// Reference implementation, as in the first version of the engine
+namespace {
+
+Cards::Color const trump = Cards::Color::Clubs;
+
+bool trump_in_trick(std::vector<Cards::Card> const& trick) {
+    for (auto const& c: trick) {
+        if ((c.color == trump) or (c.rank == Cards::Rank::Jack)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int count_points(std::vector<Cards::Card> const& cards) {
+    int sum = 0;
+    for (auto card: cards) {
+        sum += Cards::rank_points.find(card.rank)->second;
+    }
+    return sum;
+}
+
+} // namespace
+
+std::vector<Cards::Card> Reference::get_legal_cards(std::vector<Cards::Card> const& hand, std::vector<Cards::Card> const& trick) {
+    std::vector<Cards::Card> copy = hand;
+    if (trick.empty()) { // No card played yet
+        return copy;
+    }
+    Cards::Color sc = trick.front().color; // First card determines color to be played
+    Cards::Rank sr = trick.front().rank;
+    // First, determine cards that would follow suit
+    std::vector<Cards::Card> legals = copy;
+    if ((sr == Cards::Rank::Jack) or (sc == trump)) { // Trump is single suit
+        legals.erase(std::remove_if(legals.begin(), legals.end(), [](Cards::Card const& c) {
+            return ((c.rank != Cards::Rank::Jack) and (c.color != trump));
+        }), legals.end());
+    }
+    else {
+        // Rule change since the first version: jacks are trumps and don't follow their printed color
+        legals.erase(std::remove_if(legals.begin(), legals.end(), [sc](Cards::Card const& c) {
+            return (c.color != sc) or (c.rank == Cards::Rank::Jack);
+        }), legals.end());
+    }
+    // Check if player can follow suit
+    bool legal_found = !legals.empty();
+    if (legal_found) { // Player can follow suit
+        return legals;
+    }
+    else { // Player cannot follow suit
+        return copy;
+    }
+}
+
+int Reference::get_trick_winner(std::vector<Cards::Card> const& trick) {
+    if (trick.size() != 3) {
+        throw std::runtime_error("Trick is not full yet");
+    }
+    std::array<Cards::Card, 11> trick_hierarchy {{{Cards::Color::Clubs, Cards::Rank::Jack}, {Cards::Color::Spades, Cards::Rank::Jack},
+        {Cards::Color::Hearts, Cards::Rank::Jack}, {Cards::Color::Diamonds, Cards::Rank::Jack}, {Cards::Color::Spades, Cards::Rank::Ace},
+        {Cards::Color::Spades, Cards::Rank::Ten}, {Cards::Color::Spades, Cards::Rank::King}, {Cards::Color::Spades, Cards::Rank::Queen},
+        {Cards::Color::Spades, Cards::Rank::Nine}, {Cards::Color::Spades, Cards::Rank::Eight}, {Cards::Color::Spades, Cards::Rank::Seven}}};
+    for (auto& c: trick_hierarchy) {
+        if (c.rank != Cards::Rank::Jack) {
+            c.color = trump_in_trick(trick) ? trump : trick.front().color;
+        }
+        auto it = std::find(trick.begin(), trick.end(), c);
+        if (it != trick.end()) {
+            return it->played_by;
+        }
+    }
+    throw std::runtime_error("Failed to find winning card");
+}
+
+int Reference::get_game_level(std::vector<Cards::Card> const& cards) {
+    int game_level = 1;
+    Cards::Card const clubs_jack{Cards::Color::Clubs, Cards::Rank::Jack};
+    bool has_jack_clubs = (std::find(cards.begin(), cards.end(), clubs_jack) != cards.end());
+    std::array<Cards::Card, 10> const cards_to_find {{{Cards::Color::Spades, Cards::Rank::Jack},
+        {Cards::Color::Hearts, Cards::Rank::Jack},
+        {Cards::Color::Diamonds, Cards::Rank::Jack},
+        {trump, Cards::Rank::Ace},
+        {trump, Cards::Rank::Ten},
+        {trump, Cards::Rank::King},
+        {trump, Cards::Rank::Queen},
+        {trump, Cards::Rank::Nine},
+        {trump, Cards::Rank::Eight},
+        {trump, Cards::Rank::Seven}}};
+    for (auto c: cards_to_find) {
+        bool const found = (std::find(cards.begin(), cards.end(), c) != cards.end());
+        if (found != has_jack_clubs) {
+            return game_level; // Straight broken
+        }
+        game_level++;
+    }
+    return game_level;
+}
+
+int Reference::get_game_value(std::vector<Cards::Card> const& cards) {
+    return Cards::color_base_values.find(trump)->second * get_game_level(cards);
+}
+
+void Reference::deal(std::vector<Cards::Card> const& deck, std::array<std::vector<Cards::Card>, 3>& hands, std::vector<Cards::Card>& skat) {
+    for (int p=0; p<3; p++) {
+        hands[p].assign(deck.begin() + p*HalfSkat::cards_per_player, deck.begin() + (p+1)*HalfSkat::cards_per_player);
+        std::sort(hands[p].begin(), hands[p].end(), [&](Cards::Card l, Cards::Card r) {
+            return Cards::color_base_values.find(l.color)->second > Cards::color_base_values.find(r.color)->second;
+        });
+    }
+    skat.assign(deck.begin() + 3*HalfSkat::cards_per_player, deck.end());
+}
+
+namespace {
+
+// What a player sees before a decision, compared field by field
+struct Decision {
+    int seat;
+    HalfSkat::PlayerState state;
+};
+
+struct Script {
+    std::vector<uint8_t> const* choices = nullptr;
+    std::vector<Decision> log;
+};
+
+// The choices[k]-th legal card (ascending ids) at decision k
+Cards::Card choose(Cards::CardMask const legal, Script const& script) {
+    size_t const k = script.log.size() - 1;
+    int const choice = (k < script.choices->size()) ? (*script.choices)[k] : 0;
+    int skip = choice % std::max(1, Cards::count_cards(legal));
+    for (int id=0; id<32; id++) {
+        if (((legal >> id) & 1) and (skip-- == 0)) {
+            return Cards::Card(id);
+        }
+    }
+    throw std::runtime_error("No legal card");
+}
+
+class ScriptedPlayer : public HalfSkat::Player {
+    public:
+        ScriptedPlayer(int const seat, Script& script) : seat(seat), script(script) {}
+        Cards::Card query_policy() override {
+            script.log.push_back({seat, m_last_state});
+            return choose(m_last_state.legal_cards, script);
+        }
+    private:
+        int seat;
+        Script& script;
+};
+
+// Engine with access to the state the checks need, one per thread
+class Probe : public HalfSkat::Game {
+    public:
+        Probe(std::array<std::shared_ptr<ScriptedPlayer>, 3> const& p) : HalfSkat::Game(p[0], p[1], p[2], std::numeric_limits<int>::max(), false, true) {}
+        int get_trick_winner(std::vector<Cards::Card> const& trick) {
+            public_state.trick.clear();
+            for (auto const& c : trick) {
+                public_state.trick.push_back(c);
+            }
+            return HalfSkat::Game::get_trick_winner();
+        }
+        void deal(std::vector<Cards::Card> const& deck, std::array<std::vector<Cards::Card>, 3>& hands, std::vector<Cards::Card>& skat_out) {
+            deal_round(deck, 0, 0);
+            for (int p=0; p<3; p++) {
+                hands[p] = players[p]->get_cards();
+            }
+            skat_out = skat;
+        }
+        // Change of the declarer's points
+        int play_round(std::vector<Cards::Card> const& deck, int const declarer, int const dealer) {
+            deal_round(deck, declarer, dealer);
+            int const before = points[declarer];
+            step_by_round();
+            for (auto& p : players) {
+                p->clear_transitions();
+            }
+            return points[declarer] - before;
+        }
+};
+
+struct Engine {
+    Script script;
+    std::array<std::shared_ptr<ScriptedPlayer>, 3> players = {{std::make_shared<ScriptedPlayer>(0, script), std::make_shared<ScriptedPlayer>(1, script), std::make_shared<ScriptedPlayer>(2, script)}};
+    Probe probe{players};
+};
+
+Engine& get_engine() {
+    static thread_local Engine engine;
+    return engine;
+}
+
+std::string format(std::vector<Cards::Card> const& cards) {
+    std::ostringstream out;
+    out << "[";
+    for (size_t i=0; i<cards.size(); i++) {
+        out << (i > 0 ? " " : "") << cards[i];
+    }
+    out << "]";
+    return out.str();
+}
+
+std::string format(Cards::CardMask const mask) {
+    return format(Cards::get_cards_from_mask(mask));
+}
+
+Cards::CardMask get_mask(std::vector<Cards::Card> const& cards) {
+    return Cards::get_card_mask(cards);
+}
+
+// Plays the round of c with the reference rules and logs the decisions like the engine's players see them
+int play_reference_round(Case const& c, std::vector<Decision>& log) {
+    std::array<std::vector<Cards::Card>, 3> hands;
+    std::vector<Cards::Card> skat;
+    Reference::deal(c.cards, hands, skat);
+    std::array<std::vector<Cards::Card>, 3> won;
+    Script script;
+    script.choices = &c.choices;
+    int current = (c.dealer + 1) % 3;
+    for (int t=0; t<HalfSkat::cards_per_player; t++) {
+        std::vector<Cards::Card> trick;
+        for (int k=0; k<3; k++) {
+            std::vector<Cards::Card> const legal = Reference::get_legal_cards(hands[current], trick);
+            Decision d;
+            d.seat = current;
+            HalfSkat::PlayerState& s = d.state;
+            s.hole_cards = get_mask(hands[current]);
+            for (size_t i=0; i<trick.size(); i++) {
+                s.trick.push_back(trick[i]);
+                s.trick_played_by_friend[i] = (current == c.declarer) ? (trick[i].played_by == current) : (trick[i].played_by != c.declarer);
+            }
+            s.is_declarer = (current == c.declarer);
+            for (int p=0; p<3; p++) {
+                bool const friendly = s.is_declarer ? (p == current) : (p != c.declarer);
+                (friendly ? s.won_friendly : s.won_hostile) |= get_mask(won[p]);
+            }
+            s.legal_cards = get_mask(legal);
+            script.log.push_back(d);
+            log.push_back(d);
+            Cards::Card card = choose(s.legal_cards, script);
+            hands[current].erase(std::find(hands[current].begin(), hands[current].end(), card));
+            card.played_by = current;
+            trick.push_back(card);
+            current = (current + 1) % 3;
+        }
+        int const winner = Reference::get_trick_winner(trick);
+        won[winner].insert(won[winner].end(), trick.begin(), trick.end());
+        current = winner;
+    }
+    won[c.declarer].insert(won[c.declarer].end(), skat.begin(), skat.end());
+    int const value = Reference::get_game_value(won[c.declarer]);
+    return (count_points(won[c.declarer]) >= 61) ? value : -2*value;
+}
+
+std::string compare_states(HalfSkat::PlayerState const& r, HalfSkat::PlayerState const& e) {
+    std::ostringstream out;
+    if (r.hole_cards != e.hole_cards) {
+        out << "hole cards " << format(r.hole_cards) << " vs " << format(e.hole_cards);
+    }
+    else if ((r.trick.size() != e.trick.size()) or not std::equal(r.trick.begin(), r.trick.end(), e.trick.begin(),
+            [](Cards::Card const& a, Cards::Card const& b) { return (a == b) and (a.played_by == b.played_by); })) {
+        out << "trick " << format(r.trick.to_vector()) << " vs " << format(e.trick.to_vector());
+    }
+    else if (not std::equal(r.trick_played_by_friend.begin(), r.trick_played_by_friend.begin() + r.trick.size(), e.trick_played_by_friend.begin())) {
+        out << "friendly trick cards";
+    }
+    else if (r.is_declarer != e.is_declarer) {
+        out << "is_declarer " << r.is_declarer << " vs " << e.is_declarer;
+    }
+    else if (r.won_friendly != e.won_friendly) {
+        out << "friendly won cards " << format(r.won_friendly) << " vs " << format(e.won_friendly);
+    }
+    else if (r.won_hostile != e.won_hostile) {
+        out << "hostile won cards " << format(r.won_hostile) << " vs " << format(e.won_hostile);
+    }
+    else if (r.legal_cards != e.legal_cards) {
+        out << "legal cards " << format(r.legal_cards) << " vs " << format(e.legal_cards);
+    }
+    return out.str();
+}
+
+std::string compare_round(Case const& c) {
+    std::vector<Decision> reference;
+    int const reference_delta = play_reference_round(c, reference);
+    Engine& engine = get_engine();
+    engine.script.choices = &c.choices;
+    engine.script.log.clear();
+    int const engine_delta = engine.probe.play_round(c.cards, c.declarer, c.dealer);
+    std::vector<Decision> const& log = engine.script.log;
+    for (size_t k=0; k<std::max(reference.size(), log.size()); k++) {
+        if ((k >= reference.size()) or (k >= log.size())) {
+            return "decision " + std::to_string(k) + " only made by " + ((k >= log.size()) ? "reference" : "engine");
+        }
+        if (reference[k].seat != log[k].seat) {
+            return "decision " + std::to_string(k) + ": seat " + std::to_string(reference[k].seat) + " vs " + std::to_string(log[k].seat);
+        }
+        std::string const diff = compare_states(reference[k].state, log[k].state);
+        if (not diff.empty()) {
+            return "decision " + std::to_string(k) + " of seat " + std::to_string(log[k].seat) + ": " + diff;
+        }
+    }
+    if (reference_delta != engine_delta) {
+        return "declarer score " + std::to_string(reference_delta) + " vs " + std::to_string(engine_delta);
+    }
+    return "";
+}
+
+bool is_full_deck(std::vector<Cards::Card> const& deck) {
+    return (deck.size() == 32) and (Cards::get_card_mask(deck) == 0xffffffff);
+}
+
+Cards::CardMask const trumps = 0xff | Cards::jacks_mask;
+
+// SplitMix64, seeding a Mersenne Twister per case would cost more than most checks
+struct CaseEngine {
+    using result_type = uint64_t;
+    uint64_t state;
+    CaseEngine(uint64_t const seed, uint64_t const kind, uint64_t const idx) : state(seed ^ (kind << 56) ^ (idx * 0x9e3779b97f4a7c15ull)) {}
+    static constexpr result_type min() { return 0; }
+    static constexpr result_type max() { return ~uint64_t(0); }
+    result_type operator()() {
+        uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        return z ^ (z >> 31);
+    }
+};
+
+// Distinct random cards not in used
+std::vector<Cards::Card> draw(CaseEngine& engine, int const n, Cards::CardMask& used, Cards::CardMask const allowed = 0xffffffff) {
+    std::vector<int> ids;
+    for (int id=0; id<32; id++) {
+        if (((allowed & ~used) >> id) & 1) {
+            ids.push_back(id);
+        }
+    }
+    std::shuffle(ids.begin(), ids.end(), engine);
+    std::vector<Cards::Card> cards;
+    for (int i=0; i<std::min<int>(n, ids.size()); i++) {
+        cards.emplace_back(ids[i]);
+        used |= Cards::CardMask(1) << ids[i];
+    }
+    return cards;
+}
+
+Case get_random_case(CheckKind const kind, CaseEngine& engine) {
+    Case c;
+    c.kind = kind;
+    std::uniform_int_distribution<> seat(0, 2);
+    Cards::CardMask used = 0;
+    switch (kind) {
+        case CheckKind::legal_cards: {
+            int const trick_size = std::uniform_int_distribution<>(0, 2)(engine);
+            c.trick = draw(engine, trick_size, used);
+            for (size_t i=0; i<c.trick.size(); i++) {
+                c.trick[i].played_by = i;
+            }
+            int const n = std::uniform_int_distribution<>(1, HalfSkat::cards_per_player)(engine);
+            Cards::CardMask allowed = 0xffffffff;
+            if (not c.trick.empty()) {
+                // Adversarial hands: void in the led suit (jack of its color included), only jacks, or the jack of the
+                // led color as the only card of that color
+                Cards::Card const& lead = c.trick.front();
+                Cards::CardMask const color = Cards::CardMask(0xff) << 8*(3 - lead.color);
+                Cards::CardMask const suit = ((lead.rank == Cards::Rank::Jack) or (lead.color == trump)) ? trumps : color;
+                switch (std::uniform_int_distribution<>(0, 3)(engine)) {
+                    case 0: allowed = ~suit; break;
+                    case 1: allowed = Cards::jacks_mask; break;
+                    case 2: allowed = (color & Cards::jacks_mask) | ~suit; break;
+                    default: break;
+                }
+            }
+            c.cards = draw(engine, n, used, allowed);
+            if (c.cards.empty()) {
+                c.cards = draw(engine, n, used);
+            }
+            break;
+        }
+        case CheckKind::trick_winner: {
+            c.cards = draw(engine, 3, used);
+            int const first = seat(engine);
+            for (int i=0; i<3; i++) {
+                c.cards[i].played_by = (first + i) % 3;
+            }
+            break;
+        }
+        case CheckKind::game_level: {
+            if (std::bernoulli_distribution(0.5)(engine)) {
+                c.cards = draw(engine, std::uniform_int_distribution<>(1, 32)(engine), used);
+            }
+            else { // Matador sequences broken at a random length
+                c.cards = draw(engine, std::uniform_int_distribution<>(1, 12)(engine), used, trumps);
+                std::vector<Cards::Card> const rest = draw(engine, std::uniform_int_distribution<>(0, 3)(engine), used);
+                c.cards.insert(c.cards.end(), rest.begin(), rest.end());
+            }
+            break;
+        }
+        case CheckKind::deal:
+        case CheckKind::round: {
+            c.cards = draw(engine, 32, used);
+            c.declarer = seat(engine);
+            c.dealer = seat(engine);
+            c.choices.resize(3*HalfSkat::cards_per_player);
+            for (auto& choice : c.choices) {
+                choice = std::uniform_int_distribution<>(0, 255)(engine);
+            }
+            break;
+        }
+    }
+    return c;
+}
+
+// Corner cases checked completely: every ordered trick with every starting seat, every set of trumps and
+// every single-card hand against every one- and two-card trick
+std::vector<Case> get_exhaustive_cases() {
+    std::vector<Case> cases;
+    for (int a=0; a<32; a++) {
+        for (int b=0; b<32; b++) {
+            for (int d=0; (d<32) and (b != a); d++) {
+                if ((d == a) or (d == b)) {
+                    continue;
+                }
+                for (int first=0; first<3; first++) {
+                    Case c;
+                    c.kind = CheckKind::trick_winner;
+                    c.cards = {Cards::Card(a), Cards::Card(b), Cards::Card(d)};
+                    for (int i=0; i<3; i++) {
+                        c.cards[i].played_by = (first + i) % 3;
+                    }
+                    cases.push_back(c);
+                }
+            }
+            for (int h=0; h<32; h++) {
+                if ((h == a) or (h == b)) {
+                    continue;
+                }
+                Case c;
+                c.kind = CheckKind::legal_cards;
+                c.trick = {Cards::Card(a)};
+                if (b != a) {
+                    c.trick.push_back(Cards::Card(b));
+                }
+                c.cards = {Cards::Card(h)};
+                cases.push_back(c);
+            }
+        }
+    }
+    std::vector<Cards::Card> const trump_cards = Cards::get_cards_from_mask(trumps);
+    for (int s=1; s<(1 << trump_cards.size()); s++) {
+        for (bool const filler : {false, true}) {
+            Case c;
+            c.kind = CheckKind::game_level;
+            for (size_t i=0; i<trump_cards.size(); i++) {
+                if ((s >> i) & 1) {
+                    c.cards.push_back(trump_cards[i]);
+                }
+            }
+            if (filler) {
+                std::vector<Cards::Card> const rest = Cards::get_cards_from_mask(~trumps);
+                c.cards.insert(c.cards.end(), rest.begin(), rest.end());
+            }
+            cases.push_back(c);
+        }
+    }
+    return cases;
+}
+
+} // namespace
+
+std::string Differential::compare(Case const& c) {
+    Engine& engine = get_engine();
+    std::ostringstream out;
+    switch (c.kind) {
+        case CheckKind::legal_cards: {
+            HalfSkat::Trick trick;
+            for (auto const& card : c.trick) {
+                trick.push_back(card);
+            }
+            std::vector<Cards::Card> const reference = Reference::get_legal_cards(c.cards, c.trick);
+            std::vector<Cards::Card> const optimized = engine.probe.get_legal_cards(c.cards, trick);
+            if (reference != optimized) {
+                out << "legal cards " << format(reference) << " vs " << format(optimized);
+            }
+            break;
+        }
+        case CheckKind::trick_winner: {
+            int const reference = Reference::get_trick_winner(c.cards);
+            int const optimized = engine.probe.get_trick_winner(c.cards);
+            if (reference != optimized) {
+                out << "trick winner " << reference << " vs " << optimized;
+            }
+            break;
+        }
+        case CheckKind::game_level: {
+            int const reference = Reference::get_game_level(c.cards);
+            int const optimized = engine.probe.get_game_level(c.cards);
+            if (reference != optimized) {
+                out << "game level " << reference << " vs " << optimized;
+            }
+            else if (Reference::get_game_value(c.cards) != engine.probe.get_game_value(c.cards)) {
+                out << "game value " << Reference::get_game_value(c.cards) << " vs " << engine.probe.get_game_value(c.cards);
+            }
+            break;
+        }
+        case CheckKind::deal: {
+            if (not is_full_deck(c.cards)) {
+                return "deck is not a permutation of all cards";
+            }
+            std::array<std::vector<Cards::Card>, 3> reference_hands, hands;
+            std::vector<Cards::Card> reference_skat, skat;
+            Reference::deal(c.cards, reference_hands, reference_skat);
+            engine.probe.deal(c.cards, hands, skat);
+            for (int p=0; p<3; p++) {
+                if (reference_hands[p] != hands[p]) {
+                    out << "hand of seat " << p << " " << format(reference_hands[p]) << " vs " << format(hands[p]);
+                    return out.str();
+                }
+            }
+            if (reference_skat != skat) {
+                out << "skat " << format(reference_skat) << " vs " << format(skat);
+            }
+            break;
+        }
+        case CheckKind::round:
+            return compare_round(c);
+    }
+    return out.str();
+}
+
+Case Differential::shrink(Case const& original, Comparison const& comparison) {
+    Case c = original;
+    bool progress = true;
+    auto attempt = [&](Case const& candidate) {
+        if (not comparison(candidate).empty()) {
+            c = candidate;
+            progress = true;
+        }
+    };
+    while (progress) {
+        progress = false;
+        if ((c.kind == CheckKind::legal_cards) or (c.kind == CheckKind::game_level)) {
+            for (size_t i=c.cards.size(); (i-->0) and (c.cards.size() > 1);) {
+                Case candidate = c;
+                candidate.cards.erase(candidate.cards.begin() + i);
+                attempt(candidate);
+            }
+            if (c.trick.size() > 1) {
+                Case candidate = c;
+                candidate.trick.pop_back();
+                attempt(candidate);
+            }
+        }
+        else if (c.kind == CheckKind::trick_winner) {
+            if (c.cards[0].played_by != 0) {
+                Case candidate = c;
+                for (int i=0; i<3; i++) {
+                    candidate.cards[i].played_by = i;
+                }
+                attempt(candidate);
+            }
+        }
+        else {
+            // Move the deck towards the sorted one, then simplify the choices and seats
+            for (int i=0; i<32; i++) {
+                size_t const j = std::find(c.cards.begin(), c.cards.end(), Cards::Card(i)) - c.cards.begin();
+                if ((j < c.cards.size()) and (j != size_t(i))) {
+                    Case candidate = c;
+                    std::swap(candidate.cards[i], candidate.cards[j]);
+                    attempt(candidate);
+                }
+            }
+            for (size_t k=0; k<c.choices.size(); k++) {
+                if (c.choices[k] != 0) {
+                    Case candidate = c;
+                    candidate.choices[k] = 0;
+                    attempt(candidate);
+                }
+            }
+            if (c.declarer != 0) {
+                Case candidate = c;
+                candidate.declarer = 0;
+                attempt(candidate);
+            }
+            if (c.dealer != 0) {
+                Case candidate = c;
+                candidate.dealer = 0;
+                attempt(candidate);
+            }
+        }
+    }
+    return c;
+}
+
+std::string Differential::to_string(Case const& c) {
+    static char const* const names[] = {"legal_cards", "trick_winner", "game_level", "deal", "round"};
+    std::ostringstream out;
+    out << names[static_cast<int>(c.kind)] << " cards " << format(c.cards);
+    if (c.kind == CheckKind::legal_cards) {
+        out << " trick " << format(c.trick);
+    }
+    if (c.kind == CheckKind::trick_winner) {
+        out << " first seat " << c.cards[0].played_by;
+    }
+    if (c.kind == CheckKind::round) {
+        out << " declarer " << c.declarer << " dealer " << c.dealer << " choices";
+        for (auto const choice : c.choices) {
+            out << " " << int(choice);
+        }
+    }
+    return out.str();
+}
+
+Report Differential::run(Settings const& settings) {
+    Report report;
+    report.seed = (settings.seed != 0) ? settings.seed : std::random_device{}();
+    std::vector<Case> const exhaustive = settings.exhaustive ? get_exhaustive_cases() : std::vector<Case>();
+    std::array<long, 5> const counts = {{settings.positions, settings.positions, settings.positions, settings.positions, settings.rounds}};
+    long const total = exhaustive.size() + counts[0] + counts[1] + counts[2] + counts[3] + counts[4];
+    long const chunk = 1024;
+    std::atomic<long> next{0};
+    std::atomic<bool> stop{false};
+    std::mutex mutex;
+    std::vector<Divergence> found;
+    Parallel::run_on_threads(Parallel::get_num_threads(settings.threads), stop, [&](int) {
+        std::array<long, 5> checks = {{0, 0, 0, 0, 0}};
+        while (not stop) {
+            long const begin = next.fetch_add(chunk);
+            if (begin >= total) {
+                break;
+            }
+            for (long i=begin; (i<std::min(begin + chunk, total)) and (not stop); i++) {
+                Case c;
+                if (i < static_cast<long>(exhaustive.size())) {
+                    c = exhaustive[i];
+                }
+                else {
+                    // Random cases only depend on seed, kind and index, so they can be regenerated
+                    long idx = i - exhaustive.size();
+                    int kind = 0;
+                    while (idx >= counts[kind]) {
+                        idx -= counts[kind++];
+                    }
+                    CaseEngine engine(report.seed, kind, idx);
+                    c = get_random_case(static_cast<CheckKind>(kind), engine);
+                }
+                checks[static_cast<int>(c.kind)]++;
+                std::string const diff = compare(c);
+                if (not diff.empty()) {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    found.push_back({c, c, diff});
+                    if (static_cast<int>(found.size()) >= settings.max_divergences) {
+                        stop = true;
+                    }
+                }
+            }
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        for (int k=0; k<5; k++) {
+            report.checks[k] += checks[k];
+        }
+    });
+    for (auto& d : found) {
+        d.reduced = shrink(d.original);
+        d.description = compare(d.reduced);
+    }
+    report.divergences = found;
+    return report;
+}
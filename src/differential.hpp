@@ -0,0 +1,71 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "cards.hpp"
+#include "halfskat.hpp"
+
+// Differential testing of the HalfSkat rules engine against the straightforward implementation it started from
+namespace Differential {
+
+// The original card-list implementation (clubs are trump), kept as oracle and never optimized.
+// Only stated rule changes are applied here, currently one: jacks don't follow suit when their color is led.
+namespace Reference {
+
+std::vector<Cards::Card> get_legal_cards(std::vector<Cards::Card> const& hand, std::vector<Cards::Card> const& trick);
+// Seat (played_by) of the winner of a full trick
+int get_trick_winner(std::vector<Cards::Card> const& trick);
+int get_game_level(std::vector<Cards::Card> const& cards);
+int get_game_value(std::vector<Cards::Card> const& cards);
+// Ten cards per seat in seat order, then the Skat; hands sorted like the engine shows them
+void deal(std::vector<Cards::Card> const& deck, std::array<std::vector<Cards::Card>, 3>& hands, std::vector<Cards::Card>& skat);
+
+} // namespace Reference
+
+enum class CheckKind { legal_cards, trick_winner, game_level, deal, round };
+
+// A single position or round; rounds choose legal_cards[choices[k] % count] (ascending card ids) at decision k
+struct Case {
+    CheckKind kind = CheckKind::round;
+    std::vector<Cards::Card> cards; // Hand, trick, counted cards or deck depending on the kind
+    std::vector<Cards::Card> trick; // Played cards before the hand has to act (legal_cards only)
+    int declarer = 0;
+    int dealer = 0;
+    std::vector<uint8_t> choices;
+};
+
+struct Divergence {
+    Case original;
+    Case reduced; // Shrunk while it still diverges
+    std::string description; // First differing intermediate result of the reduced case
+};
+
+struct Settings {
+    long positions = 1000000; // Random positions per kind for legal_cards, trick_winner, game_level and deal
+    long rounds = 100000; // Random rounds played by both engines in lockstep
+    bool exhaustive = true; // Also all ordered tricks and all trump sets (adversarial corner cases)
+    int threads = 0; // Zero uses all cores
+    unsigned seed = 0; // Zero draws a random seed
+    int max_divergences = 10; // Stops after this many
+};
+
+struct Report {
+    std::array<long, 5> checks = {{0, 0, 0, 0, 0}}; // Indexed by CheckKind
+    std::vector<Divergence> divergences;
+    unsigned seed = 0;
+};
+
+// Empty if both engines agree on the case, otherwise a description of the first difference
+std::string compare(Case const& c);
+using Comparison = std::function<std::string(Case const&)>;
+// Greedily simplifies a diverging case (fewer cards, deck closer to sorted, zero choices) while comparison still
+// reports a divergence
+Case shrink(Case const& c, Comparison const& comparison = compare);
+std::string to_string(Case const& c);
+Report run(Settings const& settings);
+
+} // namespace Differential
@@ -5,23 +5,77 @@
 
 #include "halfskat.hpp"
 #include "cards.hpp"
+#include "policycache.hpp"
+#include "scenario.hpp"
+#include "serialization.hpp"
+#include "stats.hpp"
 
 
 namespace logging = boost::log;
 using namespace HalfSkat;
 
-Cards::Card Player::get_action(ObservableState const& state, int player_id) {
-    m_last_state = PlayerState(state, m_cards, player_id);
-    Cards::Card action = query_policy();
+Cards::Card Player::get_action(ObservableState const& state, Cards::CardMask const legal_cards, int player_id) {
+    m_last_state = PlayerState(state, m_cards, legal_cards, player_id);
+    m_last_role = (player_id - state.declarer + 3) % 3;
+    Cards::Card action = m_policy_cache ? query_cached_policy() : query_policy();
     m_last_action = action;
     m_await_transition = true;
     return action;
 }
 
-void Player::put_transition(int const reward, ObservableState const& new_state, int player_id) {
+Cards::Card Player::get_delegated_action(PlayerState const& state) {
+    m_cards = Cards::get_cards_from_mask(state.hole_cards);
+    m_last_state = state;
+    m_last_action = m_policy_cache ? query_cached_policy() : query_policy();
+    return m_last_action;
+}
+
+// Samples from the cached distribution of the legal cards, the policy is only asked on misses
+Cards::Card Player::query_cached_policy() {
+    std::vector<Cards::Card> const legal = Cards::get_cards_from_mask(m_last_state.legal_cards);
+    if (legal.size() == 1) {
+        m_policy_cache->count_forced();
+        return legal[0];
+    }
+    if (legal.size() > PolicyCache::max_legal_cards) {
+        return query_policy();
+    }
+    uint64_t const key = PolicyCache::get_key(m_last_state, m_policy_id, get_policy_version());
+    PolicyCache::Probabilities probs;
+    if (not m_policy_cache->find(key, probs)) {
+        std::vector<float> const distribution = query_distribution();
+        if (distribution.empty()) {
+            return query_policy();
+        }
+        if (distribution.size() != 32) {
+            throw std::runtime_error("Distribution must have one probability per card.");
+        }
+        float sum = 0.f;
+        for (size_t i=0; i<legal.size(); i++) {
+            probs[i] = std::max(0.f, distribution[Cards::get_card_id(legal[i])]);
+            sum += probs[i];
+        }
+        // Like PolicyPlayer, renormalized over the legal cards and uniform if the policy gives them no mass
+        for (size_t i=0; i<legal.size(); i++) {
+            probs[i] = (sum > 0.f) ? probs[i] / sum : 1.f / legal.size();
+        }
+        m_policy_cache->insert(key, probs);
+    }
+    float const r = draw_uniform();
+    float cumulative = 0.f;
+    for (size_t i=0; i+1<legal.size(); i++) {
+        cumulative += probs[i];
+        if (r < cumulative) {
+            return legal[i];
+        }
+    }
+    return legal.back();
+}
+
+void Player::put_transition(int const reward, ObservableState const& new_state, Cards::CardMask const legal_cards, int player_id) {
     if (m_await_transition) {
         BOOST_LOG_TRIVIAL(debug) << "Putting new transition for player " << std::to_string(player_id) << ", reward: " << std::to_string(reward) << ", action: " << m_last_action;
-        m_transitions.push_back(Transition(m_last_state, PlayerState(new_state, m_cards, player_id), reward, m_last_action));
+        m_transitions.push_back(Transition(m_last_state, PlayerState(new_state, m_cards, legal_cards, player_id), reward, m_last_action));
         m_await_transition = false;
     }
 }
@@ -38,24 +92,60 @@ Cards::Card HumanPlayer::query_policy() {
     BOOST_LOG_TRIVIAL(info) << "\nYour current cards: " << m_cards;
     BOOST_LOG_TRIVIAL(info) << "\nEnter card to play: ";
     std::string input;
-    size_t num;
+    size_t num = 0;
     bool valid_input = false;
     while (not valid_input) {
         std::getline(std::cin, input);
         try {
             num = std::stoi(input);
         }
-        catch (std::invalid_argument const&) {}
+        catch (std::logic_error const&) { // Not a number or out of range
+            num = 0;
+        }
         if ((num <= m_cards.size()) and (num >= 1)) {
-            return m_cards.at(num-1);
+            if (Cards::in_mask(m_last_state.legal_cards, m_cards.at(num-1))) {
+                return m_cards.at(num-1);
+            }
+            BOOST_LOG_TRIVIAL(info) << "\nThis card may not be played now. Try again: ";
+            continue;
         }
         BOOST_LOG_TRIVIAL(info) << "\nEnter valid number. Try again: ";
     }
     throw std::runtime_error("\nCould not get action.");
 }
 
+int Player::query_bid_limit() {
+    Cards::CardMask const hand = Cards::get_card_mask(m_cards);
+    Contract const contract = get_longest_suit_contract(hand);
+    if (Cards::count_cards(hand & get_trumps(contract)) < 6) {
+        return 0;
+    }
+    return get_base_value(contract) * (get_matadors(contract, hand) + 1);
+}
+
+bool Player::query_pickup_skat() {
+    return true;
+}
 
-Game::Game(int const max_rounds, bool const retry_on_illegal_action) : max_rounds(max_rounds), retry_on_illegal(retry_on_illegal_action) {
+Cards::CardMask Player::query_discard() {
+    // Put away the two cheapest cards that aren't trumps of the longest suit
+    Cards::CardMask const trumps = get_trumps(get_longest_suit_contract(Cards::get_card_mask(m_cards)));
+    std::vector<Cards::Card> cards = m_cards;
+    std::sort(cards.begin(), cards.end(), [trumps](Cards::Card const& l, Cards::Card const& r) {
+        int const l_key = 100*Cards::in_mask(trumps, l) + Cards::get_card_points(Cards::get_card_bit(l));
+        int const r_key = 100*Cards::in_mask(trumps, r) + Cards::get_card_points(Cards::get_card_bit(r));
+        return l_key < r_key;
+    });
+    return Cards::get_card_bit(cards[0]) | Cards::get_card_bit(cards[1]);
+}
+
+Contract Player::query_contract(bool const hand) {
+    return Contract(get_longest_suit_contract(Cards::get_card_mask(m_cards)).type, hand);
+}
+
+
+template<typename Variant>
+BasicGame<Variant>::BasicGame(int const max_rounds, bool const retry_on_illegal_action, bool const expect_legal_actions) : max_rounds(max_rounds), retry_on_illegal(retry_on_illegal_action), expect_legal(expect_legal_actions) {
     BOOST_LOG_TRIVIAL(info) << "Constructing new fully random Game.";
     players[0] = std::make_shared<RandomPlayer>();
     players[1] = std::make_shared<RandomPlayer>();
@@ -64,7 +154,8 @@ Game::Game(int const max_rounds, bool const retry_on_illegal_action) : max_round
     reset_players();
 }
 
-Game::Game(std::shared_ptr<Player> first_player, std::shared_ptr<Player> second_player, std::shared_ptr<Player> third_player, int const max_rounds, bool retry_on_illegal_action) : max_rounds(max_rounds), retry_on_illegal(retry_on_illegal_action) {
+template<typename Variant>
+BasicGame<Variant>::BasicGame(std::shared_ptr<Player> first_player, std::shared_ptr<Player> second_player, std::shared_ptr<Player> third_player, int const max_rounds, bool retry_on_illegal_action, bool const expect_legal_actions) : max_rounds(max_rounds), retry_on_illegal(retry_on_illegal_action), expect_legal(expect_legal_actions) {
     players[0] = first_player;
     players[1] = second_player;
     players[2] = third_player;
@@ -72,86 +163,71 @@ Game::Game(std::shared_ptr<Player> first_player, std::shared_ptr<Player> second_
     reset_players();
 }
 
-ObservableState Game::get_observable_state() const {
-    return ObservableState(won_cards, trick, dealer, declarer);
+template<typename Variant>
+std::vector<Cards::Card> BasicGame<Variant>::get_legal_cards(std::vector<Cards::Card> const& players_cards) const {
+    return get_legal_cards(players_cards, public_state.trick);
+}
+
+template<typename Variant>
+std::vector<Cards::Card> BasicGame<Variant>::get_legal_cards(std::vector<Cards::Card> const& players_cards, Trick const& trick) const {
+    Cards::CardMask const legal_mask = get_legal_mask(Cards::get_card_mask(players_cards), trick);
+    std::vector<Cards::Card> legals;
+    std::copy_if(players_cards.begin(), players_cards.end(), std::back_inserter(legals), [legal_mask](Cards::Card const& c) {
+        return Cards::in_mask(legal_mask, c);
+    });
+    return legals;
 }
 
-std::vector<Cards::Card> Game::get_legal_cards(std::vector<Cards::Card> const& players_cards) const {
-    std::vector<Cards::Card> copy = players_cards;
+template<typename Variant>
+Cards::CardMask BasicGame<Variant>::get_legal_mask(Cards::CardMask const players_cards, Trick const& trick) const {
     if (trick.empty()) { // No card played yet
-        return copy;
-    }
-    Cards::Color sc = trick.front().color; // First card determines color to be played
-    Cards::Rank sr = trick.front().rank;
-    // First, determine cards that would follow suit
-    std::vector<Cards::Card> legals = copy;
-    if ((sr == Cards::Rank::Jack) or (sc == trump)) { // Trump is single suit
-        legals.erase(std::remove_if(legals.begin(), legals.end(), [this](Cards::Card const& c) {
-            return ((c.rank != Cards::Rank::Jack) and (c.color != this->trump));
-        }), legals.end());
-    }
-    else {
-        legals.erase(std::remove_if(legals.begin(), legals.end(), [sc](Cards::Card const& c) {
-            return (c.color != sc);
-        }), legals.end());
-    }
-    // Check if player can follow suit
-    bool legal_found = !legals.empty();
-    if (legal_found) { // Player can follow suit
-        return legals;
-    }
-    else { // Player cannot follow suit
-        return copy;
+        return players_cards;
     }
+    // First card determines suit to be followed. Jacks only ever follow trumps, also when their own color is led.
+    return Variant::dispatch(public_state.contract, [&](auto rules) { return decltype(rules)::get_legal_mask(players_cards, trick.front()); });
 }
 
-bool Game::trump_in_trick() const {
-    for (auto const& c: trick) {
-        if ((c.color == trump) or (c.rank == Cards::Rank::Jack)) {
-            return true;
-        }
-    }
-    return false;
+template<typename Variant>
+Cards::CardMask BasicGame<Variant>::get_legal_mask(int const player) const {
+    return get_legal_mask(Cards::get_card_mask(players[player]->m_cards), public_state.trick);
 }
 
-int Game::get_trick_winner() {
-    if (trick.size() != 3) {
+template<typename Variant>
+bool BasicGame<Variant>::trump_in_trick() const {
+    return Variant::dispatch(public_state.contract, [&](auto rules) { return decltype(rules)::has_trump(public_state.trick.get_mask()); });
+}
+
+template<typename Variant>
+int BasicGame<Variant>::get_trick_winner() {
+    if (public_state.trick.size() != 3) {
         throw std::runtime_error("Trick is not full yet");
     }
-    if (trick.size() > 3) {
-        throw std::runtime_error("Trick is too full");
-    }
-    // First, update trick hierarchy
-    for (auto& c: trick_hierarchy) {
-        if (c.rank != Cards::Rank::Jack) {
-            if (trump_in_trick()) {
-                c.color = trump;
-            }
-            else {
-                c.color = trick.front().color;
-            }
+    size_t const idx = Variant::dispatch(public_state.contract, [&](auto rules) { return decltype(rules)::get_winner_index(public_state.trick); });
+    Cards::Card const& c = public_state.trick[idx];
+    int winner = c.played_by;
+    BOOST_LOG_TRIVIAL(info) << "Determined winning card to be: " << c;
+    BOOST_LOG_TRIVIAL(info) << "Determined winning player to be: " << std::to_string(winner);
+    return winner;
+}
+
+template<typename Variant>
+bool BasicGame<Variant>::declarer_has_won_round() const {
+    Cards::CardMask const won = public_state.won_cards[public_state.declarer];
+    if (Variant::has_bidding) {
+        if (get_round_value() < bid) { // Overbid
+            return false;
         }
-        // Find highest card in trick
-        std::vector<Cards::Card>::iterator it;
-        it = std::find(trick.begin(), trick.end(), c);
-        if (it != trick.end()) {
-            int winner = it->played_by;
-            BOOST_LOG_TRIVIAL(info) << "Determined winning card to be: " << c;
-            BOOST_LOG_TRIVIAL(info) << "Determined winning player to be: " << std::to_string(winner);
-            return winner;
+        if (public_state.contract.type == null_game) { // Declarer must not take a single trick
+            return (won & ~Cards::get_card_mask(skat)) == 0;
         }
     }
-
-    throw std::runtime_error("Failed to find winning card");
-}
-
-bool Game::declarer_has_won_round() const {
     int declarer_points;
-    declarer_points = Cards::get_card_points(won_cards[declarer]);
+    declarer_points = Cards::get_card_points(won);
     return (declarer_points >= 61);
 }
 
-int Game::get_game_winner() const { 
+template<typename Variant>
+int BasicGame<Variant>::get_game_winner() const { 
     if (round <= max_rounds) { 
         BOOST_LOG_TRIVIAL(error) << "Game is not finished yet";
         return -1;
@@ -159,45 +235,72 @@ int Game::get_game_winner() const {
     return std::distance(points.begin(), std::max_element(points.begin(), points.end()));
 }
 
-int Game::get_game_value(std::vector<Cards::Card> const& cards) const {
-    int base_value = Cards::get_suit_base_value(trump);
+template<typename Variant>
+int BasicGame<Variant>::get_game_value(std::vector<Cards::Card> const& cards) const {
+    return get_game_value(Cards::get_card_mask(cards));
+}
+
+template<typename Variant>
+int BasicGame<Variant>::get_game_value(Cards::CardMask const cards) const {
+    int base_value = Variant::dispatch(public_state.contract, [](auto rules) { return decltype(rules)::tables.base_value; });
     return base_value * get_game_level(cards);
 }
 
-int Game::get_game_level(std::vector<Cards::Card> const& cards) const {
-    assert(cards.empty() == false);
-    int game_level = 1;
-    Cards::Card const clubs_jack{Cards::Color::Clubs, Cards::Rank::Jack};
-    bool has_jack_clubs = (std::find(cards.begin(), cards.end(), clubs_jack) != cards.end());
-    std::array<Cards::Card, 10> const cards_to_find {{{Cards::Color::Spades, Cards::Rank::Jack}, 
-        {Cards::Color::Hearts, Cards::Rank::Jack},
-        {Cards::Color::Diamonds, Cards::Rank::Jack},
-        {trump, Cards::Rank::Ace},
-        {trump, Cards::Rank::Ten},
-        {trump, Cards::Rank::King},
-        {trump, Cards::Rank::Queen},
-        {trump, Cards::Rank::Nine},
-        {trump, Cards::Rank::Eight},
-        {trump, Cards::Rank::Seven}}};
-    bool found;
-    for (auto c: cards_to_find) {
-        found = (std::find(cards.begin(), cards.end(), c) != cards.end());
-        if ((found and has_jack_clubs) or (not found and not has_jack_clubs)) {
-            game_level++;
-        }
-        else {
-            return game_level; // Straight broken
-        }
+template<typename Variant>
+int BasicGame<Variant>::get_game_level(std::vector<Cards::Card> const& cards) const {
+    return get_game_level(Cards::get_card_mask(cards));
+}
+
+// Number of matadors: top trumps held ("with") or missing ("without") in an unbroken sequence
+template<typename Variant>
+int BasicGame<Variant>::get_game_level(Cards::CardMask const cards) const {
+    assert(cards != 0);
+    return Variant::dispatch(public_state.contract, [cards](auto rules) { return decltype(rules)::get_matadors(cards); });
+}
+
+// Value of the round as played, HalfSkat counts matadors on the won cards only
+template<typename Variant>
+int BasicGame<Variant>::get_round_value() const {
+    int const declarer = public_state.declarer;
+    Cards::CardMask const won = public_state.won_cards[declarer];
+    if (not Variant::has_bidding) {
+        return get_game_value(won);
+    }
+    Contract const& contract = public_state.contract;
+    if (contract.type == null_game) {
+        return contract.hand ? 35 : 23;
+    }
+    Cards::CardMask const lost = public_state.won_cards[(declarer+1)%3] | public_state.won_cards[(declarer+2)%3];
+    int const declarer_points = Cards::get_card_points(won);
+    int level = get_game_level(declarer_cards) + 1 + (contract.hand ? 1 : 0); // Matadors, game and hand
+    if ((declarer_points >= 90) or (declarer_points <= 30)) { // Schneider
+        level++;
     }
-    return game_level;
+    if ((lost == 0) or ((won & ~Cards::get_card_mask(skat)) == 0)) { // Schwarz
+        level++;
+    }
+    return get_base_value(contract) * level;
 }
 
-void Game::step_by_trick() {
+template<typename Variant>
+void BasicGame<Variant>::step_by_trick() {
     BOOST_LOG_TRIVIAL(info) << "====================================================================================";
     BOOST_LOG_TRIVIAL(info) << "Performing game step in round " << std::to_string(round);
+    if (Variant::has_bidding and auction_pending) {
+        auction_pending = false;
+        if (not run_auction()) {
+            // Like in a Skat list the passed round counts as played: nobody scores and the deal moves on
+            BOOST_LOG_TRIVIAL(info) << "All players passed, dealing again";
+            if (stats) {
+                stats->local().count_passed_round();
+            }
+            start_next_round();
+            return;
+        }
+    }
     // First, determine input for player
     bool current_player_is_declarer;
-    if (current_player == declarer) {
+    if (current_player == public_state.declarer) {
         // No players are friendly
         current_player_is_declarer = true;
     }
@@ -206,36 +309,37 @@ void Game::step_by_trick() {
         current_player_is_declarer = false;
     }
     BOOST_LOG_TRIVIAL(info) << "Current round: " <<  round;
-    BOOST_LOG_TRIVIAL(info) << "Current trick: " <<  trick;
+    BOOST_LOG_TRIVIAL(info) << "Current trick: " <<  public_state.trick.to_vector();
     BOOST_LOG_TRIVIAL(info) << "Trick played by: ";
-    for (auto c : trick) {
+    for (auto c : public_state.trick) {
         BOOST_LOG_TRIVIAL(info) << std::to_string(c.played_by) << " ";
     }
     BOOST_LOG_TRIVIAL(info) << "Current player: " <<  std::to_string(current_player);
-    BOOST_LOG_TRIVIAL(info) << "Current dealer: " <<  std::to_string(dealer);
-    BOOST_LOG_TRIVIAL(info) << "Current declarer: " <<  std::to_string(declarer);
+    BOOST_LOG_TRIVIAL(info) << "Current dealer: " <<  std::to_string(public_state.dealer);
+    BOOST_LOG_TRIVIAL(info) << "Current declarer: " <<  std::to_string(public_state.declarer);
     BOOST_LOG_TRIVIAL(debug) << "Current player is declarer: " <<  current_player_is_declarer;
     BOOST_LOG_TRIVIAL(debug) << "First player hand: " << players[0]->m_cards;
     BOOST_LOG_TRIVIAL(debug) << "Second player hand: " << players[1]->m_cards;
     BOOST_LOG_TRIVIAL(debug) << "Third player hand: " << players[2]->m_cards;
-    BOOST_LOG_TRIVIAL(debug) << "First player won: " << won_cards[0];
-    BOOST_LOG_TRIVIAL(debug) << "Second player won: " << won_cards[1];
-    BOOST_LOG_TRIVIAL(debug) << "Third player won: " << won_cards[2];
+    BOOST_LOG_TRIVIAL(debug) << "First player won: " << Cards::get_cards_from_mask(public_state.won_cards[0]);
+    BOOST_LOG_TRIVIAL(debug) << "Second player won: " << Cards::get_cards_from_mask(public_state.won_cards[1]);
+    BOOST_LOG_TRIVIAL(debug) << "Third player won: " << Cards::get_cards_from_mask(public_state.won_cards[2]);
     // Get card player wants to play
     Cards::Card played_card;
-    std::vector<Cards::Card> legal_cards;
     bool in_legals = false;
-    state_before = get_observable_state();
+    // Legal cards don't change while retrying, the mask is handed to the player with the state
+    Cards::CardMask const legal_mask = get_legal_mask(current_player);
     while (not in_legals) {
-        played_card = players[current_player]->get_action(state_before, current_player);
+        played_card = players[current_player]->get_action(public_state, legal_mask, current_player);
         BOOST_LOG_TRIVIAL(debug) << "Player wants to play " << played_card;
         // Check if legal move
-        legal_cards = get_legal_cards(players[current_player]->m_cards);
-        BOOST_LOG_TRIVIAL(debug) << "Legal cards: " << legal_cards;
-        in_legals = (std::find(legal_cards.begin(), legal_cards.end(), played_card) != legal_cards.end());
+        in_legals = Cards::in_mask(legal_mask, played_card);
         BOOST_LOG_TRIVIAL(debug) << "This move is legal: " << in_legals;
         if (not in_legals) {
             BOOST_LOG_TRIVIAL(info) << "Player wants to play illegal card: " << played_card;
+            if (expect_legal) {
+                throw std::runtime_error("Player ignored legal card mask.");
+            }
         }
         if (not retry_on_illegal) break;
     }
@@ -243,30 +347,40 @@ void Game::step_by_trick() {
     played_card.played_by = current_player;
     if (not in_legals) { // Abort game, illegal move
         state = early_abort;
-        players[current_player]->put_transition(-1, get_observable_state(), current_player);
+        if (stats) {
+            stats->local().count_abort(current_player);
+        }
+        players[current_player]->put_transition(-1, get_observable_state(), get_legal_mask(current_player), current_player);
         int other_player = (current_player+1) % 3;
-        players[other_player]->put_transition(0, get_observable_state(), other_player);
+        players[other_player]->put_transition(0, get_observable_state(), get_legal_mask(other_player), other_player);
         other_player = (other_player+1) % 3;
-        players[other_player]->put_transition(0, get_observable_state(), other_player);
+        players[other_player]->put_transition(0, get_observable_state(), get_legal_mask(other_player), other_player);
         BOOST_LOG_TRIVIAL(debug) << "Early game abort, resetting cards";
         reset_cards();
         return;
     }
-    trick.push_back(played_card);
+    record.plays[3*tricks_played + public_state.trick.size()] = Cards::get_card_id(played_card);
+    public_state.trick.push_back(played_card);
     BOOST_LOG_TRIVIAL(info) << "Player plays following card: " << played_card;
-    if (trick.size() == 3) { // End of trick reached
-        BOOST_LOG_TRIVIAL(info) << "End of trick reached: " << trick;
-        // Determine winner and manage cards
+    if (stats) {
+        stats->local().count_play(tricks_played, Cards::get_card_id(played_card));
+    }
+    if (public_state.trick.size() == 3) { // End of trick reached
+        BOOST_LOG_TRIVIAL(info) << "End of trick reached: " << public_state.trick.to_vector();
+        // Determine winner and manage cards, public state is updated in place
         int winner = get_trick_winner();
-        won_cards[winner].insert(won_cards[winner].end(), trick.begin(), trick.end());
-        trick.clear();
+        if (stats) {
+            Cards::Card const& lead = public_state.trick.front();
+            stats->local().count_trick(Cards::get_card_id(lead), (winner - lead.played_by + 3) % 3);
+        }
+        public_state.won_cards[winner] |= public_state.trick.get_mask();
+        public_state.trick.clear();
         tricks_played++;
         current_player = winner;
-        state_after = get_observable_state();
         // Provide state transitions to players 
         if ((round != max_rounds) and (tricks_played != cards_per_player)) { // Only if game isn't over
             for (size_t i=0; i<players.size(); i++) {
-                players[i]->put_transition(0, state_after, i);
+                players[i]->put_transition(0, public_state, get_legal_mask(i), i);
             }
         }
     } 
@@ -278,7 +392,8 @@ void Game::step_by_trick() {
     return;
 }
 
-void Game::step_by_round() {
+template<typename Variant>
+void BasicGame<Variant>::step_by_round() {
     int starting_round = round;
     while (round == starting_round) {
         step_by_trick();
@@ -288,37 +403,112 @@ void Game::step_by_round() {
         if (tricks_played == cards_per_player) { // Round finished
             BOOST_LOG_TRIVIAL(info) << "End of round reached.";
             // Declarer receives the Skat
-            won_cards[declarer].insert(won_cards[declarer].end(), skat.begin(), skat.end());
+            public_state.won_cards[public_state.declarer] |= Cards::get_card_mask(skat);
             bool declarer_win = declarer_has_won_round();
             BOOST_LOG_TRIVIAL(info) << "Declarer has won: " << declarer_win;
-            int game_value = get_game_value(won_cards[declarer]);
+            int game_value = get_round_value();
+            if (Variant::has_bidding and (game_value < bid) and (public_state.contract.type != null_game)) {
+                // Overbid games are lost with the lowest multiple of their base value reaching the bid
+                int const base_value = get_base_value(public_state.contract);
+                game_value = base_value * ((bid + base_value - 1) / base_value);
+            }
             BOOST_LOG_TRIVIAL(info) << "Calculated game value: " << std::to_string(game_value);
+            if (stats) {
+                // HalfSkat counts matadors on the won cards, Skat on the declarer's hand and Skat
+                Cards::CardMask const won = public_state.won_cards[public_state.declarer];
+                int const level = get_game_level(Variant::has_bidding ? declarer_cards : won);
+                stats->local().count_round(public_state.declarer, level, Cards::get_card_points(won), declarer_win);
+            }
             if (declarer_win) {
-                points[declarer] += game_value;
+                points[public_state.declarer] += game_value;
             }
             else {
-                points[declarer] -= 2*game_value;
+                points[public_state.declarer] -= 2*game_value;
             }
             BOOST_LOG_TRIVIAL(info) << "New game points: " << std::to_string(points[0]) << ", " << std::to_string(points[1]) << ", " << std::to_string(points[2]);
-            round++;
-            // Reset cards and move player designations if game isn't finished 
-            if (round <= max_rounds) {
-                reset_cards();
-                // Set declarer, dealer to next player
-                declarer = (declarer + 1) % 3;
-                dealer = (dealer + 1) % 3;
-                current_player = (dealer + 1) % 3;
-                tricks_played = 0;
+            if (recorder) {
+                record.declarer = public_state.declarer;
+                record.dealer = public_state.dealer;
+                recorder->write(record);
             }
+            start_next_round();
         }
     }
     return;
 }
 
-void Game::run_new_game() {
+template<typename Variant>
+void BasicGame<Variant>::start_next_round() {
+    round++;
+    // Move player designations and reset cards if game isn't finished, deal sources need the new declarer
+    if (round <= max_rounds) {
+        // Set declarer, dealer to next player
+        public_state.declarer = (public_state.declarer + 1) % 3;
+        public_state.dealer = (public_state.dealer + 1) % 3;
+        current_player = (public_state.dealer + 1) % 3;
+        tricks_played = 0;
+        reset_cards();
+    }
+}
+
+// Limit bidding: every player names the highest bid it holds, then the auction is played out in the usual order.
+// Middlehand bids to forehand, rearhand to the winner, and the listener holds as long as the bid is within its limit.
+template<typename Variant>
+bool BasicGame<Variant>::run_auction() {
+    int const forehand = (public_state.dealer + 1) % 3;
+    int const middlehand = (public_state.dealer + 2) % 3;
+    int const rearhand = public_state.dealer;
+    std::array<int, 3> limits;
+    for (int i=0; i<3; i++) {
+        limits[i] = get_highest_bid(players[i]->query_bid_limit());
+    }
+    int holder = forehand;
+    int value = 0;
+    for (int const bidder : {middlehand, rearhand}) {
+        if (limits[bidder] <= value) { // Passes
+            continue;
+        }
+        if (limits[holder] >= limits[bidder]) {
+            value = limits[bidder];
+        }
+        else {
+            value = get_next_bid(std::max(limits[holder], value));
+            holder = bidder;
+        }
+    }
+    if (value == 0) { // Nobody bid, forehand may still play for the lowest bid
+        if (limits[forehand] == 0) {
+            return false;
+        }
+        value = get_bid_values().front();
+    }
+    bid = value;
+    public_state.declarer = holder;
+    Player& declarer = *players[holder];
+    bool const hand = not declarer.query_pickup_skat();
+    if (not hand) {
+        declarer.m_cards.insert(declarer.m_cards.end(), skat.begin(), skat.end());
+        Cards::CardMask const cards = Cards::get_card_mask(declarer.m_cards);
+        Cards::CardMask const discard = declarer.query_discard();
+        if ((Cards::count_cards(discard) != cards_in_skat) or ((discard & ~cards) != 0)) {
+            throw std::runtime_error("Declarer must put away two of its cards.");
+        }
+        skat = Cards::get_cards_from_mask(discard);
+        declarer.m_cards = Cards::get_cards_from_mask(cards & ~discard);
+    }
+    public_state.contract = declarer.query_contract(hand);
+    public_state.contract.hand = hand;
+    declarer_cards = Cards::get_card_mask(declarer.m_cards) | Cards::get_card_mask(skat);
+    sort_hands();
+    BOOST_LOG_TRIVIAL(info) << "Player " << std::to_string(holder) << " declares game type " << std::to_string(public_state.contract.type) << " for bid " << std::to_string(bid);
+    return true;
+}
+
+template<typename Variant>
+void BasicGame<Variant>::run_new_game() {
+    reset_players();
     reset_cards();
     reset_points();
-    reset_players();
     state = ongoing;
     game_winner = -1;
     round = 0;
@@ -326,7 +516,8 @@ void Game::run_new_game() {
     step_by_game();
 }
 
-void Game::step_by_game() { 
+template<typename Variant>
+void BasicGame<Variant>::step_by_game() { 
     while (state == ongoing) {
         step_by_round();
         if (state == early_abort) {
@@ -336,56 +527,244 @@ void Game::step_by_game() {
             game_winner = get_game_winner();
             int not_winner = (game_winner + 1) % 3;
             int also_not_winner = (game_winner + 2) % 3;
-            players[game_winner]->put_transition(+1, state_after, game_winner);
-            players[not_winner]->put_transition(-1, state_after, not_winner);
-            players[also_not_winner]->put_transition(-1, state_after, also_not_winner);
+            players[game_winner]->put_transition(+1, public_state, get_legal_mask(game_winner), game_winner);
+            players[not_winner]->put_transition(-1, public_state, get_legal_mask(not_winner), not_winner);
+            players[also_not_winner]->put_transition(-1, public_state, get_legal_mask(also_not_winner), also_not_winner);
             state = finished;
+            if (stats) {
+                stats->local().count_game(game_winner);
+            }
             BOOST_LOG_TRIVIAL(info) << "Game finished -- winner: " << std::to_string(game_winner);
         }
     }
     return;
 }
 
-void Game::reset_points() {
+template<typename Variant>
+void BasicGame<Variant>::reset_points() {
     for (auto& p: points) {
         p = 0;
     }
 }
-void Game::reset_players() {
+template<typename Variant>
+void BasicGame<Variant>::reset_players() {
     std::uniform_int_distribution<> distr(0, 2);
-    declarer = distr(rng);
-    dealer = distr(rng);
-    current_player = (dealer+1) % 3;
+    public_state.declarer = distr(rng);
+    public_state.dealer = distr(rng);
+    current_player = (public_state.dealer+1) % 3;
 }
-void Game::reset_cards() {
-    trick.clear();
-    for (auto& wc: won_cards) {
-        wc.clear();
+template<typename Variant>
+void BasicGame<Variant>::reset_cards() {
+    if (deal_source) {
+        // The declarer of variants with bidding is only known after the auction, forehand takes its role
+        deal_cards(deal_source->get_deck(Variant::has_bidding ? (public_state.dealer + 1) % 3 : public_state.declarer));
+    }
+    else {
+        deal_cards(Cards::get_full_shuffled_deck());
     }
-    // Generate cards
-    std::vector<Cards::Card> cards = Cards::get_full_shuffled_deck();
+}
+
+// Starts a new round with the given deck (ten cards per seat in seat order, then the skat) and player designations
+template<typename Variant>
+void BasicGame<Variant>::deal_round(std::vector<Cards::Card> const& deck, int const new_declarer, int const new_dealer) {
+    if (deck.size() != (cards_per_player*3 + cards_in_skat)) {
+        throw std::runtime_error("Deck must contain 32 cards.");
+    }
+    deal_cards(deck);
+    public_state.declarer = new_declarer;
+    public_state.dealer = new_dealer;
+    current_player = (public_state.dealer+1) % 3;
+    tricks_played = 0;
+    state = ongoing;
+}
+
+template<typename Variant>
+void BasicGame<Variant>::deal_cards(std::vector<Cards::Card> const& cards) {
+    auction_pending = Variant::has_bidding;
+    public_state.trick.clear();
+    public_state.won_cards.fill(0);
     assert(cards.size() == (cards_per_player*3 + cards_in_skat));
     players[0]->m_cards.resize(cards_per_player);
     players[1]->m_cards.resize(cards_per_player);
     players[2]->m_cards.resize(cards_per_player);
     skat.resize(cards_in_skat);
-    std::move(cards.begin(), cards.begin() + cards_per_player, players[0]->m_cards.begin());
-    std::move(cards.begin() + cards_per_player, cards.begin() + 2*cards_per_player, players[1]->m_cards.begin());
-    std::move(cards.begin() + 2*cards_per_player, cards.begin() + 3*cards_per_player, players[2]->m_cards.begin());
-    std::move(cards.begin() + 3*cards_per_player, cards.end(), skat.begin());
-    // Sort cards
-    for (auto& pl: players) {
-        std::sort(pl->m_cards.begin(), pl->m_cards.end(), [&](Cards::Card l, Cards::Card r) {
-            return Cards::get_suit_base_value(l) > Cards::get_suit_base_value(r);
-        });
+    std::copy(cards.begin(), cards.begin() + cards_per_player, players[0]->m_cards.begin());
+    std::copy(cards.begin() + cards_per_player, cards.begin() + 2*cards_per_player, players[1]->m_cards.begin());
+    std::copy(cards.begin() + 2*cards_per_player, cards.begin() + 3*cards_per_player, players[2]->m_cards.begin());
+    std::copy(cards.begin() + 3*cards_per_player, cards.end(), skat.begin());
+    for (size_t i=0; i<cards.size(); i++) {
+        record.deal[i] = Cards::get_card_id(cards[i]);
     }
+    sort_hands();
     BOOST_LOG_TRIVIAL(debug) << "First player: " << players[0]->m_cards;
     BOOST_LOG_TRIVIAL(debug) << "Second player: " << players[1]->m_cards;
     BOOST_LOG_TRIVIAL(debug) << "Third player: " << players[2]->m_cards;
     BOOST_LOG_TRIVIAL(debug) << "Skat: " << skat;
 }
 
-void Game::remove_card_from_current_player(Cards::Card const& card) {
+template<typename Variant>
+void BasicGame<Variant>::sort_hands() {
+    for (auto& pl: players) {
+        std::sort(pl->m_cards.begin(), pl->m_cards.end(), [&](Cards::Card l, Cards::Card r) {
+            return Cards::get_suit_base_value(l) > Cards::get_suit_base_value(r);
+        });
+    }
+}
+
+static const uint8_t checkpoint_version = 3;
+
+// Serializes the rules engine state, players and their policies are not included
+template<typename Variant>
+std::string BasicGame<Variant>::checkpoint() const {
+    Serialization::Writer writer;
+    writer.put_u8(checkpoint_version);
+    writer.put_i32(state);
+    writer.put_i32(max_rounds);
+    writer.put_u8(retry_on_illegal);
+    writer.put_u8(expect_legal);
+    writer.put_u8(tricks_played);
+    writer.put_i32(game_winner);
+    writer.put_i32(round);
+    writer.put_u8(public_state.dealer);
+    writer.put_u8(public_state.declarer);
+    writer.put_u8(current_player);
+    for (auto const p : points) {
+        writer.put_i32(p);
+    }
+    for (auto const& pl : players) {
+        writer.put_u32(Cards::get_card_mask(pl->m_cards));
+    }
+    for (auto const wc : public_state.won_cards) {
+        writer.put_u32(wc);
+    }
+    writer.put_u32(Cards::get_card_mask(skat));
+    writer.put_u8(public_state.trick.size());
+    for (auto const& c : public_state.trick) {
+        Serialization::write_card(writer, c);
+    }
+    writer.put_bytes(&record, sizeof(record));
+    writer.put_u8(public_state.contract.type);
+    writer.put_u8(public_state.contract.hand);
+    writer.put_u8(auction_pending);
+    writer.put_i32(bid);
+    writer.put_u32(declarer_cards);
+    return writer.str();
+}
+
+// Restores a checkpoint into this game, keeping the current players. Every field is checked before the game is changed,
+// so corrupt data throws and leaves the game as it was.
+template<typename Variant>
+void BasicGame<Variant>::restore(std::string const& data) {
+    Serialization::Reader reader(data);
+    uint8_t const version = reader.get_u8();
+    if (version != checkpoint_version) {
+        throw std::runtime_error("Unsupported checkpoint version");
+    }
+    int32_t const new_state = reader.get_i32();
+    int32_t const new_max_rounds = reader.get_i32();
+    bool const new_retry_on_illegal = reader.get_u8();
+    bool const new_expect_legal = reader.get_u8();
+    int const new_tricks_played = reader.get_u8();
+    int32_t const new_game_winner = reader.get_i32();
+    int32_t const new_round = reader.get_i32();
+    int const new_dealer = reader.get_u8();
+    int const new_declarer = reader.get_u8();
+    int const new_current_player = reader.get_u8();
+    std::array<int, 3> new_points;
+    for (auto& p : new_points) {
+        p = reader.get_i32();
+    }
+    std::array<Cards::CardMask, 3> hands;
+    for (auto& h : hands) {
+        h = reader.get_u32();
+    }
+    std::array<Cards::CardMask, 3> won_cards;
+    for (auto& wc : won_cards) {
+        wc = reader.get_u32();
+    }
+    Cards::CardMask const skat_cards = reader.get_u32();
+    size_t const trick_size = reader.get_u8();
+    if (trick_size >= 3) { // Full tricks are cleared right away
+        throw std::runtime_error("Checkpoint has an invalid trick");
+    }
+    Trick trick;
+    for (size_t i=0; i<trick_size; i++) {
+        trick.push_back(Serialization::read_card(reader));
+    }
+    Dataset::RoundRecord new_record;
+    reader.get_bytes(&new_record, sizeof(new_record));
+    uint8_t const type = reader.get_u8();
+    if (type > null_game) {
+        throw std::runtime_error("Checkpoint has an invalid contract");
+    }
+    Contract contract(static_cast<GameType>(type), reader.get_u8());
+    bool const new_auction_pending = reader.get_u8();
+    int32_t const new_bid = reader.get_i32();
+    Cards::CardMask const new_declarer_cards = reader.get_u32();
+    if (not reader.at_end()) {
+        throw std::runtime_error("Checkpoint has trailing data");
+    }
+    if (((new_state != ongoing) and (new_state != early_abort) and (new_state != finished)) or (new_max_rounds < 0)
+            or (new_round < 0) or (new_round > new_max_rounds + 1) or (new_tricks_played > cards_per_player) or (new_game_winner < -1) or (new_game_winner > 2)) {
+        throw std::runtime_error("Checkpoint has an invalid game state");
+    }
+    if ((new_dealer > 2) or (new_declarer > 2) or (new_current_player > 2)) {
+        throw std::runtime_error("Checkpoint has an invalid seat");
+    }
+    if ((not Variant::has_bidding) and not (contract == Contract())) {
+        throw std::runtime_error("Checkpoint has an invalid contract");
+    }
+    // Every card is in exactly one hand, pile, the Skat or the trick
+    Cards::CardMask seen = 0;
+    int total = 0;
+    std::vector<Cards::CardMask> piles(hands.begin(), hands.end());
+    piles.insert(piles.end(), won_cards.begin(), won_cards.end());
+    piles.push_back(skat_cards);
+    piles.push_back(trick.get_mask());
+    for (auto const pile : piles) {
+        seen |= pile;
+        total += Cards::count_cards(pile);
+    }
+    if ((total != Cards::count_cards(seen)) or (Cards::count_cards(skat_cards) > cards_in_skat)) {
+        throw std::runtime_error("Checkpoint deals a card twice");
+    }
+    for (auto const h : hands) {
+        if (Cards::count_cards(h) > cards_per_player + cards_in_skat) {
+            throw std::runtime_error("Checkpoint has an invalid hand");
+        }
+    }
+    for (size_t i=0; i<trick_size; i++) {
+        if (trick[i].played_by != (new_current_player + 3 - static_cast<int>(trick_size) + static_cast<int>(i)) % 3) {
+            throw std::runtime_error("Checkpoint has an invalid trick");
+        }
+    }
+    state = static_cast<GameState>(new_state);
+    max_rounds = new_max_rounds;
+    retry_on_illegal = new_retry_on_illegal;
+    expect_legal = new_expect_legal;
+    tricks_played = new_tricks_played;
+    game_winner = new_game_winner;
+    round = new_round;
+    public_state.dealer = new_dealer;
+    public_state.declarer = new_declarer;
+    current_player = new_current_player;
+    points = new_points;
+    for (int i=0; i<3; i++) {
+        players[i]->m_cards = Cards::get_cards_from_mask(hands[i]);
+    }
+    public_state.won_cards = won_cards;
+    skat = Cards::get_cards_from_mask(skat_cards);
+    public_state.trick = trick;
+    record = new_record;
+    public_state.contract = contract;
+    auction_pending = new_auction_pending;
+    bid = new_bid;
+    declarer_cards = new_declarer_cards;
+    sort_hands();
+}
+
+template<typename Variant>
+void BasicGame<Variant>::remove_card_from_current_player(Cards::Card const& card) {
     for(auto it = players[current_player]->m_cards.begin(); it != players[current_player]->m_cards.end(); ++it) {
         if (*it == card) {
             players[current_player]->m_cards.erase(it);
@@ -394,16 +773,21 @@ void Game::remove_card_from_current_player(Cards::Card const& card) {
     }
 }
 
-void Game::set_log_level_to_warning() {
+template<typename Variant>
+void BasicGame<Variant>::set_log_level_to_warning() {
     logging::core::get()->set_filter
     (
         logging::trivial::severity >= logging::trivial::warning
     );
 }
 
-void Game::set_log_level_to_info() {
+template<typename Variant>
+void BasicGame<Variant>::set_log_level_to_info() {
     logging::core::get()->set_filter
     (
         logging::trivial::severity >= logging::trivial::info
     );
-}
\ No newline at end of file
+}
+
+template class HalfSkat::BasicGame<HalfSkat::HalfSkatVariant>;
+template class HalfSkat::BasicGame<HalfSkat::SkatVariant>;
@@ -9,70 +9,83 @@
 #include <random>
 #include <chrono>
 #include <stdexcept>
+#include <string>
 
 #include "cards.hpp"
+#include "dataset.hpp"
+#include "rules.hpp"
+
+namespace PolicyCache { class Cache; }
+namespace Scenario { class DealSource; }
+namespace Stats { class Collector; }
 
 namespace HalfSkat {
 
-static auto rng = std::default_random_engine {};
+static thread_local auto rng = std::default_random_engine {std::random_device{}()}; // One engine per thread, games may be played concurrently
 static const int cards_per_player = 10;
 static const int cards_in_skat = 2;
 enum GameState { ongoing = 0, early_abort = -1, finished = 1 };
 
-// Player independent state of game which everyone can observe
+// Cards of the current trick in order of play, fixed capacity so that copies don't allocate
+struct Trick {
+    std::array<Cards::Card, 3> cards;
+    size_t count = 0;
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    void clear() { count = 0; }
+    void push_back(Cards::Card const& card) { assert(count < 3); cards[count++] = card; }
+    Cards::Card const& front() const { return cards[0]; }
+    Cards::Card const& operator[](size_t const idx) const { return cards[idx]; }
+    Cards::Card const* begin() const { return cards.data(); }
+    Cards::Card const* end() const { return cards.data() + count; }
+    Cards::CardMask get_mask() const {
+        Cards::CardMask mask = 0;
+        for (auto const& c : *this) {
+            mask |= Cards::get_card_bit(c);
+        }
+        return mask;
+    }
+    std::vector<Cards::Card> to_vector() const { return std::vector<Cards::Card>(begin(), end()); }
+};
+
+// Player independent state of game which everyone can observe, updated in place by the game
 struct ObservableState { 
-    std::array<std::vector<Cards::Card>, 3> won_cards; // Cards won previously by players
-    std::vector<Cards::Card> trick; // Current trick
-    int dealer; // Identifies current dealer
-    int declarer; // Identifies current declarer
-    ObservableState(std::array<std::vector<Cards::Card>, 3> const& won_cards, std::vector<Cards::Card> const& trick, int const dealer, int const declarer) : won_cards(won_cards), trick(trick), dealer(dealer), declarer(declarer) { }
-    ObservableState() {}
+    std::array<Cards::CardMask, 3> won_cards = {{0, 0, 0}}; // Cards won previously by players
+    Trick trick; // Current trick
+    int dealer = 0; // Identifies current dealer
+    int declarer = 0; // Identifies current declarer
+    Contract contract; // Game played by the declarer
 };
 
-// State of game from the perspective of a player
+// State of game from the perspective of a player, a fixed-size value
 struct PlayerState {
-    std::vector<Cards::Card> hole_cards;
-    std::vector<Cards::Card> trick;
-    std::vector<bool> trick_played_by_friend;
-    std::vector<Cards::Card> won_friendly; // Cards won by me or the friendly party
-    std::vector<Cards::Card> won_hostile; // Cards won by hostile players
-    bool is_declarer; // Indicates whether player is the declarer
+    Cards::CardMask hole_cards = 0;
+    Trick trick;
+    std::array<bool, 3> trick_played_by_friend = {{false, false, false}}; // First trick.size() entries are valid
+    Cards::CardMask won_friendly = 0; // Cards won by me or the friendly party
+    Cards::CardMask won_hostile = 0; // Cards won by hostile players
+    bool is_declarer = false; // Indicates whether player is the declarer
+    Cards::CardMask legal_cards = 0; // Hole cards that may be played in this state
+    Contract contract; // Game played by the declarer
     PlayerState() = default;
-    // Construct PlayerState from ObservableState, hole cards and player identifier
-    PlayerState(ObservableState const& public_state, std::vector<Cards::Card> const& hole_cards, int player_id) : hole_cards(hole_cards) {
+    // Construct PlayerState from ObservableState, hole cards, mask of legal cards and player identifier
+    PlayerState(ObservableState const& public_state, std::vector<Cards::Card> const& hole_cards, Cards::CardMask const legal_cards, int player_id) : hole_cards(Cards::get_card_mask(hole_cards)), trick(public_state.trick), legal_cards(legal_cards), contract(public_state.contract) {
         is_declarer = (public_state.declarer == player_id);
-        trick = public_state.trick;
         if (is_declarer) {
-            int other_id = (player_id+1)%3;
-            int also_other_id = (player_id+2)%3;
-            won_hostile.insert(won_hostile.end(), public_state.won_cards[other_id].begin(), public_state.won_cards[other_id].end());
-            won_hostile.insert(won_hostile.end(), public_state.won_cards[also_other_id].begin(), public_state.won_cards[also_other_id].end());
-            won_friendly.insert(won_friendly.end(), public_state.won_cards[player_id].begin(), public_state.won_cards[player_id].end());
+            won_friendly = public_state.won_cards[player_id];
+            won_hostile = public_state.won_cards[(player_id+1)%3] | public_state.won_cards[(player_id+2)%3];
         }
         else {
-            int other_id = (public_state.declarer+1)%3;
-            int also_other_id = (public_state.declarer+2)%3;
-            won_hostile.insert(won_hostile.end(), public_state.won_cards[public_state.declarer].begin(), public_state.won_cards[public_state.declarer].end());
-            won_friendly.insert(won_friendly.end(), public_state.won_cards[other_id].begin(), public_state.won_cards[other_id].end());
-            won_friendly.insert(won_friendly.end(), public_state.won_cards[also_other_id].begin(), public_state.won_cards[also_other_id].end());
+            won_hostile = public_state.won_cards[public_state.declarer];
+            won_friendly = public_state.won_cards[(public_state.declarer+1)%3] | public_state.won_cards[(public_state.declarer+2)%3];
         }
         // Find player cards in trick
-        for (auto c : public_state.trick) {
+        for (size_t i=0; i<trick.size(); i++) {
             if (is_declarer) {
-                if (c.played_by == player_id) {
-                    trick_played_by_friend.push_back(true);
-                }
-                else {
-                    trick_played_by_friend.push_back(false);
-                }
+                trick_played_by_friend[i] = (trick[i].played_by == player_id);
             }
             else {
-                if (c.played_by == public_state.declarer) {
-                    trick_played_by_friend.push_back(false);
-                }
-                else {
-                    trick_played_by_friend.push_back(true);
-                }
+                trick_played_by_friend[i] = (trick[i].played_by != public_state.declarer);
             }
         }
     }
@@ -86,25 +99,51 @@ struct Transition {
     Transition(PlayerState const& before, PlayerState const& after, int reward, Cards::Card const& action) : before(before), after(after), reward(reward), action(action) {}
 };
 
+template<typename Variant>
+class BasicGame;
+
 class Player {
-    friend class Game;
+    template<typename Variant>
+    friend class BasicGame;
     public:
         Player() = default;
         virtual ~Player() = default;
-        Cards::Card get_action(ObservableState const& state, int player_id);
-        void put_transition(int const reward, ObservableState const& new_state, int player_id);
+        Cards::Card get_action(ObservableState const& state, Cards::CardMask const legal_cards, int player_id);
+        // Decides in state on behalf of a player wrapping this one, the hand is taken from state
+        Cards::Card get_delegated_action(PlayerState const& state);
+        void put_transition(int const reward, ObservableState const& new_state, Cards::CardMask const legal_cards, int player_id);
         std::vector<Cards::Card> get_cards() { return m_cards; }
         PlayerState get_last_state() { return m_last_state; }
         Cards::Card get_last_action() { return m_last_action; }
         std::vector<Transition> get_transitions() { return m_transitions; }
         void clear_transitions() { m_transitions.clear(); }
         virtual Cards::Card query_policy() = 0 ;
+        // Probabilities of the 32 cards in the last state, empty if the player only samples through query_policy
+        virtual std::vector<float> query_distribution() { return std::vector<float>(); }
+        // Decisions are looked up in cache before query_distribution is asked and forced moves skip the policy.
+        // Players with different policies sharing a cache need different policy ids.
+        void set_policy_cache(std::shared_ptr<PolicyCache::Cache> cache, uint64_t const policy_id = 0) { m_policy_cache = cache; m_policy_id = policy_id; }
+        // Cached decisions of other versions are ignored, to be changed whenever the policy changes
+        virtual uint64_t get_policy_version() const { return m_policy_version; }
+        void set_policy_version(uint64_t const version) { m_policy_version = version; }
+        // Only asked in variants with bidding, the defaults play the longest suit with six or more trumps
+        virtual int query_bid_limit(); // Highest bid the player holds, zero passes
+        virtual bool query_pickup_skat(); // Declarer picks up the Skat, otherwise plays a hand game
+        virtual Cards::CardMask query_discard(); // Two of the twelve cards after pickup, put away as new Skat
+        virtual Contract query_contract(bool const hand);
     protected:
         std::vector<Cards::Card> m_cards;
         PlayerState m_last_state;
+        int m_last_role = 0; // Seat relative to the declarer in the last state, as Scenario::Role
         Cards::Card m_last_action;
         std::vector<Transition> m_transitions;
         bool m_await_transition = false;
+        std::shared_ptr<PolicyCache::Cache> m_policy_cache;
+        uint64_t m_policy_id = 0;
+        uint64_t m_policy_version = 0;
+        Cards::Card query_cached_policy();
+        // Uniform in [0, 1) for sampling cached decisions, players with their own engine override it
+        virtual float draw_uniform() { return std::uniform_real_distribution<float>(0.f, 1.f)(rng); }
 };
 
 // Trampoline class to enable overriding from Python
@@ -118,11 +157,26 @@ class PyPlayer : public Player {
                 query_policy
             );
         }
+        int query_bid_limit() override {
+            PYBIND11_OVERLOAD(int, Player, query_bid_limit);
+        }
+        bool query_pickup_skat() override {
+            PYBIND11_OVERLOAD(bool, Player, query_pickup_skat);
+        }
+        Cards::CardMask query_discard() override {
+            PYBIND11_OVERLOAD(Cards::CardMask, Player, query_discard);
+        }
+        Contract query_contract(bool const hand) override {
+            PYBIND11_OVERLOAD(Contract, Player, query_contract, hand);
+        }
+        std::vector<float> query_distribution() override {
+            PYBIND11_OVERLOAD(std::vector<float>, Player, query_distribution);
+        }
 };
 
 class RandomPlayer : public Player {
     public:
-        RandomPlayer() { rng.seed(std::chrono::system_clock::now().time_since_epoch().count()); } // Seed with current time
+        using Player::Player;
         Cards::Card query_policy() override;
 };
 
@@ -132,58 +186,89 @@ class HumanPlayer : public Player {
         Cards::Card query_policy() override;
 };
 
-class Game {
+// Rules engine, the variant policy (see rules.hpp) selects the game types and whether there is bidding
+template<typename Variant>
+class BasicGame {
     public:
-        Game(int const max_rounds = 1000, bool const retry_on_illegal_action = false);
-        Game(std::shared_ptr<Player> first_player, std::shared_ptr<Player> second_player, std::shared_ptr<Player> third_player, int const max_rounds = 1000, bool retry_on_illegal_action = false);
+        BasicGame(int const max_rounds = 1000, bool const retry_on_illegal_action = false, bool const expect_legal_actions = false);
+        BasicGame(std::shared_ptr<Player> first_player, std::shared_ptr<Player> second_player, std::shared_ptr<Player> third_player, int const max_rounds = 1000, bool retry_on_illegal_action = false, bool const expect_legal_actions = false);
 
-        ObservableState get_observable_state() const;
+        ObservableState const& get_observable_state() const { return public_state; }
         std::vector<Cards::Card> get_legal_cards(std::vector<Cards::Card> const& players_cards) const;
+        std::vector<Cards::Card> get_legal_cards(std::vector<Cards::Card> const& players_cards, Trick const& trick) const;
+        Cards::CardMask get_legal_mask(Cards::CardMask const players_cards, Trick const& trick) const;
+        Cards::CardMask get_legal_mask(int const player) const;
         bool trump_in_trick() const;
         int get_trick_winner();
         bool declarer_has_won_round() const;
         int get_game_winner() const;
         int get_game_value(std::vector<Cards::Card> const& cards) const;
+        int get_game_value(Cards::CardMask const cards) const;
         int get_game_level(std::vector<Cards::Card> const& cards) const;
+        int get_game_level(Cards::CardMask const cards) const;
         void step_by_trick();
         void step_by_round();
         void run_new_game();
         void step_by_game();
         void set_log_level_to_warning();
         void set_log_level_to_info();
+        // Variants with bidding determine the declarer in an auction, new_declarer is ignored there
+        void deal_round(std::vector<Cards::Card> const& deck, int const new_declarer, int const new_dealer);
+        // Records only hold HalfSkat rounds (no contract, bid or Skat pickup), variants with bidding can't be recorded
+        void set_recorder(std::shared_ptr<Dataset::RecordWriter> writer) {
+            if (Variant::has_bidding and writer) {
+                throw std::runtime_error("Games with bidding can't be recorded");
+            }
+            recorder = writer;
+        }
+        // New rounds are dealt from source instead of a shuffled deck, nullptr restores shuffling
+        void set_deal_source(std::shared_ptr<Scenario::DealSource> source) { deal_source = source; }
+        // Counts outcomes, tricks and plays into collector, which may be shared by games on several threads
+        void set_stats(std::shared_ptr<Stats::Collector> collector) { stats = collector; }
+        std::string checkpoint() const;
+        void restore(std::string const& data);
 
-        std::vector<Cards::Card> get_trick() const { return trick; }
+        std::vector<Cards::Card> get_trick() const { return public_state.trick.to_vector(); }
         std::array<int, 3> get_points() const { return points; }
         int get_round() const { return round; }
         int get_max_rounds() const { return max_rounds; }
         GameState get_state() const { return state; }
-        Cards::Color const trump = Cards::Color::Clubs;
+        int get_current_player() const { return current_player; } // After an early abort the player of the illegal card
+        Contract const& get_contract() const { return public_state.contract; }
+        int get_bid() const { return bid; }
     protected:
         GameState state = ongoing;
         int max_rounds;
         bool retry_on_illegal;
+        bool expect_legal; // Players only choose cards from the legal mask, violations are errors
         int tricks_played = 0;
         int game_winner = -1;
         int round = 0;
-        int dealer = 0;
-        int declarer = 0;
         int current_player = 1;
-        ObservableState state_before;
-        ObservableState state_after;
+        ObservableState public_state; // Won cards, trick, dealer and declarer
         std::array<std::shared_ptr<Player>, 3> players;
-        std::array<std::vector<Cards::Card>, 3> won_cards;
         std::array<int, 3> points = {{0, 0, 0}};
-        std::array<Cards::Card, 11> trick_hierarchy {{{Cards::Color::Clubs, Cards::Rank::Jack}, {Cards::Color::Spades, Cards::Rank::Jack},
-            {Cards::Color::Hearts, Cards::Rank::Jack}, {Cards::Color::Diamonds, Cards::Rank::Jack}, {Cards::Color::Spades, Cards::Rank::Ace},
-            {Cards::Color::Spades, Cards::Rank::Ten}, {Cards::Color::Spades, Cards::Rank::King}, {Cards::Color::Spades, Cards::Rank::Queen},
-            {Cards::Color::Spades, Cards::Rank::Nine}, {Cards::Color::Spades, Cards::Rank::Eight}, {Cards::Color::Spades, Cards::Rank::Seven}}};
         std::vector<Cards::Card> skat;
-        std::vector<Cards::Card> trick;
+        bool auction_pending = false; // Cards are dealt but nobody has declared yet
+        int bid = 0; // Winning bid of the auction
+        Cards::CardMask declarer_cards = 0; // Hand and Skat of the declarer after pickup, matadors are counted on them
         std::uniform_int_distribution<> rand_distr{0, 2};
+        std::shared_ptr<Dataset::RecordWriter> recorder;
+        std::shared_ptr<Scenario::DealSource> deal_source;
+        std::shared_ptr<Stats::Collector> stats;
+        Dataset::RoundRecord record;
         void reset_points();
         void reset_players();
         void reset_cards();
+        void deal_cards(std::vector<Cards::Card> const& deck);
+        void sort_hands();
         void remove_card_from_current_player(Cards::Card const& card);
+        bool run_auction();
+        void start_next_round();
+        int get_round_value() const;
 };
 
+using Game = BasicGame<HalfSkatVariant>;
+using SkatGame = BasicGame<SkatVariant>;
+
 } // namespace HalfSkat
@@ -0,0 +1,265 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <random>
+#include <stdexcept>
+#include <unordered_set>
+
+#include "handstrength.hpp"
+#include "parallel.hpp"
+#include "bots.hpp"
+
+using namespace HandStrength;
+
+namespace {
+
+struct FileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t slot_bits;
+    uint32_t deals_per_hand;
+    uint32_t num_entries;
+};
+static const char file_magic[8] = {'P', 'Y', 'S', 'K', 'A', 'T', 'H', 'S'};
+static const uint32_t file_version = 1;
+
+Cards::CardMask const suit_pattern = 0xef; // Color block without its jack
+
+// Fibonacci hashing into a table of 2^slot_bits slots
+size_t get_slot(Cards::CardMask const hand, int const slot_bits) {
+    return (hand * uint32_t(2654435769u)) >> (32 - slot_bits);
+}
+
+// Declarer hand in seat 0, the other cards dealt randomly
+void get_deal(Cards::CardMask const hand, std::mt19937& engine, std::vector<Cards::Card>& deck) {
+    deck.clear();
+    std::vector<Cards::Card> rest;
+    for (int id=0; id<32; id++) {
+        if (hand & (Cards::CardMask(1) << id)) {
+            deck.push_back(Cards::AllCards[id]);
+        }
+        else {
+            rest.push_back(Cards::AllCards[id]);
+        }
+    }
+    std::shuffle(rest.begin(), rest.end(), engine);
+    deck.insert(deck.end(), rest.begin(), rest.end());
+}
+
+std::vector<Cards::CardMask> get_hands(Settings const& settings, unsigned const seed) {
+    std::vector<Cards::CardMask> hands;
+    if (not settings.hands.empty()) {
+        for (auto const hand : settings.hands) {
+            if (Cards::count_cards(hand) != HalfSkat::cards_per_player) {
+                throw std::runtime_error("Hands must contain ten cards.");
+            }
+            hands.push_back(canonicalize(hand));
+        }
+    }
+    else if (settings.sample_hands > 0) {
+        hands = sample_canonical_hands(settings.sample_hands, seed);
+    }
+    else {
+        for_each_canonical_hand([&](Cards::CardMask const hand) { hands.push_back(hand); });
+    }
+    std::sort(hands.begin(), hands.end());
+    hands.erase(std::unique(hands.begin(), hands.end()), hands.end());
+    return hands;
+}
+
+} // namespace
+
+Cards::CardMask HandStrength::canonicalize(Cards::CardMask const hand) {
+    std::array<int, 4> colors;
+    return canonicalize(hand, colors);
+}
+
+Cards::CardMask HandStrength::canonicalize(Cards::CardMask const hand, std::array<int, 4>& colors) {
+    // Pattern in the high bits and its block in the low bits, ties keep their order
+    uint32_t a = (((hand >> 8) & suit_pattern) << 2) | 1;
+    uint32_t b = (((hand >> 16) & suit_pattern) << 2) | 2;
+    uint32_t c = (((hand >> 24) & suit_pattern) << 2) | 3;
+    // Sorting network, largest pattern first
+    if ((a >> 2) < (b >> 2)) std::swap(a, b);
+    if ((b >> 2) < (c >> 2)) std::swap(b, c);
+    if ((a >> 2) < (b >> 2)) std::swap(a, b);
+    colors = {{0, int(a & 3), int(b & 3), int(c & 3)}};
+    Cards::CardMask const fixed = hand & (0xff | Cards::jacks_mask); // Clubs and all jacks are trumps
+    return fixed | ((a >> 2) << 8) | ((b >> 2) << 16) | ((c >> 2) << 24);
+}
+
+std::vector<Cards::CardMask> HandStrength::sample_canonical_hands(long const count, unsigned const seed) {
+    std::vector<Cards::CardMask> hands;
+    std::mt19937 engine(seed);
+    std::unordered_set<Cards::CardMask> seen;
+    std::vector<int> ids(32);
+    for (int i=0; i<32; i++) {
+        ids[i] = i;
+    }
+    for (long attempt=0; (static_cast<long>(hands.size()) < count) and (attempt < 1000*count); attempt++) {
+        std::shuffle(ids.begin(), ids.end(), engine);
+        Cards::CardMask hand = 0;
+        for (int i=0; i<HalfSkat::cards_per_player; i++) {
+            hand |= Cards::CardMask(1) << ids[i];
+        }
+        hand = canonicalize(hand);
+        if (seen.insert(hand).second) {
+            hands.push_back(hand);
+        }
+    }
+    return hands;
+}
+
+void HandStrength::for_each_canonical_hand(std::function<void(Cards::CardMask)> const& f) {
+    // Suit patterns grouped by their number of cards
+    std::array<std::vector<Cards::CardMask>, 8> patterns;
+    for (Cards::CardMask p=0; p<=0xff; p++) {
+        if ((p & suit_pattern) == p) {
+            patterns[Cards::count_cards(p)].push_back(p);
+        }
+    }
+    Cards::CardMask const trumps = 0xff | Cards::jacks_mask;
+    for (Cards::CardMask t=0; t<(Cards::CardMask(1) << 11); t++) {
+        // Spread the 11 bits over the trump cards
+        Cards::CardMask fixed = 0;
+        int bit = 0;
+        for (int id=0; id<32; id++) {
+            if (trumps & (Cards::CardMask(1) << id)) {
+                if (t & (Cards::CardMask(1) << bit)) {
+                    fixed |= Cards::CardMask(1) << id;
+                }
+                bit++;
+            }
+        }
+        int const remaining = HalfSkat::cards_per_player - Cards::count_cards(fixed);
+        if (remaining < 0) {
+            continue;
+        }
+        for (int na=0; na<=7; na++) {
+            for (auto const a : patterns[na]) {
+                for (int nb=0; (nb<=7) and (na+nb<=remaining); nb++) {
+                    int const nc = remaining - na - nb;
+                    if (nc > 7) {
+                        continue;
+                    }
+                    for (auto const b : patterns[nb]) {
+                        if (b > a) {
+                            continue;
+                        }
+                        for (auto const c : patterns[nc]) {
+                            if (c <= b) {
+                                f(fixed | (a << 8) | (b << 16) | (c << 24));
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+void HandStrength::build_table(std::string const& path, Settings const& settings) {
+    unsigned const seed = (settings.seed != 0) ? settings.seed : std::random_device{}();
+    std::vector<Cards::CardMask> const hands = get_hands(settings, seed);
+    if (settings.deals_per_hand <= 0) {
+        throw std::runtime_error("Hands need at least one deal.");
+    }
+    PlayerFactory const factory = settings.player ? settings.player : []() { return std::make_shared<HalfSkat::TrumpPullingPlayer>(); };
+    std::vector<Entry> entries(hands.size());
+    std::atomic<size_t> next_hand{0};
+    std::atomic<bool> stop{false};
+    Parallel::run_on_threads(Parallel::get_num_threads(settings.threads), stop, [&](int) {
+        std::array<std::shared_ptr<HalfSkat::Player>, 3> players = {{factory(), factory(), factory()}};
+        HalfSkat::Game game(players[0], players[1], players[2], std::numeric_limits<int>::max(), true);
+        std::vector<Cards::Card> deck;
+        while (not stop) {
+            size_t const h = next_hand++;
+            if (h >= hands.size()) {
+                return;
+            }
+            // Deals of a hand only depend on seed and hand, not on the thread
+            std::seed_seq seq{seed, hands[h]};
+            std::mt19937 engine(seq);
+            std::uniform_int_distribution<> dealer_distr(0, 2);
+            long wins = 0;
+            double value = 0.;
+            double score = 0.;
+            for (int d=0; d<settings.deals_per_hand; d++) {
+                get_deal(hands[h], engine, deck);
+                game.deal_round(deck, 0, dealer_distr(engine));
+                int const before = game.get_points()[0];
+                game.step_by_round();
+                for (auto& p : players) {
+                    p->clear_transitions();
+                }
+                int const delta = game.get_points()[0] - before;
+                wins += (delta > 0);
+                value += (delta > 0) ? delta : -delta/2;
+                score += delta;
+            }
+            Entry& e = entries[h];
+            e.hand = hands[h];
+            e.win_rate = static_cast<float>(wins) / settings.deals_per_hand;
+            e.expected_value = value / settings.deals_per_hand;
+            e.expected_score = score / settings.deals_per_hand;
+        }
+    });
+    // Open addressing with linear probing, at most half of the slots are used
+    int slot_bits = 1;
+    while ((size_t(1) << slot_bits) < 2*entries.size()) {
+        slot_bits++;
+    }
+    size_t const num_slots = size_t(1) << slot_bits;
+    std::vector<Entry> slots(num_slots);
+    for (auto const& e : entries) {
+        size_t s = get_slot(e.hand, slot_bits);
+        while (slots[s].hand != 0) {
+            s = (s + 1) & (num_slots - 1);
+        }
+        slots[s] = e;
+    }
+    FileHeader header;
+    std::memcpy(header.magic, file_magic, sizeof(file_magic));
+    header.version = file_version;
+    header.slot_bits = slot_bits;
+    header.deals_per_hand = settings.deals_per_hand;
+    header.num_entries = entries.size();
+    std::FILE* file = std::fopen(path.c_str(), "wb");
+    if (file == nullptr) {
+        throw std::runtime_error("Could not open hand table " + path);
+    }
+    bool const written = (std::fwrite(&header, sizeof(header), 1, file) == 1) and (std::fwrite(slots.data(), sizeof(Entry), num_slots, file) == num_slots);
+    std::fclose(file);
+    if (not written) {
+        throw std::runtime_error("Could not write hand table " + path);
+    }
+}
+
+Table::Table(std::string const& path) : file(path, "hand table", sizeof(FileHeader)) {
+    FileHeader const* header = reinterpret_cast<FileHeader const*>(file.data());
+    if ((std::memcmp(header->magic, file_magic, sizeof(file_magic)) != 0) or (header->version != file_version) or (header->slot_bits < 1) or (header->slot_bits > 31)
+            or (file.size() != sizeof(FileHeader) + (size_t(1) << header->slot_bits)*sizeof(Entry))
+            or (header->num_entries >= (size_t(1) << header->slot_bits))) {
+        throw std::runtime_error("Not a hand table: " + path);
+    }
+    file.advise_random();
+    slot_bits = header->slot_bits;
+    num_entries = header->num_entries;
+    deals_per_hand = header->deals_per_hand;
+    slots = reinterpret_cast<Entry const*>(file.data() + sizeof(FileHeader));
+}
+
+Entry const* Table::find(Cards::CardMask const hand) const {
+    Cards::CardMask const key = canonicalize(hand);
+    size_t const mask = (size_t(1) << slot_bits) - 1;
+    // Bounded by the number of slots, so a corrupt table without empty slots can't loop forever
+    size_t s = get_slot(key, slot_bits);
+    for (size_t probes=0; (probes <= mask) and (slots[s].hand != 0); probes++, s=(s+1) & mask) {
+        if (slots[s].hand == key) {
+            return &slots[s];
+        }
+    }
+    return nullptr;
+}
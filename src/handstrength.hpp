@@ -0,0 +1,65 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "cards.hpp"
+#include "halfskat.hpp"
+#include "mapping.hpp"
+
+// Precomputed strength of HalfSkat declarer hands (clubs are trump), looked up from a memory-mapped table
+namespace HandStrength {
+
+// Hands that only differ by a permutation of spades, hearts and diamonds (without their jacks) play the same.
+// The canonical hand has the largest of these suit patterns in spades and the smallest in diamonds.
+Cards::CardMask canonicalize(Cards::CardMask const hand);
+// Also sets colors[block] to the block of hand whose cards (without the jack) moved to block of the canonical hand
+Cards::CardMask canonicalize(Cards::CardMask const hand, std::array<int, 4>& colors);
+// Distinct canonical hands drawn like in real deals, so frequent hand shapes come first
+std::vector<Cards::CardMask> sample_canonical_hands(long const count, unsigned const seed);
+// Calls f for every canonical 10-card hand
+void for_each_canonical_hand(std::function<void(Cards::CardMask)> const& f);
+
+struct Entry {
+    Cards::CardMask hand = 0; // Canonical hand, zero marks an empty slot
+    float win_rate = 0.f; // Fraction of rounds the declarer won
+    float expected_value = 0.f; // Mean get_game_value of the declarer's won cards
+    float expected_score = 0.f; // Mean change of the declarer's points, lost rounds count double negative
+};
+static_assert(sizeof(Entry) == 16, "Entry must stay 16 bytes");
+
+using PlayerFactory = std::function<std::shared_ptr<HalfSkat::Player>()>;
+
+struct Settings {
+    std::vector<Cards::CardMask> hands; // Hands to evaluate, if empty sample_hands or all canonical hands are used
+    long sample_hands = 0; // Number of distinct canonical hands drawn from random deals, zero evaluates all of them
+    int deals_per_hand = 100; // Random deals of the remaining cards played per hand
+    int threads = 0; // Zero uses all cores
+    unsigned seed = 0; // Zero draws a random seed
+    PlayerFactory player; // Plays all three seats, defaults to TrumpPullingPlayer
+};
+
+// Simulates the hands of settings as declarer and writes the table to path
+void build_table(std::string const& path, Settings const& settings);
+
+// Read-only memory mapping of a file written by build_table
+class Table {
+    public:
+        Table(std::string const& path);
+        // Entry of the canonical form of hand, nullptr if the hand wasn't evaluated
+        Entry const* find(Cards::CardMask const hand) const;
+        size_t size() const { return num_entries; }
+        int get_deals_per_hand() const { return deals_per_hand; }
+    private:
+        Mapping::File file;
+        size_t num_entries = 0;
+        int deals_per_hand = 0;
+        int slot_bits = 0;
+        Entry const* slots = nullptr;
+};
+
+} // namespace HandStrength
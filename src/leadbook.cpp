@@ -0,0 +1,514 @@
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <random>
+#include <stdexcept>
+
+#include "leadbook.hpp"
+#include "parallel.hpp"
+#include "handstrength.hpp"
+
+using namespace LeadBook;
+
+namespace {
+
+struct FileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t slot_bits;
+    uint32_t deals_per_hand;
+    uint32_t num_entries;
+};
+static const char file_magic[8] = {'P', 'Y', 'S', 'K', 'A', 'T', 'L', 'B'};
+static const uint32_t file_version = 1;
+
+static const int table_bits = 20;
+
+using ClubsRules = HalfSkat::Rules<HalfSkat::clubs_game>;
+
+// Points by offset within a color block: Seven, Eight, Nine, Ten, Jack, Queen, King, Ace
+static const int offset_points[8] = {0, 0, 0, 10, 2, 3, 4, 11};
+
+int get_points(int const id) {
+    return offset_points[id & 7];
+}
+
+int get_points(Cards::CardMask cards) {
+    int sum = 0;
+    for (; cards != 0; cards &= cards - 1) {
+        sum += get_points(__builtin_ctz(cards));
+    }
+    return sum;
+}
+
+// Cards of the same suit (trumps form one suit) ranking above each card
+struct HigherCards {
+    std::array<Cards::CardMask, 32> masks;
+    HigherCards() {
+        for (int id=0; id<32; id++) {
+            masks[id] = 0;
+            for (int other=0; other<32; other++) {
+                if (((ClubsRules::tables.suits[id] >> other) & 1) and (ClubsRules::tables.order[other] > ClubsRules::tables.order[id])) {
+                    masks[id] |= Cards::CardMask(1) << other;
+                }
+            }
+        }
+    }
+};
+static const HigherCards higher_cards;
+
+// Card of hand ranking directly above card among the remaining cards with the same points, -1 if there is none
+int get_equivalent(int const card, Cards::CardMask const hand, Cards::CardMask const remaining) {
+    int next = -1;
+    for (Cards::CardMask higher = higher_cards.masks[card] & remaining; higher != 0; higher &= higher - 1) {
+        int const id = __builtin_ctz(higher);
+        if ((next < 0) or (ClubsRules::tables.order[id] < ClubsRules::tables.order[next])) {
+            next = id;
+        }
+    }
+    if ((next >= 0) and ((hand >> next) & 1) and (get_points(next) == get_points(card))) {
+        return next;
+    }
+    return -1;
+}
+
+size_t get_table_slot(uint64_t const key) {
+    return (key * 11400714819323198485ull) >> (64 - table_bits);
+}
+
+// Fibonacci hashing of hand and role into a book of 2^slot_bits slots
+size_t get_slot(Cards::CardMask const hand, int const role, int const slot_bits) {
+    return (((uint64_t(hand) << 2) | role) * 11400714819323198485ull) >> (64 - slot_bits);
+}
+
+// Card id of the canonical hand back in the hand it was made from
+int get_original_id(int const id, std::array<int, 4> const& colors) {
+    int const block = id / 8;
+    int const offset = id % 8;
+    return (offset == 4) ? id : 8*colors[block] + offset; // Jacks are never moved
+}
+
+} // namespace
+
+Solver::Solver() : table(size_t(1) << table_bits) {}
+
+void Solver::start(Hands const& new_hands, int const new_declarer) {
+    hands = new_hands;
+    declarer = new_declarer;
+    generation++;
+}
+
+int Solver::get_moves(int const player, int const played, std::array<int, HalfSkat::cards_per_player>& moves) const {
+    Cards::CardMask const hand = hands[player];
+    Cards::CardMask legal = hand;
+    if (played > 0) {
+        Cards::CardMask const follow = hand & ClubsRules::tables.suits[trick[0]];
+        legal = (follow != 0) ? follow : hand;
+    }
+    // Cards of the trick still separate ranks, a Nine over a played Eight wins where the Seven doesn't
+    Cards::CardMask remaining = hands[0] | hands[1] | hands[2];
+    for (int i=0; i<played; i++) {
+        remaining |= Cards::CardMask(1) << trick[i];
+    }
+    std::array<int, HalfSkat::cards_per_player> priorities;
+    int n = 0;
+    // Leads try high cards first, followers cards taking the trick and then the points fitting the current winner
+    int best_key = -1;
+    bool friend_wins = false;
+    if (played > 0) {
+        int winner = 0;
+        for (int i=0; i<played; i++) {
+            int const key = ClubsRules::get_key(trick[i], trick[0]);
+            if (key > best_key) {
+                best_key = key;
+                winner = i;
+            }
+        }
+        int const winner_seat = (player + 3 - played + winner) % 3;
+        friend_wins = (winner_seat == declarer) == (player == declarer);
+    }
+    for (Cards::CardMask cards = legal; cards != 0; cards &= cards - 1) {
+        int const id = __builtin_ctz(cards);
+        if (get_equivalent(id, hand, remaining) >= 0) {
+            continue;
+        }
+        int priority;
+        if (played == 0) {
+            priority = ClubsRules::tables.order[id];
+        }
+        else {
+            int const key = ClubsRules::get_key(id, trick[0]);
+            if (key > best_key) {
+                priority = friend_wins ? get_points(id) : 100 + get_points(id) - key;
+            }
+            else {
+                priority = friend_wins ? get_points(id) : -get_points(id);
+            }
+        }
+        // Insertion sort, highest priority first
+        int i = n++;
+        for (; (i > 0) and (priorities[i - 1] < priority); i--) {
+            moves[i] = moves[i - 1];
+            priorities[i] = priorities[i - 1];
+        }
+        moves[i] = id;
+        priorities[i] = priority;
+    }
+    return n;
+}
+
+// Fail-soft alpha-beta on the declarer points of the remaining cards, the card on the table included
+int Solver::search(int const player, int const played, int alpha, int beta) {
+    nodes++;
+    TableEntry* entry = nullptr;
+    uint64_t key = 0;
+    int lower = 0;
+    int upper = 0;
+    int hint = -1;
+    if (played == 0) {
+        Cards::CardMask const remaining = hands[0] | hands[1] | hands[2];
+        if (remaining == 0) {
+            return 0;
+        }
+        if (__builtin_popcount(remaining) == 3) { // Every card of the last trick is forced
+            int const lead = __builtin_ctz(hands[player]);
+            int winner = player;
+            int best_key = -1;
+            for (int i=0; i<3; i++) {
+                int const seat = (player + i) % 3;
+                int const k = ClubsRules::get_key(__builtin_ctz(hands[seat]), lead);
+                if (k > best_key) {
+                    best_key = k;
+                    winner = seat;
+                }
+            }
+            return (winner == declarer) ? get_points(remaining) : 0;
+        }
+        key = uint64_t(remaining) | (uint64_t(player) << 32) | (generation << 34);
+        entry = &table[get_table_slot(key)];
+        if (entry->key == key) {
+            lower = entry->lower;
+            upper = entry->upper;
+            hint = entry->move;
+        }
+        else {
+            upper = get_points(remaining);
+        }
+        if ((lower >= beta) or (lower == upper)) {
+            return lower;
+        }
+        if (upper <= alpha) {
+            return upper;
+        }
+        alpha = std::max(alpha, lower);
+        beta = std::min(beta, upper);
+    }
+    std::array<int, HalfSkat::cards_per_player> moves;
+    int const num_moves = get_moves(player, played, moves);
+    for (int m=1; (hint >= 0) and (m<num_moves); m++) {
+        if (moves[m] == hint) {
+            std::rotate(moves.begin(), moves.begin() + m, moves.begin() + m + 1);
+            break;
+        }
+    }
+    std::array<int, 3> const current = trick;
+    int best_move = -1;
+    bool const maximize = (player == declarer);
+    int best = maximize ? std::numeric_limits<int>::min() : std::numeric_limits<int>::max();
+    int a = alpha;
+    int b = beta;
+    for (int m=0; m<num_moves; m++) {
+        int const id = moves[m];
+        hands[player] ^= Cards::CardMask(1) << id;
+        trick = current;
+        trick[played] = id;
+        int value;
+        if (played == 2) {
+            int winner = 0;
+            int best_key = ClubsRules::get_key(trick[0], trick[0]);
+            for (int i=1; i<3; i++) {
+                int const k = ClubsRules::get_key(trick[i], trick[0]);
+                if (k > best_key) {
+                    best_key = k;
+                    winner = i;
+                }
+            }
+            int const winner_seat = (player + 1 + winner) % 3;
+            int const won = (winner_seat == declarer) ? (get_points(trick[0]) + get_points(trick[1]) + get_points(trick[2])) : 0;
+            value = won + search(winner_seat, 0, a - won, b - won);
+        }
+        else {
+            value = search((player + 1) % 3, played + 1, a, b);
+        }
+        hands[player] ^= Cards::CardMask(1) << id;
+        if (maximize ? (value > best) : (value < best)) {
+            best = value;
+            best_move = id;
+        }
+        if (maximize) {
+            a = std::max(a, value);
+        }
+        else {
+            b = std::min(b, value);
+        }
+        if (a >= b) {
+            break;
+        }
+    }
+    trick = current;
+    if (entry != nullptr) {
+        if (best <= alpha) {
+            upper = best;
+        }
+        else if (best >= beta) {
+            lower = best;
+        }
+        else {
+            lower = upper = best;
+        }
+        entry->key = key;
+        entry->lower = lower;
+        entry->upper = upper;
+        entry->move = best_move;
+    }
+    return best;
+}
+
+int Solver::solve(Hands const& new_hands, int const new_declarer, int const leader) {
+    start(new_hands, new_declarer);
+    return search(leader, 0, -1, 121);
+}
+
+void Solver::solve_leads(Hands const& new_hands, int const new_declarer, int const leader, std::array<int, 32>& points) {
+    start(new_hands, new_declarer);
+    points.fill(0);
+    std::array<int, HalfSkat::cards_per_player> moves;
+    int const num_moves = get_moves(leader, 0, moves);
+    for (int m=0; m<num_moves; m++) {
+        int const id = moves[m];
+        hands[leader] ^= Cards::CardMask(1) << id;
+        trick[0] = id;
+        // MTD(f): null window searches around the value of the previous lead converge faster than a full window
+        int lower = 0;
+        int upper = 120;
+        int guess = (m > 0) ? points[moves[m - 1]] : 60;
+        while (lower < upper) {
+            int const beta = (guess == lower) ? guess + 1 : guess;
+            guess = search((leader + 1) % 3, 1, beta - 1, beta);
+            if (guess < beta) {
+                upper = guess;
+            }
+            else {
+                lower = guess;
+            }
+        }
+        points[id] = guess;
+        hands[leader] ^= Cards::CardMask(1) << id;
+    }
+    // Skipped leads take the value of the card they are equivalent to, which is searched or equivalent to a higher one
+    Cards::CardMask const hand = hands[leader];
+    Cards::CardMask const remaining = hands[0] | hands[1] | hands[2];
+    for (Cards::CardMask cards = hand; cards != 0; cards &= cards - 1) {
+        int id = __builtin_ctz(cards);
+        int const start_id = id;
+        for (int next = get_equivalent(id, hand, remaining); next >= 0; next = get_equivalent(id, hand, remaining)) {
+            id = next;
+        }
+        points[start_id] = points[id];
+    }
+}
+
+void LeadBook::build_book(std::string const& path, Settings const& settings) {
+    unsigned const seed = (settings.seed != 0) ? settings.seed : std::random_device{}();
+    std::vector<Cards::CardMask> hands;
+    if (not settings.hands.empty()) {
+        for (auto const hand : settings.hands) {
+            if (Cards::count_cards(hand) != HalfSkat::cards_per_player) {
+                throw std::runtime_error("Hands must contain ten cards.");
+            }
+            hands.push_back(HandStrength::canonicalize(hand));
+        }
+    }
+    else if (settings.sample_hands > 0) {
+        hands = HandStrength::sample_canonical_hands(settings.sample_hands, seed);
+    }
+    else {
+        throw std::runtime_error("Book needs a list of hands or a positive number of sampled hands.");
+    }
+    std::sort(hands.begin(), hands.end());
+    hands.erase(std::unique(hands.begin(), hands.end()), hands.end());
+    if (settings.deals_per_hand <= 0) {
+        throw std::runtime_error("Hands need at least one deal.");
+    }
+    if (settings.roles.empty()) {
+        throw std::runtime_error("Book needs at least one role.");
+    }
+    for (auto const role : settings.roles) {
+        if ((role != Scenario::declarer) and (role != Scenario::first_defender) and (role != Scenario::second_defender)) {
+            throw std::runtime_error("Only players lead.");
+        }
+    }
+    size_t const num_items = hands.size()*settings.roles.size();
+    std::vector<Entry> entries(num_items);
+    std::atomic<size_t> next_item{0};
+    std::atomic<bool> stop{false};
+    Parallel::run_on_threads(Parallel::get_num_threads(settings.threads), stop, [&](int) {
+        Solver solver;
+        std::vector<int> rest;
+        std::array<int, 32> points;
+        while (not stop) {
+            size_t const item = next_item++;
+            if (item >= num_items) {
+                return;
+            }
+            Cards::CardMask const hand = hands[item / settings.roles.size()];
+            int const role = settings.roles[item % settings.roles.size()];
+            // The leader sits in seat 0, the declarer in the seat its role is relative to
+            int const declarer = (3 - role) % 3;
+            // Deals only depend on seed, hand and role, not on the thread
+            std::seed_seq seq{seed, hand, static_cast<uint32_t>(role)};
+            std::mt19937 engine(seq);
+            rest.clear();
+            for (int id=0; id<32; id++) {
+                if (not ((hand >> id) & 1)) {
+                    rest.push_back(id);
+                }
+            }
+            std::array<double, 32> sums = {};
+            for (int d=0; d<settings.deals_per_hand; d++) {
+                std::shuffle(rest.begin(), rest.end(), engine);
+                Hands deal = {{hand, 0, 0}};
+                for (int i=0; i<2*HalfSkat::cards_per_player; i++) {
+                    deal[1 + i / HalfSkat::cards_per_player] |= Cards::CardMask(1) << rest[i];
+                }
+                int const skat_points = get_points(rest[2*HalfSkat::cards_per_player]) + get_points(rest[2*HalfSkat::cards_per_player + 1]);
+                solver.solve_leads(deal, declarer, 0, points);
+                for (Cards::CardMask cards = hand; cards != 0; cards &= cards - 1) {
+                    int const id = __builtin_ctz(cards);
+                    int const declarer_points = points[id] + skat_points;
+                    sums[id] += (role == Scenario::declarer) ? declarer_points : 120 - declarer_points;
+                }
+            }
+            Entry& e = entries[item];
+            e.hand = hand;
+            e.role = role;
+            int idx = 0;
+            double best = -1.;
+            for (Cards::CardMask cards = hand; cards != 0; cards &= cards - 1, idx++) {
+                int const id = __builtin_ctz(cards);
+                double const mean = sums[id] / settings.deals_per_hand;
+                e.points[idx] = static_cast<uint16_t>(std::lround(mean*256.));
+                if (mean > best) {
+                    best = mean;
+                    e.best_lead = id;
+                }
+            }
+        }
+    });
+    // Open addressing with linear probing, at most half of the slots are used
+    int slot_bits = 1;
+    while ((size_t(1) << slot_bits) < 2*entries.size()) {
+        slot_bits++;
+    }
+    size_t const num_slots = size_t(1) << slot_bits;
+    std::vector<Entry> slots(num_slots);
+    for (auto const& e : entries) {
+        size_t s = get_slot(e.hand, e.role, slot_bits);
+        while (slots[s].hand != 0) {
+            s = (s + 1) & (num_slots - 1);
+        }
+        slots[s] = e;
+    }
+    FileHeader header;
+    std::memcpy(header.magic, file_magic, sizeof(file_magic));
+    header.version = file_version;
+    header.slot_bits = slot_bits;
+    header.deals_per_hand = settings.deals_per_hand;
+    header.num_entries = entries.size();
+    std::FILE* file = std::fopen(path.c_str(), "wb");
+    if (file == nullptr) {
+        throw std::runtime_error("Could not open lead book " + path);
+    }
+    bool const written = (std::fwrite(&header, sizeof(header), 1, file) == 1) and (std::fwrite(slots.data(), sizeof(Entry), num_slots, file) == num_slots);
+    std::fclose(file);
+    if (not written) {
+        throw std::runtime_error("Could not write lead book " + path);
+    }
+}
+
+Book::Book(std::string const& path) : file(path, "lead book", sizeof(FileHeader)) {
+    FileHeader const* header = reinterpret_cast<FileHeader const*>(file.data());
+    if ((std::memcmp(header->magic, file_magic, sizeof(file_magic)) != 0) or (header->version != file_version) or (header->slot_bits < 1) or (header->slot_bits > 31)
+            or (file.size() != sizeof(FileHeader) + (size_t(1) << header->slot_bits)*sizeof(Entry))
+            or (header->num_entries >= (size_t(1) << header->slot_bits))) {
+        throw std::runtime_error("Not a lead book: " + path);
+    }
+    file.advise_random();
+    slot_bits = header->slot_bits;
+    num_entries = header->num_entries;
+    deals_per_hand = header->deals_per_hand;
+    slots = reinterpret_cast<Entry const*>(file.data() + sizeof(FileHeader));
+}
+
+Entry const* Book::find(Cards::CardMask const hand, Scenario::Role const role) const {
+    Cards::CardMask const key = HandStrength::canonicalize(hand);
+    size_t const mask = (size_t(1) << slot_bits) - 1;
+    // Bounded by the number of slots, so a corrupt book without empty slots can't loop forever
+    size_t s = get_slot(key, role, slot_bits);
+    for (size_t probes=0; (probes <= mask) and (slots[s].hand != 0); probes++, s=(s+1) & mask) {
+        if ((slots[s].hand == key) and (slots[s].role == role)) {
+            return &slots[s];
+        }
+    }
+    return nullptr;
+}
+
+bool Book::get_best_lead(Cards::CardMask const hand, Scenario::Role const role, Cards::Card& lead) const {
+    Entry const* e = find(hand, role);
+    if (e == nullptr) {
+        return false;
+    }
+    std::array<int, 4> colors;
+    HandStrength::canonicalize(hand, colors);
+    lead = Cards::Card(get_original_id(e->best_lead, colors));
+    return true;
+}
+
+bool Book::get_lead_points(Cards::CardMask const hand, Scenario::Role const role, std::array<float, 32>& points) const {
+    Entry const* e = find(hand, role);
+    if (e == nullptr) {
+        return false;
+    }
+    std::array<int, 4> colors;
+    Cards::CardMask const canonical = HandStrength::canonicalize(hand, colors);
+    points.fill(std::nanf(""));
+    int idx = 0;
+    for (Cards::CardMask cards = canonical; cards != 0; cards &= cards - 1, idx++) {
+        points[get_original_id(__builtin_ctz(cards), colors)] = e->get_points(idx);
+    }
+    return true;
+}
+
+BookPlayer::BookPlayer(std::shared_ptr<Book const> book, std::shared_ptr<HalfSkat::Player> fallback) : book(book), fallback(fallback) {
+    if ((not book) or (not fallback)) {
+        throw std::runtime_error("BookPlayer needs a book and a fallback player.");
+    }
+}
+
+Cards::Card BookPlayer::query_policy() {
+    HalfSkat::PlayerState const& state = m_last_state;
+    bool const opening = state.trick.empty() and (state.won_friendly == 0) and (state.won_hostile == 0) and (state.contract.type == HalfSkat::clubs_game)
+        and (Cards::count_cards(state.hole_cards) == HalfSkat::cards_per_player);
+    if (opening) {
+        Cards::Card lead;
+        if (book->get_best_lead(state.hole_cards, static_cast<Scenario::Role>(m_last_role), lead) and Cards::in_mask(state.legal_cards, lead)) {
+            hits++;
+            return lead;
+        }
+        misses++;
+    }
+    return fallback->get_delegated_action(state);
+}
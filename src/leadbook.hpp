@@ -0,0 +1,108 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "cards.hpp"
+#include "halfskat.hpp"
+#include "mapping.hpp"
+#include "scenario.hpp"
+
+// Opening leads of HalfSkat rounds (clubs are trump) evaluated offline by double dummy search, looked up from a memory-mapped book
+namespace LeadBook {
+
+using Hands = std::array<Cards::CardMask, 3>; // Cards by seat
+
+// Alpha-beta search of the card play with all hands known, every player maximizes the points of its side.
+// Keeps its transposition table between calls, each thread needs its own Solver.
+class Solver {
+    public:
+        Solver();
+        // Declarer card points of the tricks still to be played (without the Skat), leader on lead with hands of equal size
+        int solve(Hands const& hands, int const declarer, int const leader);
+        // Same for every card of the leader's hand led first, 0 for other cards. Leads ranking next to each other
+        // with the same points play the same and are searched once.
+        void solve_leads(Hands const& hands, int const declarer, int const leader, std::array<int, 32>& points);
+        uint64_t get_nodes() const { return nodes; }
+    private:
+        struct TableEntry {
+            uint64_t key = 0;
+            int8_t lower = 0;
+            int8_t upper = 0;
+            int8_t move = -1; // Best or refuting lead found last, searched first
+        };
+        std::vector<TableEntry> table; // Positions at the start of tricks, always replaced
+        uint64_t generation = 0; // Part of the keys, so a new deal doesn't need to clear the table
+        uint64_t nodes = 0;
+        Hands hands;
+        int declarer = 0;
+        std::array<int, 3> trick; // Card ids of the current trick
+        void start(Hands const& hands, int const declarer);
+        int search(int const player, int const played, int alpha, int beta);
+        int get_moves(int const player, int const played, std::array<int, HalfSkat::cards_per_player>& moves) const;
+};
+
+struct Entry {
+    Cards::CardMask hand = 0; // Canonical hand of the leader, zero marks an empty slot
+    uint8_t role = 0; // Scenario::Role of the leader
+    uint8_t best_lead = 0; // Card id of the lead with the most points for the leader's side
+    uint16_t reserved = 0;
+    // Mean card points of the leader's side (Skat included) in 1/256 points, by card of hand in ascending id order
+    std::array<uint16_t, HalfSkat::cards_per_player> points = {};
+    float get_points(int const idx) const { return points[idx] / 256.f; }
+};
+static_assert(sizeof(Entry) == 28, "Entry must stay 28 bytes");
+
+struct Settings {
+    std::vector<Cards::CardMask> hands; // Leader hands to evaluate, if empty sample_hands are drawn
+    // Number of distinct canonical hands drawn from random deals. Solving all 11.2 million canonical hands is out of
+    // reach, so the book always covers a sample or a given list.
+    long sample_hands = 1000;
+    std::vector<Scenario::Role> roles = {Scenario::declarer, Scenario::first_defender, Scenario::second_defender};
+    int deals_per_hand = 20; // Random deals of the remaining cards solved per hand and role
+    int threads = 0; // Zero uses all cores
+    unsigned seed = 0; // Zero draws a random seed
+};
+
+// Solves every lead of the hands and roles of settings and writes the book to path
+void build_book(std::string const& path, Settings const& settings);
+
+// Read-only memory mapping of a file written by build_book
+class Book {
+    public:
+        Book(std::string const& path);
+        // Entry of the canonical form of hand, nullptr if the hand wasn't evaluated for role
+        Entry const* find(Cards::CardMask const hand, Scenario::Role const role) const;
+        // Best lead of hand itself (not its canonical form), false if the hand wasn't evaluated
+        bool get_best_lead(Cards::CardMask const hand, Scenario::Role const role, Cards::Card& lead) const;
+        // Mean points of the leader's side by card id of hand, NaN for cards not in hand
+        bool get_lead_points(Cards::CardMask const hand, Scenario::Role const role, std::array<float, 32>& points) const;
+        size_t size() const { return num_entries; }
+        int get_deals_per_hand() const { return deals_per_hand; }
+    private:
+        Mapping::File file;
+        size_t num_entries = 0;
+        int deals_per_hand = 0;
+        int slot_bits = 0;
+        Entry const* slots = nullptr;
+};
+
+// Leads the best card of the book in the first trick of HalfSkat rounds, every other card (and every lead of a hand
+// missing in the book) is decided by fallback
+class BookPlayer : public HalfSkat::Player {
+    public:
+        BookPlayer(std::shared_ptr<Book const> book, std::shared_ptr<HalfSkat::Player> fallback);
+        Cards::Card query_policy() override;
+        uint64_t get_hits() const { return hits; }
+        uint64_t get_misses() const { return misses; }
+    private:
+        std::shared_ptr<Book const> book;
+        std::shared_ptr<HalfSkat::Player> fallback;
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+};
+
+} // namespace LeadBook
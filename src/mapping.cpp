@@ -0,0 +1,38 @@
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mapping.hpp"
+
+using namespace Mapping;
+
+File::File(std::string const& path, std::string const& description, size_t const min_size) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Could not open " + description + " " + path);
+    }
+    struct stat st;
+    if ((fstat(fd, &st) != 0) or (static_cast<size_t>(st.st_size) < min_size) or (st.st_size == 0)) {
+        close(fd);
+        throw std::runtime_error("Not a " + description + ": " + path);
+    }
+    mapped_size = st.st_size;
+    mapped = mmap(nullptr, mapped_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        mapped = nullptr;
+        throw std::runtime_error("Could not map " + description + " " + path);
+    }
+}
+
+File::~File() {
+    if (mapped != nullptr) {
+        munmap(mapped, mapped_size);
+    }
+}
+
+void File::advise_random() const {
+    madvise(mapped, mapped_size, MADV_RANDOM);
+}
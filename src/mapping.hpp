@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// Read-only memory mappings of the binary files written by the record writer and the table builders
+namespace Mapping {
+
+class File {
+    public:
+        // Throws if path can't be mapped or is shorter than min_size, description names the kind of file in errors
+        File(std::string const& path, std::string const& description, size_t const min_size);
+        ~File();
+        File(File const&) = delete;
+        File& operator=(File const&) = delete;
+        char const* data() const { return static_cast<char const*>(mapped); }
+        size_t size() const { return mapped_size; }
+        // Tells the kernel that reads jump around the file, so read-ahead doesn't waste memory
+        void advise_random() const;
+    private:
+        void* mapped = nullptr;
+        size_t mapped_size = 0;
+};
+
+} // namespace Mapping
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Spreads work of the table builders, tournaments, tests and trainers over all cores
+namespace Parallel {
+
+// threads if positive, otherwise the number of cores
+inline int get_num_threads(int const threads) {
+    if (threads > 0) {
+        return threads;
+    }
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+// Runs work(thread_index) on num_threads threads, rethrows the first exception after all have finished.
+// The first exception sets stop, work running for long should poll it and return.
+template<typename F>
+void run_on_threads(int const num_threads, std::atomic<bool>& stop, F work) {
+    std::mutex mutex;
+    std::exception_ptr error;
+    std::vector<std::thread> threads;
+    for (int t=0; t<num_threads; t++) {
+        threads.emplace_back([&, t]() {
+            try {
+                work(t);
+            }
+            catch (...) {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (not error) {
+                    error = std::current_exception();
+                }
+                stop = true;
+            }
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+template<typename F>
+void run_on_threads(int const num_threads, F work) {
+    std::atomic<bool> stop{false};
+    run_on_threads(num_threads, stop, work);
+}
+
+} // namespace Parallel
@@ -0,0 +1,381 @@
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <thread>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "pipeline.hpp"
+
+using namespace Pipeline;
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "Shared memory needs lock-free 64 bit atomics");
+
+namespace Pipeline {
+
+// Fields written by different processes live on separate cache lines
+struct SegmentHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t max_actors;
+    uint32_t ring_slots;
+    uint32_t slot_size;
+    uint64_t weights_capacity;
+    std::atomic<uint32_t> closed;
+    alignas(64) std::atomic<uint64_t> weights_sequence; // Odd while the learner writes weights
+    std::atomic<uint64_t> weights_size;
+};
+
+struct ActorControl {
+    alignas(64) std::atomic<uint32_t> claimed;
+    std::atomic<int32_t> pid;
+    alignas(64) std::atomic<uint64_t> head; // Next message written by the actor
+    std::atomic<uint64_t> bytes;
+    std::atomic<uint64_t> full_waits;
+    std::atomic<int64_t> first_push_ns;
+    std::atomic<int64_t> last_push_ns;
+    alignas(64) std::atomic<uint64_t> tail; // Next message read by the learner
+    std::atomic<uint64_t> malformed; // Messages the learner skipped for a length beyond the slot
+};
+
+} // namespace Pipeline
+
+namespace {
+
+char const segment_magic[8] = {'P', 'Y', 'S', 'K', 'A', 'T', 'P', 'L'};
+uint32_t const segment_version = 1;
+
+size_t align(size_t const size) {
+    return (size + 63) & ~size_t(63);
+}
+
+size_t get_rings_offset(uint32_t const max_actors) {
+    return align(sizeof(SegmentHeader)) + max_actors*align(sizeof(ActorControl));
+}
+
+size_t get_weights_offset(SegmentHeader const& h) {
+    return get_rings_offset(h.max_actors) + align(size_t(h.max_actors) * h.ring_slots * h.slot_size);
+}
+
+int64_t get_time_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Spins briefly, then sleeps so that idle processes don't burn cores
+void backoff(int& rounds) {
+    if (rounds++ < 64) {
+        std::this_thread::yield();
+    }
+    else {
+        std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+}
+
+std::string get_shm_name(std::string const& name) {
+    return (not name.empty() and (name[0] == '/')) ? name : "/" + name;
+}
+
+} // namespace
+
+Segment::Segment(std::string const& name, Config const* config) : name(get_shm_name(name)), owner(config != nullptr) {
+    int fd;
+    if (owner) {
+        if ((config->max_actors <= 0) or (config->ring_slots <= 0) or (config->slot_size <= 4)) {
+            throw std::runtime_error("Invalid pipeline config");
+        }
+        SegmentHeader h;
+        h.max_actors = config->max_actors;
+        h.ring_slots = config->ring_slots;
+        h.slot_size = config->slot_size;
+        h.weights_capacity = config->weights_capacity;
+        mapped_size = get_weights_offset(h) + config->weights_capacity;
+        fd = shm_open(this->name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+        if ((fd >= 0) and (ftruncate(fd, mapped_size) != 0)) {
+            close(fd);
+            shm_unlink(this->name.c_str());
+            fd = -1;
+        }
+    }
+    else {
+        fd = shm_open(this->name.c_str(), O_RDWR, 0600);
+        struct stat st;
+        if ((fd >= 0) and ((fstat(fd, &st) != 0) or (static_cast<size_t>(st.st_size) < sizeof(SegmentHeader)))) {
+            close(fd);
+            fd = -1;
+        }
+        mapped_size = (fd >= 0) ? st.st_size : 0;
+    }
+    if (fd < 0) {
+        throw std::runtime_error("Could not open shared memory " + this->name);
+    }
+    data = mmap(nullptr, mapped_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        data = nullptr;
+        if (owner) {
+            shm_unlink(this->name.c_str());
+        }
+        throw std::runtime_error("Could not map shared memory " + this->name);
+    }
+    if (owner) {
+        // Fresh mapping is zeroed, the atomics only need to be constructed
+        SegmentHeader* h = new (data) SegmentHeader();
+        h->version = segment_version;
+        h->max_actors = config->max_actors;
+        h->ring_slots = config->ring_slots;
+        h->slot_size = config->slot_size;
+        h->weights_capacity = config->weights_capacity;
+        h->closed = 0;
+        h->weights_sequence = 0;
+        h->weights_size = 0;
+        for (int i=0; i<config->max_actors; i++) {
+            new (&actor(i)) ActorControl();
+        }
+        std::atomic_thread_fence(std::memory_order_release);
+        std::memcpy(h->magic, segment_magic, sizeof(segment_magic)); // Written last, attaching actors check it
+    }
+    else {
+        SegmentHeader const& h = header();
+        if ((std::memcmp(h.magic, segment_magic, sizeof(segment_magic)) != 0) or (h.version != segment_version) or (mapped_size != get_weights_offset(h) + h.weights_capacity)) {
+            munmap(data, mapped_size);
+            data = nullptr;
+            throw std::runtime_error("Not a pipeline segment: " + this->name);
+        }
+    }
+}
+
+Segment::~Segment() {
+    if (data != nullptr) {
+        munmap(data, mapped_size);
+    }
+    if (owner) {
+        shm_unlink(name.c_str());
+    }
+}
+
+ActorControl& Segment::actor(int const idx) const {
+    return *reinterpret_cast<ActorControl*>(static_cast<char*>(data) + align(sizeof(SegmentHeader)) + idx*align(sizeof(ActorControl)));
+}
+
+char* Segment::slot(int const actor, uint64_t const idx) const {
+    SegmentHeader const& h = header();
+    size_t const ring = size_t(actor) * h.ring_slots * h.slot_size;
+    return static_cast<char*>(data) + get_rings_offset(h.max_actors) + ring + (idx % h.ring_slots) * h.slot_size;
+}
+
+char* Segment::weights() const {
+    return static_cast<char*>(data) + get_weights_offset(header());
+}
+
+Learner::Learner(std::string const& name, Config const& config) : segment(name, &config) {}
+
+Learner::~Learner() {
+    close();
+}
+
+std::vector<std::string> Learner::pop(size_t const max_messages) {
+    std::vector<std::string> messages;
+    SegmentHeader const& h = segment.header();
+    int const n = h.max_actors;
+    // Round robin over actors, one message each per pass
+    bool found = true;
+    while (found and (messages.size() < max_messages)) {
+        found = false;
+        for (int i=0; (i<n) and (messages.size() < max_messages); i++) {
+            int const a = (next_actor + i) % n;
+            ActorControl& ctl = segment.actor(a);
+            uint64_t const tail = ctl.tail.load(std::memory_order_relaxed);
+            if (tail == ctl.head.load(std::memory_order_acquire)) {
+                continue;
+            }
+            char const* slot = segment.slot(a, tail);
+            uint32_t length;
+            std::memcpy(&length, slot, sizeof(length));
+            // Actors may crash halfway, never trust the length beyond the slot
+            if (length > h.slot_size - sizeof(length)) {
+                ctl.malformed.fetch_add(1, std::memory_order_relaxed);
+            }
+            else {
+                messages.emplace_back(slot + sizeof(length), length);
+            }
+            ctl.tail.store(tail + 1, std::memory_order_release);
+            found = true;
+        }
+        next_actor = (next_actor + 1) % n;
+    }
+    return messages;
+}
+
+std::vector<std::string> Learner::pop_wait(size_t const max_messages, double const timeout) {
+    auto const deadline = std::chrono::steady_clock::now() + std::chrono::duration<double>(timeout);
+    int rounds = 0;
+    while (true) {
+        std::vector<std::string> messages = pop(max_messages);
+        if ((not messages.empty()) or (std::chrono::steady_clock::now() >= deadline)) {
+            return messages;
+        }
+        backoff(rounds);
+    }
+}
+
+// Sequence lock: actors retry their copy if the learner wrote in between
+void Learner::publish_weights(std::string const& weights) {
+    SegmentHeader& h = segment.header();
+    if (weights.size() > h.weights_capacity) {
+        throw std::runtime_error("Weights exceed capacity of pipeline");
+    }
+    uint64_t const seq = h.weights_sequence.load(std::memory_order_relaxed);
+    h.weights_sequence.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(segment.weights(), weights.data(), weights.size());
+    h.weights_size.store(weights.size(), std::memory_order_relaxed);
+    h.weights_sequence.store(seq + 2, std::memory_order_release);
+}
+
+uint64_t Learner::get_weights_version() const {
+    return segment.header().weights_sequence.load() / 2;
+}
+
+std::vector<ActorStats> Learner::get_stats() const {
+    std::vector<ActorStats> stats;
+    SegmentHeader const& h = segment.header();
+    for (uint32_t i=0; i<h.max_actors; i++) {
+        ActorControl const& ctl = segment.actor(i);
+        ActorStats s;
+        s.actor = i;
+        s.pid = ctl.pid.load();
+        s.attached = ctl.claimed.load();
+        s.pushed = ctl.head.load();
+        s.popped = ctl.tail.load();
+        s.bytes = ctl.bytes.load();
+        s.full_waits = ctl.full_waits.load();
+        s.malformed = ctl.malformed.load();
+        if (s.pushed == 0) {
+            continue;
+        }
+        s.seconds = (ctl.last_push_ns.load() - ctl.first_push_ns.load()) * 1e-9;
+        if (s.seconds > 0.) {
+            s.messages_per_second = s.pushed / s.seconds;
+            s.bytes_per_second = s.bytes / s.seconds;
+        }
+        stats.push_back(s);
+    }
+    return stats;
+}
+
+void Learner::close() {
+    segment.header().closed.store(1);
+}
+
+Actor::Actor(std::string const& name) : segment(name, nullptr) {
+    SegmentHeader const& h = segment.header();
+    int32_t const pid = getpid();
+    for (uint32_t i=0; (i<h.max_actors) and (index < 0); i++) {
+        uint32_t expected = 0;
+        if (segment.actor(i).claimed.compare_exchange_strong(expected, 1)) {
+            segment.actor(i).pid.store(pid);
+            index = i;
+        }
+    }
+    // Rings of actors that died without releasing them are taken over, unread messages are still delivered
+    for (uint32_t i=0; (i<h.max_actors) and (index < 0); i++) {
+        ActorControl& ctl = segment.actor(i);
+        int32_t owner = ctl.pid.load();
+        if (ctl.claimed.load() and (owner != 0) and (kill(owner, 0) != 0) and (errno == ESRCH) and ctl.pid.compare_exchange_strong(owner, pid)) {
+            index = i;
+        }
+    }
+    if (index < 0) {
+        throw std::runtime_error("All actor rings of the pipeline are taken");
+    }
+    segment.actor(index).first_push_ns.store(0);
+}
+
+Actor::~Actor() {
+    ActorControl& ctl = segment.actor(index);
+    ctl.pid.store(0); // A stale pid could let others take over the ring while it is claimed again
+    ctl.claimed.store(0);
+}
+
+bool Actor::try_push(std::string const& message) {
+    SegmentHeader const& h = segment.header();
+    if (message.size() + sizeof(uint32_t) > h.slot_size) {
+        throw std::runtime_error("Message exceeds slot size of pipeline");
+    }
+    if (h.closed.load() != 0) {
+        return false;
+    }
+    ActorControl& ctl = segment.actor(index);
+    uint64_t const head = ctl.head.load(std::memory_order_relaxed);
+    if (head - ctl.tail.load(std::memory_order_acquire) >= h.ring_slots) { // Full
+        return false;
+    }
+    char* slot = segment.slot(index, head);
+    uint32_t const length = message.size();
+    std::memcpy(slot, &length, sizeof(length));
+    std::memcpy(slot + sizeof(length), message.data(), length);
+    ctl.head.store(head + 1, std::memory_order_release);
+    int64_t const now = get_time_ns();
+    if (ctl.first_push_ns.load(std::memory_order_relaxed) == 0) {
+        ctl.first_push_ns.store(now, std::memory_order_relaxed);
+    }
+    ctl.last_push_ns.store(now, std::memory_order_relaxed);
+    ctl.bytes.fetch_add(length, std::memory_order_relaxed);
+    return true;
+}
+
+bool Actor::push(std::string const& message, double const timeout) {
+    if (try_push(message)) {
+        return true;
+    }
+    if (is_closed()) {
+        return false;
+    }
+    segment.actor(index).full_waits.fetch_add(1, std::memory_order_relaxed);
+    auto const deadline = std::chrono::steady_clock::now() + std::chrono::duration<double>(std::max(timeout, 0.));
+    int rounds = 0;
+    while (not is_closed()) {
+        if (try_push(message)) {
+            return true;
+        }
+        if ((timeout >= 0.) and (std::chrono::steady_clock::now() >= deadline)) {
+            return false;
+        }
+        backoff(rounds);
+    }
+    return false;
+}
+
+bool Actor::poll_weights(std::string& out) {
+    SegmentHeader const& h = segment.header();
+    int rounds = 0;
+    while (true) {
+        uint64_t const seq = h.weights_sequence.load(std::memory_order_acquire);
+        if ((seq == 0) or (seq / 2 <= weights_version)) { // Nothing new
+            return false;
+        }
+        if (seq % 2 == 0) {
+            size_t const size = std::min<uint64_t>(h.weights_size.load(std::memory_order_relaxed), h.weights_capacity);
+            out.assign(segment.weights(), size);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (h.weights_sequence.load(std::memory_order_relaxed) == seq) {
+                weights_version = seq / 2;
+                return true;
+            }
+        }
+        backoff(rounds);
+    }
+}
+
+size_t Actor::get_max_message_size() const {
+    return segment.header().slot_size - sizeof(uint32_t);
+}
+
+bool Actor::is_closed() const {
+    return segment.header().closed.load() != 0;
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Actor/learner transport between local processes over POSIX shared memory, no network service needed.
+// Every actor owns a lock-free single-producer ring, the learner drains all rings and publishes weights back.
+namespace Pipeline {
+
+struct Config {
+    int max_actors = 64;
+    int ring_slots = 1024; // Messages buffered per actor before it is blocked
+    int slot_size = 4096; // Bytes per message including a four byte length
+    size_t weights_capacity = size_t(16) << 20;
+};
+
+struct ActorStats {
+    int actor = 0; // Ring index
+    int pid = 0;
+    bool attached = false;
+    uint64_t pushed = 0;
+    uint64_t popped = 0;
+    uint64_t bytes = 0;
+    uint64_t full_waits = 0; // Pushes that had to wait for the learner
+    uint64_t malformed = 0; // Messages the learner skipped because their length exceeded the slot
+    double seconds = 0.; // Between the first and the latest push
+    double messages_per_second = 0.;
+    double bytes_per_second = 0.;
+};
+
+struct SegmentHeader;
+struct ActorControl;
+
+// Mapping of a shared memory segment, the creator unlinks it when destroyed
+class Segment {
+    public:
+        Segment(std::string const& name, Config const* config); // Creates the segment if config is given, otherwise attaches
+        ~Segment();
+        Segment(Segment const&) = delete;
+        Segment& operator=(Segment const&) = delete;
+        SegmentHeader& header() const { return *static_cast<SegmentHeader*>(data); }
+        ActorControl& actor(int const idx) const;
+        char* slot(int const actor, uint64_t const idx) const;
+        char* weights() const;
+    private:
+        std::string name;
+        bool owner;
+        void* data = nullptr;
+        size_t mapped_size = 0;
+};
+
+// Creates the channel, receives messages of all actors and publishes weights
+class Learner {
+    public:
+        Learner(std::string const& name, Config const& config = Config());
+        ~Learner();
+        // Takes up to max_messages messages, rotating over actors so that none starves
+        std::vector<std::string> pop(size_t const max_messages);
+        // Waits up to timeout seconds for at least one message
+        std::vector<std::string> pop_wait(size_t const max_messages, double const timeout);
+        void publish_weights(std::string const& weights);
+        uint64_t get_weights_version() const;
+        std::vector<ActorStats> get_stats() const;
+        void close(); // Actors stop pushing and fail once the channel is closed
+    private:
+        Segment segment;
+        int next_actor = 0;
+};
+
+// Attaches to the channel of a running learner and claims a free ring, or the ring of an actor process that died
+class Actor {
+    public:
+        Actor(std::string const& name);
+        ~Actor();
+        // False if the ring is full or the channel is closed
+        bool try_push(std::string const& message);
+        // Blocks while the ring is full (backpressure), returns false on timeout (negative waits forever) or if the channel is closed
+        bool push(std::string const& message, double const timeout = -1.);
+        // Copies the latest weights into out if they are newer than the ones seen before
+        bool poll_weights(std::string& out);
+        uint64_t get_weights_version() const { return weights_version; }
+        bool is_closed() const;
+        int get_index() const { return index; }
+        size_t get_max_message_size() const;
+    private:
+        Segment segment;
+        int index = -1;
+        uint64_t weights_version = 0;
+};
+
+} // namespace Pipeline
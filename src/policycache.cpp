@@ -0,0 +1,113 @@
+#include <algorithm>
+#include <stdexcept>
+
+#include "policycache.hpp"
+#include "halfskat.hpp"
+
+using namespace PolicyCache;
+
+namespace {
+
+// Finalizer of SplitMix64
+uint64_t mix(uint64_t x) {
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
+uint64_t combine(uint64_t const seed, uint64_t const value) {
+    return mix(seed ^ (value + 0x9e3779b97f4a7c15ull));
+}
+
+} // namespace
+
+uint64_t PolicyCache::get_key(HalfSkat::PlayerState const& state, uint64_t const policy_id, uint64_t const policy_version) {
+    uint64_t trick = state.trick.size();
+    for (size_t i=0; i<state.trick.size(); i++) {
+        trick = (trick << 8) | (Cards::get_card_id(state.trick[i]) << 1) | state.trick_played_by_friend[i];
+    }
+    uint64_t key = combine(policy_id, policy_version);
+    key = combine(key, (uint64_t(state.hole_cards) << 32) | state.legal_cards);
+    key = combine(key, (uint64_t(state.won_friendly) << 32) | state.won_hostile);
+    key = combine(key, (trick << 16) | (state.contract.type << 2) | (state.contract.hand << 1) | state.is_declarer);
+    return key;
+}
+
+Cache::Cache(size_t const capacity, int const num_shards) {
+    if ((capacity == 0) or (num_shards <= 0)) {
+        throw std::runtime_error("Policy cache needs capacity and shards.");
+    }
+    shard_capacity = std::max<size_t>(1, capacity / num_shards);
+    for (int s=0; s<num_shards; s++) {
+        shards.emplace_back(new Shard());
+        shards.back()->slots.reserve(shard_capacity);
+    }
+}
+
+bool Cache::find(uint64_t const key, Probabilities& probs) {
+    Shard& shard = get_shard(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto const it = shard.slots.find(key);
+    if (it == shard.slots.end()) {
+        shard.misses++;
+        return false;
+    }
+    shard.hits++;
+    shard.referenced[it->second] = 1;
+    probs = shard.values[it->second];
+    return true;
+}
+
+void Cache::insert(uint64_t const key, Probabilities const& probs) {
+    Shard& shard = get_shard(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    if (shard.slots.count(key) != 0) { // Another player computed it meanwhile
+        return;
+    }
+    uint32_t slot;
+    if (shard.keys.size() < shard_capacity) {
+        slot = shard.keys.size();
+        shard.keys.push_back(key);
+        shard.values.push_back(probs);
+        shard.referenced.push_back(0);
+    }
+    else {
+        // Second chance: referenced slots are spared once
+        while (shard.referenced[shard.hand]) {
+            shard.referenced[shard.hand] = 0;
+            shard.hand = (shard.hand + 1) % shard_capacity;
+        }
+        slot = shard.hand;
+        shard.hand = (shard.hand + 1) % shard_capacity;
+        shard.slots.erase(shard.keys[slot]);
+        shard.evictions++;
+        shard.keys[slot] = key;
+        shard.values[slot] = probs;
+    }
+    shard.slots.emplace(key, slot);
+}
+
+CacheStats Cache::get_stats() const {
+    CacheStats stats;
+    for (auto const& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        stats.hits += shard->hits;
+        stats.misses += shard->misses;
+        stats.evictions += shard->evictions;
+        stats.size += shard->keys.size();
+    }
+    stats.forced = forced.load(std::memory_order_relaxed);
+    stats.capacity = shard_capacity*shards.size();
+    return stats;
+}
+
+void Cache::clear() {
+    for (auto& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        shard->slots.clear();
+        shard->keys.clear();
+        shard->values.clear();
+        shard->referenced.clear();
+        shard->hand = 0;
+    }
+}
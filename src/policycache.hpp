@@ -0,0 +1,61 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace HalfSkat {
+struct PlayerState;
+} // namespace HalfSkat
+
+// Memoized policy decisions, shared by players on any number of threads
+namespace PolicyCache {
+
+static const int max_legal_cards = 10;
+using Probabilities = std::array<float, max_legal_cards>; // Of the legal cards in ascending card id order
+
+// Key of everything a player observes in state, the policy and its version
+uint64_t get_key(HalfSkat::PlayerState const& state, uint64_t const policy_id, uint64_t const policy_version);
+
+struct CacheStats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t forced = 0; // Decisions with a single legal card, answered without policy or cache
+    uint64_t evictions = 0;
+    size_t size = 0;
+    size_t capacity = 0;
+    double get_hit_rate() const { return (hits + misses > 0) ? double(hits) / (hits + misses) : 0.; }
+};
+
+// Bounded map from keys to probabilities, split into shards with their own lock and CLOCK eviction
+class Cache {
+    public:
+        Cache(size_t const capacity = 1 << 20, int const num_shards = 64);
+        bool find(uint64_t const key, Probabilities& probs);
+        void insert(uint64_t const key, Probabilities const& probs);
+        void count_forced() { forced.fetch_add(1, std::memory_order_relaxed); }
+        CacheStats get_stats() const;
+        void clear();
+    private:
+        struct Shard {
+            mutable std::mutex mutex;
+            std::unordered_map<uint64_t, uint32_t> slots; // Key to slot
+            std::vector<uint64_t> keys;
+            std::vector<Probabilities> values;
+            std::vector<uint8_t> referenced; // Set on hits, the clock hand evicts the first slot without
+            size_t hand = 0;
+            uint64_t hits = 0;
+            uint64_t misses = 0;
+            uint64_t evictions = 0;
+        };
+        size_t shard_capacity;
+        std::vector<std::unique_ptr<Shard>> shards;
+        std::atomic<uint64_t> forced{0};
+        Shard& get_shard(uint64_t const key) { return *shards[(key >> 32) % shards.size()]; }
+};
+
+} // namespace PolicyCache
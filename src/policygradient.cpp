@@ -0,0 +1,430 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+#include "policygradient.hpp"
+#include "dataset.hpp"
+#include "parallel.hpp"
+#include "policycache.hpp"
+
+using namespace PolicyGradient;
+
+namespace {
+
+size_t const block_rows = 64; // Rows per forward/backward pass, keeps activations in cache
+
+// out = in * kernel + bias for rows of in, inner loops run over contiguous outputs so they vectorize.
+// Zero inputs are skipped, which covers most of the multi-hot state and the inactive relu units.
+void dense(float const* __restrict in, size_t const rows, int const n_in, float const* __restrict kernel, float const* __restrict bias, int const n_out, float* __restrict out) {
+    for (size_t r=0; r<rows; r++) {
+        float* __restrict o = out + r*n_out;
+        std::copy(bias, bias + n_out, o);
+        for (int i=0; i<n_in; i++) {
+            float const x = in[r*n_in + i];
+            if (x == 0.f) {
+                continue;
+            }
+            float const* __restrict k = kernel + size_t(i)*n_out;
+            for (int j=0; j<n_out; j++) {
+                o[j] += x*k[j];
+            }
+        }
+    }
+}
+
+// Eight independent partial sums, so the reduction vectorizes without reassociating floats
+float dot(float const* __restrict a, float const* __restrict b, int const n) {
+    float partial[8] = {};
+    int j = 0;
+    for (; j+8<=n; j+=8) {
+        for (int k=0; k<8; k++) {
+            partial[k] += a[j+k]*b[j+k];
+        }
+    }
+    for (; j<n; j++) {
+        partial[0] += a[j]*b[j];
+    }
+    return ((partial[0] + partial[1]) + (partial[2] + partial[3])) + ((partial[4] + partial[5]) + (partial[6] + partial[7]));
+}
+
+void relu(float* values, size_t const n) {
+    for (size_t i=0; i<n; i++) {
+        values[i] = std::max(values[i], 0.f);
+    }
+}
+
+// Softmax restricted to the legal cards, illegal cards get probability zero
+void masked_softmax(float const* logits, Cards::CardMask const legal_cards, float* probs) {
+    float max_logit = -std::numeric_limits<float>::infinity();
+    for (int c=0; c<32; c++) {
+        if ((legal_cards >> c) & 1) {
+            max_logit = std::max(max_logit, logits[c]);
+        }
+    }
+    float sum = 0.f;
+    for (int c=0; c<32; c++) {
+        probs[c] = ((legal_cards >> c) & 1) ? std::exp(logits[c] - max_logit) : 0.f;
+        sum += probs[c];
+    }
+    for (int c=0; c<32; c++) {
+        probs[c] /= sum;
+    }
+}
+
+double get_seconds_since(std::chrono::steady_clock::time_point const start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+} // namespace
+
+std::vector<int> PolicyGradient::get_default_layers() {
+    return {Dataset::state_size, Dataset::state_size, Dataset::state_size, 100, 100, 32};
+}
+
+Network::Network(std::vector<int> const& layers, unsigned const seed) : layers(layers) {
+    if ((layers.size() < 2) or (layers.front() != Dataset::state_size) or (layers.back() != 32)) {
+        throw std::runtime_error("Network needs state_size inputs and 32 outputs");
+    }
+    size_t size = 0;
+    for (size_t l=0; l+1<layers.size(); l++) {
+        offsets.push_back(size);
+        size += size_t(layers[l])*layers[l+1] + layers[l+1];
+    }
+    parameters.assign(size, 0.f);
+    std::mt19937 engine(seed != 0 ? seed : std::random_device{}());
+    for (size_t l=0; l+1<layers.size(); l++) {
+        float const limit = std::sqrt(6.f / (layers[l] + layers[l+1]));
+        std::uniform_real_distribution<float> distr(-limit, limit);
+        std::generate(&parameters[offsets[l]], &parameters[offsets[l]] + size_t(layers[l])*layers[l+1], [&]() { return distr(engine); });
+    }
+}
+
+std::vector<std::vector<float>> Network::get_weights() const {
+    std::vector<std::vector<float>> weights;
+    for (size_t l=0; l+1<layers.size(); l++) {
+        float const* kernel = &parameters[offsets[l]];
+        float const* bias = kernel + size_t(layers[l])*layers[l+1];
+        weights.emplace_back(kernel, bias);
+        weights.emplace_back(bias, bias + layers[l+1]);
+    }
+    return weights;
+}
+
+std::vector<std::vector<size_t>> Network::get_weight_shapes() const {
+    std::vector<std::vector<size_t>> shapes;
+    for (size_t l=0; l+1<layers.size(); l++) {
+        shapes.push_back({size_t(layers[l]), size_t(layers[l+1])});
+        shapes.push_back({size_t(layers[l+1])});
+    }
+    return shapes;
+}
+
+void Network::set_weights(std::vector<std::vector<float>> const& weights) {
+    std::vector<std::vector<size_t>> const shapes = get_weight_shapes();
+    if (weights.size() != shapes.size()) {
+        throw std::runtime_error("Weights don't match the layers of the network");
+    }
+    std::vector<float> values;
+    for (size_t w=0; w<weights.size(); w++) {
+        size_t const size = (shapes[w].size() == 2) ? shapes[w][0]*shapes[w][1] : shapes[w][0];
+        if (weights[w].size() != size) {
+            throw std::runtime_error("Weights don't match the layers of the network");
+        }
+        values.insert(values.end(), weights[w].begin(), weights[w].end());
+    }
+    parameters = values;
+    version++;
+}
+
+void Network::forward(float* const* activations, size_t const rows) const {
+    size_t const num_layers = layers.size() - 1;
+    for (size_t l=0; l<num_layers; l++) {
+        float const* kernel = &parameters[offsets[l]];
+        float const* bias = kernel + size_t(layers[l])*layers[l+1];
+        dense(activations[l], rows, layers[l], kernel, bias, layers[l+1], activations[l+1]);
+        if (l+1 < num_layers) {
+            relu(activations[l+1], rows*layers[l+1]);
+        }
+    }
+}
+
+void Network::get_probabilities(float const* state, Cards::CardMask const legal_cards, float* probs) const {
+    size_t width = 0;
+    for (int const n : layers) {
+        width = std::max<size_t>(width, n);
+    }
+    std::vector<float> buffer(2*width);
+    std::vector<float*> activations(layers.size());
+    activations[0] = const_cast<float*>(state);
+    for (size_t l=1; l<layers.size(); l++) {
+        activations[l] = &buffer[(l % 2)*width];
+    }
+    forward(activations.data(), 1);
+    masked_softmax(activations.back(), legal_cards, probs);
+}
+
+double Network::accumulate_gradients(Batch const& batch, float const scale, std::vector<float>& grads) const {
+    size_t const num_layers = layers.size() - 1;
+    grads.resize(parameters.size(), 0.f);
+    std::vector<std::vector<float>> buffers(layers.size());
+    std::vector<float*> activations(layers.size());
+    size_t width = 0;
+    for (size_t l=1; l<layers.size(); l++) {
+        buffers[l].resize(block_rows*layers[l]);
+        activations[l] = buffers[l].data();
+        width = std::max<size_t>(width, layers[l]);
+    }
+    std::vector<float> delta(block_rows*width);
+    std::vector<float> previous_delta(block_rows*width);
+    float probs[32];
+    double loss = 0.;
+    for (size_t begin=0; begin<batch.rows; begin+=block_rows) {
+        size_t const rows = std::min(block_rows, batch.rows - begin);
+        activations[0] = const_cast<float*>(batch.states + begin*layers[0]);
+        forward(activations.data(), rows);
+        // Gradient of the loss with respect to the logits: advantage * (p - onehot(action)) on the legal cards
+        for (size_t r=0; r<rows; r++) {
+            size_t const row = begin + r;
+            masked_softmax(activations.back() + r*32, batch.legal_cards[row], probs);
+            int const action = batch.actions[row];
+            float const advantage = batch.advantages[row];
+            loss -= advantage * std::log(std::max(probs[action], 1e-30f));
+            for (int c=0; c<32; c++) {
+                delta[r*32 + c] = advantage * (probs[c] - (c == action ? 1.f : 0.f)) / scale;
+            }
+        }
+        for (size_t l=num_layers; l-->0;) {
+            int const n_in = layers[l];
+            int const n_out = layers[l+1];
+            float const* __restrict kernel = &parameters[offsets[l]];
+            float* __restrict kernel_grad = &grads[offsets[l]];
+            float* __restrict bias_grad = kernel_grad + size_t(n_in)*n_out;
+            float const* in = activations[l];
+            for (size_t r=0; r<rows; r++) {
+                float const* __restrict d = &delta[r*n_out];
+                for (int j=0; j<n_out; j++) {
+                    bias_grad[j] += d[j];
+                }
+                for (int i=0; i<n_in; i++) {
+                    float const x = in[r*n_in + i];
+                    if (x == 0.f) {
+                        continue;
+                    }
+                    float* __restrict g = kernel_grad + size_t(i)*n_out;
+                    for (int j=0; j<n_out; j++) {
+                        g[j] += x*d[j];
+                    }
+                }
+            }
+            if (l == 0) {
+                break;
+            }
+            // Back through the kernel and the relu of the layer below
+            for (size_t r=0; r<rows; r++) {
+                float const* __restrict d = &delta[r*n_out];
+                for (int i=0; i<n_in; i++) {
+                    previous_delta[r*n_in + i] = (in[r*n_in + i] > 0.f) ? dot(kernel + size_t(i)*n_out, d, n_out) : 0.f;
+                }
+            }
+            std::swap(delta, previous_delta);
+        }
+    }
+    return loss;
+}
+
+NetworkPlayer::NetworkPlayer(std::shared_ptr<Network const> network, unsigned const seed) : network(network), engine(seed != 0 ? seed : std::random_device{}()), state(Dataset::state_size) {}
+
+Cards::Card NetworkPlayer::query_policy() {
+    float probs[32];
+    Dataset::encode_state(m_last_state, state.data());
+    network->get_probabilities(state.data(), m_last_state.legal_cards, probs);
+    std::discrete_distribution<int> distr(probs, probs + 32);
+    return Cards::Card(distr(engine));
+}
+
+std::vector<float> NetworkPlayer::query_distribution() {
+    std::vector<float> probs(32);
+    Dataset::encode_state(m_last_state, state.data());
+    network->get_probabilities(state.data(), m_last_state.legal_cards, probs.data());
+    return probs;
+}
+
+Trainer::Trainer(Settings const& settings) : settings(settings), engine(settings.seed != 0 ? settings.seed : std::random_device{}()) {
+    if ((settings.minibatch_size <= 0) or (settings.games_per_episode <= 0) or (settings.max_rounds < 0)) {
+        throw std::runtime_error("Invalid policy gradient settings");
+    }
+    network = std::make_shared<Network>(settings.layers, engine());
+    if (settings.policy_cache_capacity > 0) {
+        policy_cache = std::make_shared<PolicyCache::Cache>(settings.policy_cache_capacity);
+    }
+    num_threads = Parallel::get_num_threads(settings.threads);
+    thread_grads.resize(num_threads);
+}
+
+std::vector<Sample> Trainer::play_games(int const games) {
+    std::vector<std::vector<Sample>> thread_samples(num_threads);
+    std::vector<unsigned> seeds(num_threads);
+    for (auto& s : seeds) {
+        s = engine();
+    }
+    std::atomic<int> next_game{0};
+    Parallel::run_on_threads(num_threads, [&](int const t) {
+        std::mt19937 seeder(seeds[t]);
+        std::array<std::shared_ptr<NetworkPlayer>, 3> players;
+        for (auto& p : players) {
+            p = std::make_shared<NetworkPlayer>(network, seeder());
+            if (policy_cache) {
+                p->set_policy_cache(policy_cache);
+            }
+        }
+        HalfSkat::Game game(players[0], players[1], players[2], settings.max_rounds, false, true);
+        while (next_game++ < games) {
+            game.run_new_game();
+            for (auto& p : players) {
+                std::vector<HalfSkat::Transition> const transitions = p->get_transitions();
+                p->clear_transitions();
+                if (transitions.empty()) {
+                    continue;
+                }
+                float const reward = transitions.back().reward; // Game outcome, like PlayerTrainer
+                for (auto const& tr : transitions) {
+                    thread_samples[t].push_back({tr.before, static_cast<uint8_t>(Cards::get_card_id(tr.action)), reward});
+                }
+            }
+        }
+    });
+    std::vector<Sample> samples;
+    for (auto const& s : thread_samples) {
+        samples.insert(samples.end(), s.begin(), s.end());
+    }
+    return samples;
+}
+
+void Trainer::apply_gradients(std::vector<float> const& grads) {
+    std::vector<float>& params = network->get_parameters();
+    size_t const n = params.size();
+    float const lr = settings.learning_rate;
+    float const eps = settings.epsilon;
+    second_moments.resize(n, 0.f);
+    steps++;
+    if (settings.optimizer == OptimizerType::rmsprop) {
+        float const rho = settings.rho;
+        for (size_t i=0; i<n; i++) {
+            second_moments[i] = rho*second_moments[i] + (1.f - rho)*grads[i]*grads[i];
+            params[i] -= lr*grads[i] / (std::sqrt(second_moments[i]) + eps);
+        }
+    }
+    else {
+        first_moments.resize(n, 0.f);
+        float const b1 = settings.beta_1;
+        float const b2 = settings.beta_2;
+        float const step_size = lr * std::sqrt(1. - std::pow(b2, steps)) / (1. - std::pow(b1, steps));
+        for (size_t i=0; i<n; i++) {
+            first_moments[i] = b1*first_moments[i] + (1.f - b1)*grads[i];
+            second_moments[i] = b2*second_moments[i] + (1.f - b2)*grads[i]*grads[i];
+            params[i] -= step_size*first_moments[i] / (std::sqrt(second_moments[i]) + eps);
+        }
+    }
+    network->mark_changed();
+}
+
+// Splits the rows over the threads, sums their gradients and takes one optimizer step
+double Trainer::train_on_batch(float const* states, uint8_t const* actions, float const* returns, Cards::CardMask const* legal_cards, size_t const rows) {
+    if (rows == 0) {
+        return 0.;
+    }
+    double mean = 0.;
+    for (size_t r=0; r<rows; r++) {
+        mean += returns[r];
+    }
+    mean /= rows;
+    if (settings.subtract_baseline and (steps == 0)) { // First batch has no history yet
+        baseline = mean;
+    }
+    advantages.resize(rows);
+    for (size_t r=0; r<rows; r++) {
+        advantages[r] = returns[r] - (settings.subtract_baseline ? baseline : 0.f);
+    }
+    if (settings.subtract_baseline) {
+        baseline = settings.baseline_decay*baseline + (1.f - settings.baseline_decay)*mean;
+    }
+    int const used_threads = std::min<size_t>(num_threads, (rows + block_rows - 1) / block_rows);
+    std::vector<double> losses(used_threads, 0.);
+    Parallel::run_on_threads(used_threads, [&](int const t) {
+        size_t const begin = rows*t / used_threads;
+        size_t const end = rows*(t + 1) / used_threads;
+        std::vector<float>& grads = thread_grads[t];
+        grads.assign(network->get_parameters().size(), 0.f);
+        Batch batch;
+        batch.states = states + begin*Dataset::state_size;
+        batch.actions = actions + begin;
+        batch.advantages = advantages.data() + begin;
+        batch.legal_cards = legal_cards + begin;
+        batch.rows = end - begin;
+        losses[t] = network->accumulate_gradients(batch, rows, grads);
+    });
+    std::vector<float>& grads = thread_grads[0];
+    for (int t=1; t<used_threads; t++) {
+        for (size_t i=0; i<grads.size(); i++) {
+            grads[i] += thread_grads[t][i];
+        }
+    }
+    apply_gradients(grads);
+    double loss = 0.;
+    for (double const l : losses) {
+        loss += l;
+    }
+    return loss / rows;
+}
+
+double Trainer::train_on_samples(std::vector<Sample> const& samples) {
+    std::vector<size_t> order(samples.size());
+    for (size_t i=0; i<order.size(); i++) {
+        order[i] = i;
+    }
+    size_t const minibatch = settings.minibatch_size;
+    std::vector<float> states(minibatch*Dataset::state_size);
+    std::vector<uint8_t> actions(minibatch);
+    std::vector<float> returns(minibatch);
+    std::vector<Cards::CardMask> legal_cards(minibatch);
+    double loss = 0.;
+    for (int epoch=0; epoch<settings.epochs; epoch++) {
+        std::shuffle(order.begin(), order.end(), engine);
+        loss = 0.;
+        for (size_t begin=0; begin<order.size(); begin+=minibatch) {
+            size_t const rows = std::min(minibatch, order.size() - begin);
+            for (size_t r=0; r<rows; r++) {
+                Sample const& s = samples[order[begin + r]];
+                Dataset::encode_state(s.state, &states[r*Dataset::state_size]);
+                actions[r] = s.action;
+                returns[r] = s.reward;
+                legal_cards[r] = s.state.legal_cards;
+            }
+            loss += train_on_batch(states.data(), actions.data(), returns.data(), legal_cards.data(), rows) * rows;
+        }
+    }
+    return samples.empty() ? 0. : loss / samples.size();
+}
+
+EpisodeStats Trainer::train_episode() {
+    EpisodeStats stats;
+    auto start = std::chrono::steady_clock::now();
+    std::vector<Sample> const samples = play_games(settings.games_per_episode);
+    stats.play_seconds = get_seconds_since(start);
+    start = std::chrono::steady_clock::now();
+    stats.loss = train_on_samples(samples);
+    stats.train_seconds = get_seconds_since(start);
+    stats.decisions = samples.size();
+    for (auto const& s : samples) {
+        stats.mean_reward += s.reward;
+    }
+    if (not samples.empty()) {
+        stats.mean_reward /= samples.size();
+    }
+    stats.baseline = baseline;
+    return stats;
+}
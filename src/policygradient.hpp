@@ -0,0 +1,134 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "cards.hpp"
+#include "halfskat.hpp"
+
+// Native REINFORCE training of the PlayerTrainer policy network, self-play and updates without Python
+namespace PolicyGradient {
+
+// Layer widths of PlayerTrainer's default model, from Dataset::state_size inputs to 32 card probabilities
+std::vector<int> get_default_layers();
+
+// Decisions for a gradient step, states are rows of Dataset::state_size floats
+struct Batch {
+    float const* states = nullptr;
+    uint8_t const* actions = nullptr; // Card ids
+    float const* advantages = nullptr; // Returns minus baseline
+    Cards::CardMask const* legal_cards = nullptr;
+    size_t rows = 0;
+};
+
+// Dense network with relu hidden layers and a softmax over the legal cards.
+// Parameters are stored per layer as kernel (inputs x outputs, row-major like Keras) followed by the bias.
+class Network {
+    public:
+        Network(std::vector<int> const& layers = get_default_layers(), unsigned const seed = 0); // Glorot uniform kernels, zero biases
+        std::vector<int> const& get_layers() const { return layers; }
+        // Keras get_weights order: kernel and bias of every layer
+        std::vector<std::vector<float>> get_weights() const;
+        std::vector<std::vector<size_t>> get_weight_shapes() const;
+        void set_weights(std::vector<std::vector<float>> const& weights);
+        std::vector<float>& get_parameters() { return parameters; }
+        std::vector<float> const& get_parameters() const { return parameters; }
+        // Changes with every update, players report it as policy version to their decision cache
+        uint64_t get_version() const { return version; }
+        void mark_changed() { version++; } // After changing parameters in place
+        // Probabilities of the 32 cards, zero for cards not in legal_cards
+        void get_probabilities(float const* state, Cards::CardMask const legal_cards, float* probs) const;
+        // Adds the gradient of the loss -sum(advantage * log p(action)) / scale to grads and returns the summed loss
+        double accumulate_gradients(Batch const& batch, float const scale, std::vector<float>& grads) const;
+    private:
+        std::vector<int> layers;
+        std::vector<size_t> offsets; // Start of each layer's kernel in parameters
+        std::vector<float> parameters;
+        uint64_t version = 0;
+        void forward(float* const* activations, size_t const rows) const;
+};
+
+// Samples its cards from a network shared with the trainer
+class NetworkPlayer : public HalfSkat::Player {
+    public:
+        NetworkPlayer(std::shared_ptr<Network const> network, unsigned const seed = 0);
+        Cards::Card query_policy() override;
+        std::vector<float> query_distribution() override;
+        uint64_t get_policy_version() const override { return network->get_version(); }
+    protected:
+        float draw_uniform() override { return std::uniform_real_distribution<float>(0.f, 1.f)(engine); }
+    private:
+        std::shared_ptr<Network const> network;
+        std::mt19937 engine;
+        std::vector<float> state;
+};
+
+enum class OptimizerType { rmsprop, adam };
+
+struct Settings {
+    std::vector<int> layers = get_default_layers();
+    OptimizerType optimizer = OptimizerType::rmsprop; // Keras defaults below, like PlayerTrainer's compile
+    float learning_rate = 0.001f;
+    float rho = 0.9f; // RMSprop
+    float beta_1 = 0.9f; // Adam
+    float beta_2 = 0.999f; // Adam
+    float epsilon = 1e-7f;
+    bool subtract_baseline = true; // Advantage is return minus a moving average of returns
+    float baseline_decay = 0.99f;
+    int minibatch_size = 4096;
+    int epochs = 1; // Passes over the decisions of an episode
+    int games_per_episode = 100;
+    int max_rounds = 10; // Rounds of a self-play game, every decision is rewarded with the game outcome
+    int threads = 0; // Zero uses all cores
+    unsigned seed = 0; // Zero draws a random seed
+    size_t policy_cache_capacity = 0; // Self-play decisions cached across games and threads, zero disables
+};
+
+struct EpisodeStats {
+    size_t decisions = 0;
+    double mean_reward = 0.;
+    double loss = 0.; // Mean over decisions of the last epoch
+    double baseline = 0.;
+    double play_seconds = 0.;
+    double train_seconds = 0.;
+};
+
+// Self-play decision, the reward is the outcome of the game for the deciding player
+struct Sample {
+    HalfSkat::PlayerState state;
+    uint8_t action;
+    float reward;
+};
+
+class Trainer {
+    public:
+        Trainer(Settings const& settings = Settings());
+        std::shared_ptr<Network> get_network() { return network; }
+        std::shared_ptr<PolicyCache::Cache> get_policy_cache() { return policy_cache; } // nullptr if disabled
+        Settings const& get_settings() const { return settings; }
+        float get_baseline() const { return baseline; }
+        // Plays games with NetworkPlayers in all seats on all threads
+        std::vector<Sample> play_games(int const games);
+        // Minibatch updates over the samples, returns the mean loss of the last epoch
+        double train_on_samples(std::vector<Sample> const& samples);
+        // One update on already encoded decisions (e.g. recorded games), returns the mean loss
+        double train_on_batch(float const* states, uint8_t const* actions, float const* returns, Cards::CardMask const* legal_cards, size_t const rows);
+        EpisodeStats train_episode();
+    private:
+        Settings settings;
+        std::shared_ptr<Network> network;
+        std::shared_ptr<PolicyCache::Cache> policy_cache;
+        std::mt19937 engine;
+        int num_threads;
+        float baseline = 0.;
+        long steps = 0;
+        std::vector<float> first_moments;
+        std::vector<float> second_moments;
+        std::vector<std::vector<float>> thread_grads;
+        std::vector<float> advantages;
+        void apply_gradients(std::vector<float> const& grads);
+};
+
+} // namespace PolicyGradient
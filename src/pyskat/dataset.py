@@ -0,0 +1,108 @@
+import queue
+import threading
+import numpy as np
+import pyskat_cpp
+
+
+class OfflineDataset(object):
+    """Streams training batches from a file of recorded rounds (see Game.set_recorder).
+
+    The file is memory mapped, so it may be much larger than RAM. Player states are rebuilt
+    by replaying the recorded card plays through the rules engine on background threads.
+    """
+    def __init__(self, path, batch_size=4096, rounds_per_block=256, num_threads=4, prefetch=16, seed=None):
+        self.file = pyskat_cpp.RecordFile(path)
+        self.batch_size = batch_size
+        self.rounds_per_block = rounds_per_block
+        self.num_threads = num_threads
+        self.prefetch = prefetch
+        self.rng = np.random.default_rng(seed)
+
+    def __len__(self):
+        return len(self.file)
+
+    # Puts item into q unless stop is set first, returns whether it was put
+    @staticmethod
+    def _put(q, item, stop):
+        while not stop.is_set():
+            try:
+                q.put(item, timeout=0.1)
+                return True
+            except queue.Full:
+                pass
+        return False
+
+    # Takes an item from q, None once stop is set
+    @staticmethod
+    def _get(q, stop):
+        while not stop.is_set():
+            try:
+                return q.get(timeout=0.1)
+            except queue.Empty:
+                pass
+        return None
+
+    # Decodes blocks of round indices taken from tasks and puts shuffled decisions into results.
+    # A failed decode is put into results instead of the sentinel, so the consumer raises it.
+    def _worker(self, tasks, results, seed, stop):
+        rng = np.random.default_rng(seed)
+        try:
+            while True:
+                indices = self._get(tasks, stop)
+                if indices is None:
+                    break
+                # Decoding releases the GIL, so workers run in parallel
+                block = self.file.decode(indices)
+                order = rng.permutation(len(block[0]))
+                if not self._put(results, tuple(a[order] for a in block), stop):
+                    return
+        except Exception as e:
+            self._put(results, e, stop)
+            return
+        self._put(results, None, stop)
+
+    # Puts blocks of round indices into tasks, only one epoch's permutation is held at a time
+    def _producer(self, tasks, epochs, seed, stop):
+        rng = np.random.default_rng(seed)
+        for _ in range(epochs):
+            order = rng.permutation(len(self.file))
+            for start in range(0, len(order), self.rounds_per_block):
+                if not self._put(tasks, order[start:start+self.rounds_per_block].tolist(), stop):
+                    return
+        for _ in range(self.num_threads):
+            self._put(tasks, None, stop)
+
+    def _blocks(self, epochs):
+        # Bounded, so the producer stays a few blocks ahead of the workers
+        tasks = queue.Queue(maxsize=self.prefetch + self.num_threads)
+        results = queue.Queue(maxsize=self.prefetch)
+        # Set when the consumer stops iterating or a worker failed, so no thread stays blocked on a full queue
+        stop = threading.Event()
+        producer = threading.Thread(target=self._producer, args=(tasks, epochs, self.rng.integers(2**32), stop), daemon=True)
+        workers = [threading.Thread(target=self._worker, args=(tasks, results, self.rng.integers(2**32), stop), daemon=True) for _ in range(self.num_threads)]
+        producer.start()
+        for w in workers:
+            w.start()
+        try:
+            finished = 0
+            while finished < self.num_threads:
+                block = results.get()
+                if block is None:
+                    finished += 1
+                elif isinstance(block, Exception):
+                    raise block
+                else:
+                    yield block
+        finally:
+            stop.set()
+
+    # Yields (states, actions, returns, legal_masks) batches, the last batch may be smaller
+    def batches(self, epochs=1):
+        pending = None
+        for block in self._blocks(epochs):
+            pending = block if pending is None else tuple(np.concatenate([p, b]) for p, b in zip(pending, block))
+            while len(pending[0]) >= self.batch_size:
+                yield tuple(a[:self.batch_size] for a in pending)
+                pending = tuple(a[self.batch_size:] for a in pending)
+        if pending is not None and len(pending[0]) > 0:
+            yield pending
@@ -0,0 +1,118 @@
+import pyskat
+import numpy as np
+
+from .player import PolicyPlayer
+
+
+# Model weights travel as one buffer of float32 values, receivers restore the shapes of their own model
+def pack_weights(weights):
+    return np.concatenate([np.asarray(w, dtype=np.float32).ravel() for w in weights]).tobytes()
+
+
+def unpack_weights(data, like):
+    flat = np.frombuffer(data, dtype=np.float32)
+    weights = list()
+    offset = 0
+    for w in like:
+        weights.append(flat[offset:offset+w.size].reshape(w.shape))
+        offset += w.size
+    return weights
+
+
+# A message is the final reward of a game (float32) followed by serialized transitions of one player
+def encode_message(reward, transitions):
+    return np.float32(reward).tobytes() + pyskat.serialize_transitions(transitions)
+
+
+def decode_message(message):
+    reward = np.frombuffer(message[:4], dtype=np.float32)[0]
+    states, actions, _, legal_masks = pyskat.decode_transitions(message[4:])
+    return states, actions, np.full(len(states), reward, dtype=np.float32), legal_masks
+
+
+class SelfPlayActor(object):
+    # Plays games with the model in all seats and streams the transitions to the learner of the named pipeline
+    def __init__(self, name, model, max_rounds=1000, policy_cache=None):
+        self.model = model
+        self.channel = pyskat.PipelineActor(name)
+        self.players = [PolicyPlayer(model, None) for _ in range(3)]
+        self.weights_version = 0
+        if policy_cache is not None:
+            # The seats share the model, so they share cached decisions as well
+            for player in self.players:
+                player.set_policy_cache(policy_cache)
+        self.game = pyskat.Game(*self.players, max_rounds=max_rounds, expect_legal_actions=True)
+        self.game.set_log_level_to_warning()
+        self.chunk_size = None
+
+    def update_weights(self):
+        data = self.channel.poll_weights()
+        if data is not None:
+            self.model.set_weights(unpack_weights(data, self.model.get_weights()))
+            self.weights_version += 1
+            for player in self.players:
+                player.set_policy_version(self.weights_version)
+
+    def push_transitions(self, transitions):
+        if self.chunk_size is None:
+            transition_bytes = len(pyskat.serialize_transitions(transitions[:1]))
+            self.chunk_size = (self.channel.get_max_message_size() - 4) // transition_bytes
+        reward = transitions[-1].reward # Like PlayerTrainer, every decision is rewarded with the game outcome
+        for start in range(0, len(transitions), self.chunk_size):
+            # Blocks while the learner is behind
+            if not self.channel.push(encode_message(reward, transitions[start:start+self.chunk_size])):
+                return False
+        return True
+
+    # Returns once the given number of games is played or the learner closed the pipeline
+    def run(self, games=None):
+        played = 0
+        while (games is None or played < games) and not self.channel.is_closed():
+            self.update_weights()
+            self.game.run_new_game()
+            for player in self.players:
+                transitions = player.get_transitions()
+                player.clear_transitions()
+                if transitions and not self.push_transitions(transitions):
+                    return
+            played += 1
+
+
+class PipelineTrainer(object):
+    # Trains a PlayerTrainer's model on transitions of SelfPlayActor processes and publishes the updated weights to them
+    def __init__(self, name, trainer, config=None):
+        self.trainer = trainer
+        self.channel = pyskat.PipelineLearner(name, config if config is not None else pyskat.PipelineConfig())
+        self.channel.publish_weights(pack_weights(self.trainer.model.get_weights()))
+
+    def collect(self, batch_size, timeout=1.):
+        batch = list()
+        rows = 0
+        while rows < batch_size:
+            messages = self.channel.pop(256, timeout)
+            if not messages:
+                break
+            for message in messages:
+                batch.append(decode_message(message))
+                rows += len(batch[-1][0])
+        if not batch:
+            return None
+        return [np.concatenate(parts) for parts in zip(*batch)]
+
+    def train(self, steps, batch_size=30000, report_every=10):
+        for step in range(steps):
+            batch = self.collect(batch_size)
+            if batch is None:
+                continue
+            states, actions, rewards, _ = batch
+            self.trainer.training_model.train_on_batch([states, rewards], actions)
+            self.channel.publish_weights(pack_weights(self.trainer.model.get_weights()))
+            if report_every and step % report_every == 0:
+                print("Step {}: {} transitions, average reward {}".format(step, len(states), np.mean(rewards)))
+                for s in self.channel.get_stats():
+                    print("  actor {} (pid {}): {:.0f} messages/s, {} waits on full ring, {} malformed".format(s.actor, s.pid, s.messages_per_second, s.full_waits, s.malformed))
+            if self.trainer.save_to is not None:
+                self.trainer.model.save(self.trainer.save_to)
+
+    def close(self):
+        self.channel.close()
@@ -13,15 +13,16 @@ class PolicyPlayer(pyskat_cpp.Player):
     # Converts PlayerState into representation to be used as model input
     def convert_state_for_model(self, state):
         assert(isinstance(state, pyskat_cpp.PlayerState))
-        trick_card_1 = np.array(state.trick[0].to_one_hot())*1. if len(state.trick) > 0 else np.zeros(32)
-        trick_card_2 = np.array(state.trick[1].to_one_hot())*1. if len(state.trick) > 1 else np.zeros(32)
+        trick = state.trick
+        trick_card_1 = np.array(trick[0].to_one_hot())*1. if len(trick) > 0 else np.zeros(32)
+        trick_card_2 = np.array(trick[1].to_one_hot())*1. if len(trick) > 1 else np.zeros(32)
         # Sequentially create list with multi-hot card representation
         input_repr = list()
-        input_repr.extend(pyskat_cpp.get_multi_hot(state.hole_cards)*np.ones(32))
+        input_repr.extend(pyskat_cpp.get_multi_hot(state.hole_cards_mask)*np.ones(32))
         input_repr.extend(trick_card_1)
         input_repr.extend(trick_card_2)
-        input_repr.extend(pyskat_cpp.get_multi_hot(state.won_friendly)*np.ones(32))
-        input_repr.extend(pyskat_cpp.get_multi_hot(state.won_hostile)*np.ones(32))
+        input_repr.extend(pyskat_cpp.get_multi_hot(state.won_friendly_mask)*np.ones(32))
+        input_repr.extend(pyskat_cpp.get_multi_hot(state.won_hostile_mask)*np.ones(32))
         input_repr.append(state.is_declarer * 1.)
         assert(PolicyPlayer.input_size == len(input_repr))
         return np.array(input_repr)
@@ -43,13 +44,25 @@ class PolicyPlayer(pyskat_cpp.Player):
         self.clear_transitions()
         return states, actions, rewards
 
+    # Probabilities of the legal cards in the last state, asked by Game on policy cache misses
+    def query_distribution(self):
+        last_state = self.get_last_state()
+        state = self.convert_state_for_model(last_state)
+        probs = self.model.predict(np.expand_dims(state, axis=0))[0]
+        # Only sample from legal cards
+        legal = np.array(last_state.legal_cards, dtype=probs.dtype)
+        probs = probs * legal
+        if probs.sum() > 0:
+            probs = probs / probs.sum()
+        else:
+            probs = legal / legal.sum()
+        return probs
+
     # Is called by Game to get player's action, overrides pure virtual
     def query_policy(self):
-        # Get probabilities from neural network
-        state = self.convert_state_for_model(self.get_last_state())
-        probs = self.model.predict(np.expand_dims(state, axis=0))[0]
+        probs = self.query_distribution()
         # Get one-hot representation of random card
         card_id = np.random.choice(32, p=probs)
         card = pyskat_cpp.Card(card_id)
         self.counter += 1
-        return card
\ No newline at end of file
+        return card
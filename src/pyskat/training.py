@@ -4,13 +4,14 @@ import tensorflow as tf
 from tensorflow.keras import layers, models
 
 from .player import PolicyPlayer
+from .dataset import OfflineDataset
 
 
 class PlayerTrainer(object):
     # total input size = hole cards + trick card 1 + trick card 2 + friendly won + hostile won + is declarer
     input_size = 32 + 32 + 32 + 32 + 32 + 1
     default_hparams = {"hidden_size_1": input_size, "hidden_size_2": input_size, "hidden_size_3": 100, "hidden_size_4": 100}
-    def __init__(self, hparams=default_hparams, save_to=None, start_model=None):
+    def __init__(self, hparams=default_hparams, save_to=None, start_model=None, record_to=None):
         self.hparams = hparams
         self.save_to = save_to
         self.states = list()
@@ -41,8 +42,13 @@ class PlayerTrainer(object):
         self.two = PolicyPlayer(self.model, self.training_model)
         self.three = PolicyPlayer(self.model, self.training_model)
         self.players = [self.one, self.two, self.three]
-        self.game = pyskat.Game(self.one, self.two, self.three, retry_on_illegal_action=True)
+        self.game = pyskat.Game(self.one, self.two, self.three, expect_legal_actions=True)
         self.game.set_log_level_to_warning()
+        # Optionally record all played rounds for offline training
+        self.recorder = None
+        if record_to is not None:
+            self.recorder = pyskat.RecordWriter(record_to)
+            self.game.set_recorder(self.recorder)
 
     # Creates loss function that takes reward into account
     def create_loss_function(self, reward_input):
@@ -76,6 +82,16 @@ class PlayerTrainer(object):
         self.training_model.train_on_batch([np_states, np_rewards], np_actions)
         print("Got average reward: {}".format(np.mean(self.rewards)))
 
+    # Trains on rounds previously recorded with record_to, rewards are the round outcomes
+    def train_on_dataset(self, path, epochs=1, batch_size=4096):
+        dataset = OfflineDataset(path, batch_size=batch_size)
+        for ep in range(epochs):
+            for states, actions, returns, _ in dataset.batches():
+                self.training_model.train_on_batch([states, returns], actions)
+            print("Finished offline epoch {}".format(ep))
+            if self.save_to is not None:
+                self.model.save(self.save_to)
+
     def train(self, eps=10000, games_per_ep=1000):
         for ep in range(eps):
             for _ in range(games_per_ep):
@@ -83,5 +99,23 @@ class PlayerTrainer(object):
                 self.save_transitions()
             print("In episode {}".format(ep))
             self.train_on_transitions()
+            if self.recorder is not None:
+                self.recorder.flush()
             if self.save_to is not None:
-                self.model.save(self.save_to)
\ No newline at end of file
+                self.model.save(self.save_to)
+
+    # Self-play and updates in C++ (pyskat.NativeTrainer) with the same network and loss, the Keras model only holds the result
+    def train_native(self, eps=10000, settings=None, report_every=10):
+        trainer = pyskat.NativeTrainer(settings if settings is not None else pyskat.PolicyGradientSettings())
+        network = trainer.get_network()
+        network.set_weights(self.model.get_weights())
+        for ep in range(eps):
+            stats = trainer.train_episode()
+            if ep % report_every == 0:
+                print("In episode {}: {} decisions, loss {}, baseline {}".format(ep, stats.decisions, stats.loss, stats.baseline))
+                self.model.set_weights(network.get_weights())
+                if self.save_to is not None:
+                    self.model.save(self.save_to)
+        self.model.set_weights(network.get_weights())
+        if self.save_to is not None:
+            self.model.save(self.save_to)
@@ -2,6 +2,8 @@
 #include <pybind11/operators.h>
 #include <pybind11/stl.h>
 #include <pybind11/chrono.h>
+#include <pybind11/numpy.h>
+#include <pybind11/functional.h>
 #include <Python.h>
 #include <boost/log/trivial.hpp>
 #include <boost/log/core.hpp>
@@ -9,12 +11,95 @@
 #include <sstream>
 
 #include "halfskat.hpp"
+#include "bots.hpp"
 #include "cards.hpp"
+#include "dataset.hpp"
+#include "differential.hpp"
+#include "handstrength.hpp"
+#include "leadbook.hpp"
+#include "pipeline.hpp"
+#include "policycache.hpp"
+#include "policygradient.hpp"
+#include "scenario.hpp"
+#include "serialization.hpp"
+#include "stats.hpp"
+#include "tournament.hpp"
 #include "tests.hpp"
 
 namespace py = pybind11;
 namespace logging = boost::log;
 
+namespace {
+
+// Wraps Python player factories for the tournament runners, which call them from worker threads
+std::vector<Tournament::Entrant> wrap_roster(std::vector<std::pair<std::string, py::object>> const& roster) {
+    std::vector<Tournament::Entrant> entrants;
+    for (auto const& e : roster) {
+        py::object factory = e.second;
+        entrants.emplace_back(e.first, [factory]() {
+            py::gil_scoped_acquire gil;
+            py::object obj = factory();
+            auto player = obj.cast<std::shared_ptr<HalfSkat::Player>>();
+            // Keep the Python object alive as long as the game uses the player, so Python overrides stay valid
+            auto keep_alive = std::make_shared<py::object>(obj);
+            return std::shared_ptr<HalfSkat::Player>(player.get(), [player, keep_alive](HalfSkat::Player*) mutable {
+                py::gil_scoped_acquire gil;
+                keep_alive.reset();
+                player.reset();
+            });
+        });
+    }
+    return entrants;
+}
+
+// Copy of a table of snapshot counters as numpy array
+py::array_t<uint64_t> get_counter_array(Stats::Snapshot const& s, size_t const offset, std::vector<size_t> const& shape) {
+    py::array_t<uint64_t> array(shape);
+    std::copy(s.counts.begin() + offset, s.counts.begin() + offset + array.size(), array.mutable_data());
+    return array;
+}
+
+// Games of all variants share their bindings
+template<typename Variant>
+py::class_<HalfSkat::BasicGame<Variant>> bind_game(py::module& m, char const* name) {
+    using GameClass = HalfSkat::BasicGame<Variant>;
+    py::class_<GameClass> game(m, name);
+    game
+        .def(py::init<int const, bool const, bool const>(), py::arg("max_rounds") = 1000, py::arg("retry_on_illegal_action") = false, py::arg("expect_legal_actions") = false)
+        .def(py::init<std::shared_ptr<HalfSkat::Player>, std::shared_ptr<HalfSkat::Player>, std::shared_ptr<HalfSkat::Player>, int const, bool const, bool const>(), py::arg("first_player"), py::arg("second_player"), py::arg("third_player"), py::arg("max_rounds") = 1000, py::arg("retry_on_illegal_action") = false, py::arg("expect_legal_actions") = false)
+        .def(py::init<std::shared_ptr<HalfSkat::RandomPlayer>, std::shared_ptr<HalfSkat::RandomPlayer>, std::shared_ptr<HalfSkat::RandomPlayer>, int const, bool const, bool const>(), py::arg("first_player"), py::arg("second_player"), py::arg("third_player"), py::arg("max_rounds") = 1000, py::arg("retry_on_illegal_action") = false, py::arg("expect_legal_actions") = false)
+        .def(py::init<std::shared_ptr<HalfSkat::Player>, std::shared_ptr<HalfSkat::Player>, std::shared_ptr<HalfSkat::HumanPlayer>, int const, bool const, bool const>(), py::arg("first_player"), py::arg("second_player"), py::arg("third_player"), py::arg("max_rounds") = 1000, py::arg("retry_on_illegal_action") = false, py::arg("expect_legal_actions") = false)
+        // Python players reacquire the GIL when queried, native players run without it
+        .def("step_by_trick", &GameClass::step_by_trick, py::call_guard<py::gil_scoped_release>())
+        .def("step_by_round", &GameClass::step_by_round, py::call_guard<py::gil_scoped_release>())
+        .def("step_by_game", &GameClass::step_by_game, py::call_guard<py::gil_scoped_release>())
+        .def("run_new_game", &GameClass::run_new_game, py::call_guard<py::gil_scoped_release>())
+        .def("get_trick", &GameClass::get_trick)
+        .def("get_points", &GameClass::get_points)
+        .def("get_round", &GameClass::get_round)
+        .def("get_max_rounds", &GameClass::get_max_rounds)
+        .def("set_log_level_to_warning", &GameClass::set_log_level_to_warning)
+        .def("set_log_level_to_info", &GameClass::set_log_level_to_info)
+        .def("set_recorder", &GameClass::set_recorder)
+        .def("set_deal_source", &GameClass::set_deal_source)
+        .def("set_stats", &GameClass::set_stats)
+        .def("checkpoint", [](GameClass const& g) { return py::bytes(g.checkpoint()); })
+        .def("restore", [](GameClass& g, py::bytes const& data) { g.restore(data); })
+        .def("get_contract", &GameClass::get_contract)
+        .def("get_bid", &GameClass::get_bid)
+        // Unpickled games are played by random players, use restore() to continue with other players
+        .def(py::pickle(
+            [](GameClass const& g) { return py::bytes(g.checkpoint()); },
+            [](py::bytes const& data) {
+                GameClass g;
+                g.restore(data);
+                return g;
+            }));
+    return game;
+}
+
+} // namespace
+
 PYBIND11_MODULE(pyskat_cpp, m) {
     logging::core::get()->set_filter
     (
@@ -52,59 +137,576 @@ PYBIND11_MODULE(pyskat_cpp, m) {
             return ss.str(); })
         .def_readwrite("rank", &Cards::Card::rank)
         .def_readwrite("played_by", &Cards::Card::played_by)
-        .def("to_one_hot", &Cards::Card::to_one_hot);
+        .def("to_one_hot", &Cards::Card::to_one_hot)
+        .def(py::pickle(
+            [](Cards::Card const& c) { return py::bytes(Serialization::serialize_card(c)); },
+            [](py::bytes const& data) { return Serialization::deserialize_card(data); }));
     m.def("get_full_shuffled_deck", &Cards::get_full_shuffled_deck);
-    m.def("get_card_points", &Cards::get_card_points);
+    m.def("get_card_points", (int (*)(std::vector<Cards::Card> const&)) &Cards::get_card_points);
+    m.def("get_card_points", (int (*)(Cards::CardMask const)) &Cards::get_card_points);
     m.def("get_suit_base_value", (int (*)(Cards::Card const&)) &Cards::get_suit_base_value);
     m.def("get_suit_base_value", (int (*)(Cards::Color const&)) &Cards::get_suit_base_value);
-    m.def("get_multi_hot", &Cards::get_multi_hot);
+    m.def("get_multi_hot", (std::array<bool, 32> (*)(std::vector<Cards::Card> const&)) &Cards::get_multi_hot);
+    m.def("get_multi_hot", (std::array<bool, 32> (*)(Cards::CardMask const)) &Cards::get_multi_hot);
+    m.def("get_card_mask", &Cards::get_card_mask);
+    m.def("get_cards_from_mask", &Cards::get_cards_from_mask);
 
     // HalfSkat bindings
+    py::enum_<HalfSkat::GameType>(m, "GameType")
+        .value("clubs", HalfSkat::GameType::clubs_game)
+        .value("spades", HalfSkat::GameType::spades_game)
+        .value("hearts", HalfSkat::GameType::hearts_game)
+        .value("diamonds", HalfSkat::GameType::diamonds_game)
+        .value("grand", HalfSkat::GameType::grand_game)
+        .value("null", HalfSkat::GameType::null_game);
+    py::class_<HalfSkat::Contract>(m, "Contract")
+        .def(py::init<>())
+        .def(py::init<HalfSkat::GameType const, bool const>(), py::arg("type"), py::arg("hand") = false)
+        .def(py::self == py::self)
+        .def_readwrite("type", &HalfSkat::Contract::type)
+        .def_readwrite("hand", &HalfSkat::Contract::hand);
+    m.def("get_bid_values", &HalfSkat::get_bid_values);
     py::class_<HalfSkat::Player, std::shared_ptr<HalfSkat::Player>, HalfSkat::PyPlayer>(m, "Player")
         .def(py::init<>())
         .def("query_policy", &HalfSkat::Player::query_policy)
+        .def("query_distribution", &HalfSkat::Player::query_distribution)
+        .def("set_policy_cache", &HalfSkat::Player::set_policy_cache, py::arg("cache"), py::arg("policy_id") = 0)
+        .def("get_policy_version", &HalfSkat::Player::get_policy_version)
+        .def("set_policy_version", &HalfSkat::Player::set_policy_version)
+        .def("query_bid_limit", &HalfSkat::Player::query_bid_limit)
+        .def("query_pickup_skat", &HalfSkat::Player::query_pickup_skat)
+        .def("query_discard", &HalfSkat::Player::query_discard)
+        .def("query_contract", &HalfSkat::Player::query_contract)
         .def("get_cards", &HalfSkat::Player::get_cards)
         .def("get_last_state", &HalfSkat::Player::get_last_state)
         .def("get_last_action", &HalfSkat::Player::get_last_action)
         .def("get_transitions", &HalfSkat::Player::get_transitions)
+        .def("get_serialized_transitions", [](HalfSkat::Player& p) { return py::bytes(Serialization::serialize_transitions(p.get_transitions())); })
         .def("clear_transitions", &HalfSkat::Player::clear_transitions);
-    py::class_<HalfSkat::RandomPlayer, std::shared_ptr<HalfSkat::RandomPlayer>>(m, "RandomPlayer")
+    py::class_<HalfSkat::RandomPlayer, HalfSkat::Player, std::shared_ptr<HalfSkat::RandomPlayer>>(m, "RandomPlayer")
         .def(py::init<>())
         .def("query_policy", &HalfSkat::Player::query_policy)
         .def("get_cards", &HalfSkat::Player::get_cards)
         .def("get_last_state", &HalfSkat::Player::get_last_state)
         .def("get_last_action", &HalfSkat::Player::get_last_action)
         .def("get_transitions", &HalfSkat::Player::get_transitions)
+        .def("get_serialized_transitions", [](HalfSkat::Player& p) { return py::bytes(Serialization::serialize_transitions(p.get_transitions())); })
         .def("clear_transitions", &HalfSkat::Player::clear_transitions);
-    py::class_<HalfSkat::HumanPlayer, std::shared_ptr<HalfSkat::HumanPlayer>>(m, "HumanPlayer")
+    py::class_<HalfSkat::HumanPlayer, HalfSkat::Player, std::shared_ptr<HalfSkat::HumanPlayer>>(m, "HumanPlayer")
+        .def(py::init<>());
+    py::class_<HalfSkat::HighestCardPlayer, HalfSkat::Player, std::shared_ptr<HalfSkat::HighestCardPlayer>>(m, "HighestCardPlayer")
         .def(py::init<>());
-    py::class_<HalfSkat::Game>(m, "Game")
-        .def(py::init<int const, bool const>(), py::arg("max_rounds") = 1000, py::arg("retry_on_illegal_action") = false)
-        .def(py::init<std::shared_ptr<HalfSkat::Player>, std::shared_ptr<HalfSkat::Player>, std::shared_ptr<HalfSkat::Player>, int const, bool const>(), py::arg("first_player"), py::arg("second_player"), py::arg("third_player"), py::arg("max_rounds") = 1000, py::arg("retry_on_illegal_action") = false)
-        .def(py::init<std::shared_ptr<HalfSkat::RandomPlayer>, std::shared_ptr<HalfSkat::RandomPlayer>, std::shared_ptr<HalfSkat::RandomPlayer>, int const, bool const>(), py::arg("first_player"), py::arg("second_player"), py::arg("third_player"), py::arg("max_rounds") = 1000, py::arg("retry_on_illegal_action") = false)
-        .def(py::init<std::shared_ptr<HalfSkat::Player>, std::shared_ptr<HalfSkat::Player>, std::shared_ptr<HalfSkat::HumanPlayer>, int const, bool const>(), py::arg("first_player"), py::arg("second_player"), py::arg("third_player"), py::arg("max_rounds") = 1000, py::arg("retry_on_illegal_action") = false)
-        .def("step_by_trick", &HalfSkat::Game::step_by_trick)
-        .def("step_by_round", &HalfSkat::Game::step_by_round)
-        .def("step_by_game", &HalfSkat::Game::step_by_game)
-        .def("run_new_game", &HalfSkat::Game::run_new_game)
-        .def("get_trick", &HalfSkat::Game::get_trick)
-        .def("get_points", &HalfSkat::Game::get_points)
-        .def("get_round", &HalfSkat::Game::get_round)
-        .def("get_max_rounds", &HalfSkat::Game::get_max_rounds)
-        .def("set_log_level_to_warning", &HalfSkat::Game::set_log_level_to_warning)
-        .def("set_log_level_to_info", &HalfSkat::Game::set_log_level_to_info)
-        .def_readonly("trump", &HalfSkat::Game::trump);
+    py::class_<HalfSkat::SmearPlayer, HalfSkat::Player, std::shared_ptr<HalfSkat::SmearPlayer>>(m, "SmearPlayer")
+        .def(py::init<>());
+    py::class_<HalfSkat::TrumpPullingPlayer, HalfSkat::Player, std::shared_ptr<HalfSkat::TrumpPullingPlayer>>(m, "TrumpPullingPlayer")
+        .def(py::init<>());
+    py::class_<HalfSkat::HeuristicWeights>(m, "HeuristicWeights")
+        .def(py::init<>())
+        .def_readwrite("wins_trick", &HalfSkat::HeuristicWeights::wins_trick)
+        .def_readwrite("card_points", &HalfSkat::HeuristicWeights::card_points)
+        .def_readwrite("trick_points_won", &HalfSkat::HeuristicWeights::trick_points_won)
+        .def_readwrite("smear_points", &HalfSkat::HeuristicWeights::smear_points)
+        .def_readwrite("strength", &HalfSkat::HeuristicWeights::strength)
+        .def_readwrite("trump", &HalfSkat::HeuristicWeights::trump)
+        .def_readwrite("lead_trump_as_declarer", &HalfSkat::HeuristicWeights::lead_trump_as_declarer);
+    py::class_<HalfSkat::WeightedHeuristicPlayer, HalfSkat::Player, std::shared_ptr<HalfSkat::WeightedHeuristicPlayer>>(m, "WeightedHeuristicPlayer")
+        .def(py::init<HalfSkat::HeuristicWeights const&>(), py::arg("weights") = HalfSkat::HeuristicWeights())
+        .def_readwrite("weights", &HalfSkat::WeightedHeuristicPlayer::weights);
+    bind_game<HalfSkat::HalfSkatVariant>(m, "Game")
+        .def_property_readonly("trump", [](HalfSkat::Game const&) { return Cards::Color::Clubs; });
+    bind_game<HalfSkat::SkatVariant>(m, "SkatGame");
     py::class_<HalfSkat::Transition>(m, "Transition")
         .def_readonly("before", &HalfSkat::Transition::before)
         .def_readonly("after", &HalfSkat::Transition::after)
         .def_readonly("reward", &HalfSkat::Transition::reward)
-        .def_readonly("action", &HalfSkat::Transition::action);
+        .def_readonly("action", &HalfSkat::Transition::action)
+        .def(py::pickle(
+            [](HalfSkat::Transition const& t) { return py::bytes(Serialization::serialize_transitions({t})); },
+            [](py::bytes const& data) { return Serialization::deserialize_transitions(data).at(0); }));
     py::class_<HalfSkat::PlayerState>(m, "PlayerState")
-        .def_readonly("hole_cards", &HalfSkat::PlayerState::hole_cards)
-        .def_readonly("trick", &HalfSkat::PlayerState::trick)
-        .def_readonly("trick_played_by_friend", &HalfSkat::PlayerState::trick_played_by_friend)
-        .def_readonly("won_friendly", &HalfSkat::PlayerState::won_friendly)
-        .def_readonly("won_hostile", &HalfSkat::PlayerState::won_hostile)
-        .def_readonly("is_declarer", &HalfSkat::PlayerState::is_declarer);
+        // Card collections are stored as masks and converted to lists of cards on access
+        .def_property_readonly("hole_cards", [](HalfSkat::PlayerState const& s) { return Cards::get_cards_from_mask(s.hole_cards); })
+        .def_property_readonly("trick", [](HalfSkat::PlayerState const& s) { return s.trick.to_vector(); })
+        .def_property_readonly("trick_played_by_friend", [](HalfSkat::PlayerState const& s) {
+            return std::vector<bool>(s.trick_played_by_friend.begin(), s.trick_played_by_friend.begin() + s.trick.size()); })
+        .def_property_readonly("won_friendly", [](HalfSkat::PlayerState const& s) { return Cards::get_cards_from_mask(s.won_friendly); })
+        .def_property_readonly("won_hostile", [](HalfSkat::PlayerState const& s) { return Cards::get_cards_from_mask(s.won_hostile); })
+        .def_readonly("is_declarer", &HalfSkat::PlayerState::is_declarer)
+        .def_property_readonly("legal_cards", [](HalfSkat::PlayerState const& s) { return Cards::get_multi_hot(s.legal_cards); })
+        .def_readonly("hole_cards_mask", &HalfSkat::PlayerState::hole_cards)
+        .def_readonly("won_friendly_mask", &HalfSkat::PlayerState::won_friendly)
+        .def_readonly("won_hostile_mask", &HalfSkat::PlayerState::won_hostile)
+        .def_readonly("legal_cards_mask", &HalfSkat::PlayerState::legal_cards)
+        .def_readonly("contract", &HalfSkat::PlayerState::contract)
+        .def(py::pickle(
+            [](HalfSkat::PlayerState const& s) { return py::bytes(Serialization::serialize_state(s)); },
+            [](py::bytes const& data) { return Serialization::deserialize_state(data); }));
+    m.def("serialize_transitions", [](std::vector<HalfSkat::Transition> const& transitions) { return py::bytes(Serialization::serialize_transitions(transitions)); });
+    m.def("deserialize_transitions", [](py::bytes const& data) { return Serialization::deserialize_transitions(data); });
+
+    // Dataset bindings
+    py::class_<Dataset::RecordWriter, std::shared_ptr<Dataset::RecordWriter>>(m, "RecordWriter")
+        .def(py::init<std::string const&>())
+        .def("flush", &Dataset::RecordWriter::flush)
+        .def("get_written", &Dataset::RecordWriter::get_written);
+    py::class_<Dataset::RecordFile>(m, "RecordFile")
+        .def(py::init<std::string const&>())
+        .def("__len__", &Dataset::RecordFile::size)
+        // Returns (states, actions, returns, legal_masks) for all decisions of the given rounds
+        .def("decode", [](Dataset::RecordFile const& file, std::vector<size_t> const& indices) {
+            size_t const rows = indices.size() * Dataset::decisions_per_round;
+            py::array_t<float> states({rows, static_cast<size_t>(Dataset::state_size)});
+            py::array_t<float> actions({rows, static_cast<size_t>(32)});
+            py::array_t<float> returns(rows);
+            py::array_t<float> legal_masks({rows, static_cast<size_t>(32)});
+            float* states_ptr = states.mutable_data();
+            float* actions_ptr = actions.mutable_data();
+            float* returns_ptr = returns.mutable_data();
+            float* legal_masks_ptr = legal_masks.mutable_data();
+            {
+                py::gil_scoped_release release;
+                Dataset::decode_rounds(file, indices, states_ptr, actions_ptr, returns_ptr, legal_masks_ptr);
+            }
+            return py::make_tuple(states, actions, returns, legal_masks);
+        });
+    m.attr("state_size") = Dataset::state_size;
+    m.attr("decisions_per_round") = Dataset::decisions_per_round;
+
+    // Hand strength bindings
+    m.def("canonicalize_hand", &HandStrength::canonicalize);
+    py::class_<HandStrength::Entry>(m, "HandStrength")
+        .def_readonly("hand", &HandStrength::Entry::hand)
+        .def_readonly("win_rate", &HandStrength::Entry::win_rate)
+        .def_readonly("expected_value", &HandStrength::Entry::expected_value)
+        .def_readonly("expected_score", &HandStrength::Entry::expected_score);
+    py::class_<HandStrength::Settings>(m, "HandTableSettings")
+        .def(py::init<>())
+        .def_readwrite("hands", &HandStrength::Settings::hands)
+        .def_readwrite("sample_hands", &HandStrength::Settings::sample_hands)
+        .def_readwrite("deals_per_hand", &HandStrength::Settings::deals_per_hand)
+        .def_readwrite("threads", &HandStrength::Settings::threads)
+        .def_readwrite("seed", &HandStrength::Settings::seed);
+    // Player is an optional factory like the tournament roster takes, the default plays TrumpPullingPlayer in all seats
+    m.def("build_hand_table", [](std::string const& path, HandStrength::Settings settings, py::object const& player) {
+        std::vector<Tournament::Entrant> wrapped;
+        if (not player.is_none()) {
+            wrapped = wrap_roster({{"player", player}});
+            settings.player = wrapped[0].factory;
+        }
+        py::gil_scoped_release release;
+        HandStrength::build_table(path, settings);
+    }, py::arg("path"), py::arg("settings") = HandStrength::Settings(), py::arg("player") = py::none());
+    py::class_<HandStrength::Table>(m, "HandTable")
+        .def(py::init<std::string const&>())
+        .def("__len__", &HandStrength::Table::size)
+        .def("get_deals_per_hand", &HandStrength::Table::get_deals_per_hand)
+        // Returns a copy of the entry or None if the hand wasn't evaluated
+        .def("find", [](HandStrength::Table const& t, Cards::CardMask const hand) -> py::object {
+            HandStrength::Entry const* e = t.find(hand);
+            return e ? py::cast(*e) : py::none();
+        })
+        .def("find", [](HandStrength::Table const& t, std::vector<Cards::Card> const& hand) -> py::object {
+            HandStrength::Entry const* e = t.find(Cards::get_card_mask(hand));
+            return e ? py::cast(*e) : py::none();
+        });
+
+    // Scenario bindings
+    py::enum_<Scenario::Role>(m, "Role")
+        .value("declarer", Scenario::Role::declarer)
+        .value("first_defender", Scenario::Role::first_defender)
+        .value("second_defender", Scenario::Role::second_defender)
+        .value("skat", Scenario::Role::skat);
+    py::class_<Scenario::Range>(m, "Range")
+        .def(py::init<>())
+        .def(py::init<int const, int const>(), py::arg("min"), py::arg("max"))
+        .def_readwrite("min", &Scenario::Range::min)
+        .def_readwrite("max", &Scenario::Range::max);
+    py::class_<Scenario::HandConstraints>(m, "HandConstraints")
+        .def(py::init<>())
+        .def_property("required", [](Scenario::HandConstraints const& c) { return Cards::get_cards_from_mask(c.required); },
+            [](Scenario::HandConstraints& c, std::vector<Cards::Card> const& cards) { c.required = Cards::get_card_mask(cards); })
+        .def_property("forbidden", [](Scenario::HandConstraints const& c) { return Cards::get_cards_from_mask(c.forbidden); },
+            [](Scenario::HandConstraints& c, std::vector<Cards::Card> const& cards) { c.forbidden = Cards::get_card_mask(cards); })
+        .def_readwrite("jacks", &Scenario::HandConstraints::jacks)
+        .def_readwrite("trumps", &Scenario::HandConstraints::trumps)
+        .def_readwrite("matadors", &Scenario::HandConstraints::matadors)
+        // Ranges are copied to Python, so single suits are changed through set_suit
+        .def_readwrite("suits", &Scenario::HandConstraints::suits)
+        .def("set_suit", [](Scenario::HandConstraints& c, Cards::Color const color, Scenario::Range const& range) { c.suits[color] = range; });
+    py::class_<Scenario::DealSource, std::shared_ptr<Scenario::DealSource>>(m, "DealSource");
+    py::class_<Scenario::Generator, Scenario::DealSource, std::shared_ptr<Scenario::Generator>>(m, "ScenarioGenerator")
+        // Constraints of the declarer, first defender, second defender and Skat
+        .def(py::init<Scenario::Constraints const&, unsigned const>(), py::arg("constraints"), py::arg("seed") = 0)
+        .def("get_count", &Scenario::Generator::get_count)
+        .def("get_probability", &Scenario::Generator::get_probability)
+        .def("sample", [](Scenario::Generator& g) {
+            Scenario::Hands const hands = g.sample();
+            std::vector<std::vector<Cards::Card>> cards;
+            for (auto const mask : hands) {
+                cards.push_back(Cards::get_cards_from_mask(mask));
+            }
+            return cards;
+        })
+        .def("get_deck", &Scenario::Generator::get_deck, py::arg("declarer") = 0)
+        // Card ids of many decks in deal_round order, one row per deck
+        .def("sample_decks", [](Scenario::Generator& g, size_t const count, int const declarer) {
+            py::array_t<uint8_t> decks({count, static_cast<size_t>(32)});
+            uint8_t* out = decks.mutable_data();
+            {
+                py::gil_scoped_release release;
+                for (size_t i=0; i<count; i++) {
+                    for (auto const& card : Scenario::get_deck(g.sample(), declarer)) {
+                        *out++ = Cards::get_card_id(card);
+                    }
+                }
+            }
+            return decks;
+        }, py::arg("count"), py::arg("declarer") = 0);
+
+    // Lead book bindings
+    py::class_<LeadBook::Settings>(m, "LeadBookSettings")
+        .def(py::init<>())
+        .def_readwrite("hands", &LeadBook::Settings::hands)
+        .def_readwrite("sample_hands", &LeadBook::Settings::sample_hands)
+        .def_readwrite("roles", &LeadBook::Settings::roles)
+        .def_readwrite("deals_per_hand", &LeadBook::Settings::deals_per_hand)
+        .def_readwrite("threads", &LeadBook::Settings::threads)
+        .def_readwrite("seed", &LeadBook::Settings::seed);
+    m.def("build_lead_book", &LeadBook::build_book, py::arg("path"), py::arg("settings") = LeadBook::Settings(), py::call_guard<py::gil_scoped_release>());
+    py::class_<LeadBook::Book, std::shared_ptr<LeadBook::Book>>(m, "LeadBook")
+        .def(py::init<std::string const&>())
+        .def("__len__", &LeadBook::Book::size)
+        .def("get_deals_per_hand", &LeadBook::Book::get_deals_per_hand)
+        // Best lead or None if the hand wasn't evaluated for role
+        .def("get_best_lead", [](LeadBook::Book const& b, std::vector<Cards::Card> const& hand, Scenario::Role const role) -> py::object {
+            Cards::Card lead;
+            return b.get_best_lead(Cards::get_card_mask(hand), role, lead) ? py::cast(lead) : py::none();
+        }, py::arg("hand"), py::arg("role"))
+        // Mean card points of the leader's side by card id (NaN for cards not in hand) or None
+        .def("get_lead_points", [](LeadBook::Book const& b, std::vector<Cards::Card> const& hand, Scenario::Role const role) -> py::object {
+            std::array<float, 32> points;
+            if (not b.get_lead_points(Cards::get_card_mask(hand), role, points)) {
+                return py::none();
+            }
+            py::array_t<float> result(32);
+            std::copy(points.begin(), points.end(), result.mutable_data());
+            return result;
+        }, py::arg("hand"), py::arg("role"));
+    py::class_<LeadBook::BookPlayer, HalfSkat::Player, std::shared_ptr<LeadBook::BookPlayer>>(m, "BookPlayer")
+        .def(py::init([](std::shared_ptr<LeadBook::Book> const& book, std::shared_ptr<HalfSkat::Player> const& fallback) {
+            return std::make_shared<LeadBook::BookPlayer>(book, fallback);
+        }), py::arg("book"), py::arg("fallback"))
+        .def("get_hits", &LeadBook::BookPlayer::get_hits)
+        .def("get_misses", &LeadBook::BookPlayer::get_misses);
+
+    // Stats bindings
+    py::class_<Stats::Snapshot>(m, "StatsSnapshot")
+        .def(py::init<>())
+        .def_property_readonly("games", &Stats::Snapshot::get_games)
+        .def_property_readonly("rounds", &Stats::Snapshot::get_rounds)
+        .def_property_readonly("passed_rounds", &Stats::Snapshot::get_passed_rounds)
+        .def_property_readonly("game_winners", [](Stats::Snapshot const& s) { return get_counter_array(s, Stats::Layout::game_winners, {3}); })
+        .def_property_readonly("aborts", [](Stats::Snapshot const& s) { return get_counter_array(s, Stats::Layout::aborts, {3}); })
+        // Rounds by declarer seat, game level and whether the declarer won
+        .def_property_readonly("declarer_rounds", [](Stats::Snapshot const& s) { return get_counter_array(s, Stats::Layout::declarer_rounds, {3, Stats::max_level + 1, 2}); })
+        .def_property_readonly("declarer_points", [](Stats::Snapshot const& s) { return get_counter_array(s, Stats::Layout::declarer_points, {Stats::max_points + 1}); })
+        // Tricks by lead card id and position of the winning card
+        .def_property_readonly("trick_winners", [](Stats::Snapshot const& s) { return get_counter_array(s, Stats::Layout::trick_winners, {32, 3}); })
+        .def_property_readonly("card_plays", [](Stats::Snapshot const& s) { return get_counter_array(s, Stats::Layout::card_plays, {Stats::tricks_per_round, 32}); })
+        .def("get_declarer_win_rate", &Stats::Snapshot::get_declarer_win_rate)
+        .def("get_abort_rate", &Stats::Snapshot::get_abort_rate)
+        .def(py::self += py::self);
+    py::class_<Stats::Collector, std::shared_ptr<Stats::Collector>>(m, "StatsCollector")
+        .def(py::init<int const>(), py::arg("max_threads") = 1024)
+        .def("get_snapshot", &Stats::Collector::get_snapshot)
+        .def("get_threads", &Stats::Collector::get_threads);
+
+    // Policy cache bindings
+    py::class_<PolicyCache::CacheStats>(m, "PolicyCacheStats")
+        .def_readonly("hits", &PolicyCache::CacheStats::hits)
+        .def_readonly("misses", &PolicyCache::CacheStats::misses)
+        .def_readonly("forced", &PolicyCache::CacheStats::forced)
+        .def_readonly("evictions", &PolicyCache::CacheStats::evictions)
+        .def_readonly("size", &PolicyCache::CacheStats::size)
+        .def_readonly("capacity", &PolicyCache::CacheStats::capacity)
+        .def_property_readonly("hit_rate", &PolicyCache::CacheStats::get_hit_rate);
+    py::class_<PolicyCache::Cache, std::shared_ptr<PolicyCache::Cache>>(m, "PolicyCache")
+        .def(py::init<size_t const, int const>(), py::arg("capacity") = 1 << 20, py::arg("num_shards") = 64)
+        .def("get_stats", &PolicyCache::Cache::get_stats)
+        .def("clear", &PolicyCache::Cache::clear);
+
+    // Pipeline bindings
+    py::class_<Pipeline::Config>(m, "PipelineConfig")
+        .def(py::init<>())
+        .def_readwrite("max_actors", &Pipeline::Config::max_actors)
+        .def_readwrite("ring_slots", &Pipeline::Config::ring_slots)
+        .def_readwrite("slot_size", &Pipeline::Config::slot_size)
+        .def_readwrite("weights_capacity", &Pipeline::Config::weights_capacity);
+    py::class_<Pipeline::ActorStats>(m, "ActorStats")
+        .def_readonly("actor", &Pipeline::ActorStats::actor)
+        .def_readonly("pid", &Pipeline::ActorStats::pid)
+        .def_readonly("attached", &Pipeline::ActorStats::attached)
+        .def_readonly("pushed", &Pipeline::ActorStats::pushed)
+        .def_readonly("popped", &Pipeline::ActorStats::popped)
+        .def_readonly("bytes", &Pipeline::ActorStats::bytes)
+        .def_readonly("full_waits", &Pipeline::ActorStats::full_waits)
+        .def_readonly("malformed", &Pipeline::ActorStats::malformed)
+        .def_readonly("seconds", &Pipeline::ActorStats::seconds)
+        .def_readonly("messages_per_second", &Pipeline::ActorStats::messages_per_second)
+        .def_readonly("bytes_per_second", &Pipeline::ActorStats::bytes_per_second);
+    py::class_<Pipeline::Learner>(m, "PipelineLearner")
+        .def(py::init<std::string const&, Pipeline::Config const&>(), py::arg("name"), py::arg("config") = Pipeline::Config())
+        .def("pop", [](Pipeline::Learner& l, size_t const max_messages, double const timeout) {
+            std::vector<std::string> messages;
+            {
+                py::gil_scoped_release release;
+                messages = l.pop_wait(max_messages, timeout);
+            }
+            py::list result;
+            for (auto const& msg : messages) {
+                result.append(py::bytes(msg));
+            }
+            return result;
+        }, py::arg("max_messages"), py::arg("timeout") = 0.)
+        .def("publish_weights", [](Pipeline::Learner& l, py::bytes const& weights) { l.publish_weights(weights); })
+        .def("get_weights_version", &Pipeline::Learner::get_weights_version)
+        .def("get_stats", &Pipeline::Learner::get_stats)
+        .def("close", &Pipeline::Learner::close);
+    py::class_<Pipeline::Actor>(m, "PipelineActor")
+        .def(py::init<std::string const&>())
+        .def("try_push", [](Pipeline::Actor& a, py::bytes const& message) { return a.try_push(message); })
+        .def("push", [](Pipeline::Actor& a, py::bytes const& message, double const timeout) {
+            std::string const data = message;
+            py::gil_scoped_release release;
+            return a.push(data, timeout);
+        }, py::arg("message"), py::arg("timeout") = -1.)
+        // Returns the latest weights if they changed since the last call, otherwise None
+        .def("poll_weights", [](Pipeline::Actor& a) -> py::object {
+            std::string weights;
+            return a.poll_weights(weights) ? py::object(py::bytes(weights)) : py::object(py::none());
+        })
+        .def("get_weights_version", &Pipeline::Actor::get_weights_version)
+        .def("get_max_message_size", &Pipeline::Actor::get_max_message_size)
+        .def("is_closed", &Pipeline::Actor::is_closed)
+        .def("get_index", &Pipeline::Actor::get_index);
+    // Returns (states, actions, rewards, legal_masks) of serialized transitions in model representation
+    m.def("decode_transitions", [](py::bytes const& data) {
+        std::vector<HalfSkat::Transition> const transitions = Serialization::deserialize_transitions(data);
+        size_t const rows = transitions.size();
+        py::array_t<float> states({rows, static_cast<size_t>(Dataset::state_size)});
+        py::array_t<float> actions({rows, static_cast<size_t>(32)});
+        py::array_t<float> rewards(rows);
+        py::array_t<float> legal_masks({rows, static_cast<size_t>(32)});
+        float* states_ptr = states.mutable_data();
+        float* actions_ptr = actions.mutable_data();
+        float* rewards_ptr = rewards.mutable_data();
+        float* legal_masks_ptr = legal_masks.mutable_data();
+        std::fill(actions_ptr, actions_ptr + rows*32, 0.f);
+        for (size_t i=0; i<rows; i++) {
+            HalfSkat::Transition const& t = transitions[i];
+            Dataset::encode_state(t.before, states_ptr + i*Dataset::state_size);
+            actions_ptr[i*32 + Cards::get_card_id(t.action)] = 1.f;
+            rewards_ptr[i] = t.reward;
+            for (int c=0; c<32; c++) {
+                legal_masks_ptr[i*32 + c] = ((t.before.legal_cards >> c) & 1) ? 1.f : 0.f;
+            }
+        }
+        return py::make_tuple(states, actions, rewards, legal_masks);
+    });
+
+    // Policy gradient bindings
+    py::class_<PolicyGradient::Network, std::shared_ptr<PolicyGradient::Network>>(m, "Network")
+        .def(py::init<std::vector<int> const&, unsigned const>(), py::arg("layers") = PolicyGradient::get_default_layers(), py::arg("seed") = 0)
+        .def("get_layers", &PolicyGradient::Network::get_layers)
+        .def("get_version", &PolicyGradient::Network::get_version)
+        // Same list of arrays as keras Model.get_weights, so model.set_weights(network.get_weights()) works and vice versa
+        .def("get_weights", [](PolicyGradient::Network const& n) {
+            std::vector<std::vector<float>> const weights = n.get_weights();
+            std::vector<std::vector<size_t>> const shapes = n.get_weight_shapes();
+            py::list result;
+            for (size_t w=0; w<weights.size(); w++) {
+                py::array_t<float> array(shapes[w]);
+                std::copy(weights[w].begin(), weights[w].end(), array.mutable_data());
+                result.append(array);
+            }
+            return result;
+        })
+        .def("set_weights", [](PolicyGradient::Network& n, std::vector<py::array_t<float, py::array::c_style | py::array::forcecast>> const& arrays) {
+            std::vector<std::vector<float>> weights;
+            for (auto const& a : arrays) {
+                weights.emplace_back(a.data(), a.data() + a.size());
+            }
+            n.set_weights(weights);
+        })
+        .def("get_probabilities", [](PolicyGradient::Network const& n, py::array_t<float, py::array::c_style | py::array::forcecast> const& state, Cards::CardMask const legal_cards) {
+            if (state.size() != Dataset::state_size) {
+                throw std::runtime_error("State must have state_size entries");
+            }
+            py::array_t<float> probs(32);
+            n.get_probabilities(state.data(), legal_cards, probs.mutable_data());
+            return probs;
+        });
+    py::class_<PolicyGradient::NetworkPlayer, HalfSkat::Player, std::shared_ptr<PolicyGradient::NetworkPlayer>>(m, "NetworkPlayer")
+        .def(py::init([](std::shared_ptr<PolicyGradient::Network> const& network, unsigned const seed) {
+            return std::make_shared<PolicyGradient::NetworkPlayer>(network, seed);
+        }), py::arg("network"), py::arg("seed") = 0);
+    py::enum_<PolicyGradient::OptimizerType>(m, "OptimizerType")
+        .value("rmsprop", PolicyGradient::OptimizerType::rmsprop)
+        .value("adam", PolicyGradient::OptimizerType::adam);
+    py::class_<PolicyGradient::Settings>(m, "PolicyGradientSettings")
+        .def(py::init<>())
+        .def_readwrite("layers", &PolicyGradient::Settings::layers)
+        .def_readwrite("optimizer", &PolicyGradient::Settings::optimizer)
+        .def_readwrite("learning_rate", &PolicyGradient::Settings::learning_rate)
+        .def_readwrite("rho", &PolicyGradient::Settings::rho)
+        .def_readwrite("beta_1", &PolicyGradient::Settings::beta_1)
+        .def_readwrite("beta_2", &PolicyGradient::Settings::beta_2)
+        .def_readwrite("epsilon", &PolicyGradient::Settings::epsilon)
+        .def_readwrite("subtract_baseline", &PolicyGradient::Settings::subtract_baseline)
+        .def_readwrite("baseline_decay", &PolicyGradient::Settings::baseline_decay)
+        .def_readwrite("minibatch_size", &PolicyGradient::Settings::minibatch_size)
+        .def_readwrite("epochs", &PolicyGradient::Settings::epochs)
+        .def_readwrite("games_per_episode", &PolicyGradient::Settings::games_per_episode)
+        .def_readwrite("max_rounds", &PolicyGradient::Settings::max_rounds)
+        .def_readwrite("threads", &PolicyGradient::Settings::threads)
+        .def_readwrite("seed", &PolicyGradient::Settings::seed)
+        .def_readwrite("policy_cache_capacity", &PolicyGradient::Settings::policy_cache_capacity);
+    py::class_<PolicyGradient::EpisodeStats>(m, "EpisodeStats")
+        .def_readonly("decisions", &PolicyGradient::EpisodeStats::decisions)
+        .def_readonly("mean_reward", &PolicyGradient::EpisodeStats::mean_reward)
+        .def_readonly("loss", &PolicyGradient::EpisodeStats::loss)
+        .def_readonly("baseline", &PolicyGradient::EpisodeStats::baseline)
+        .def_readonly("play_seconds", &PolicyGradient::EpisodeStats::play_seconds)
+        .def_readonly("train_seconds", &PolicyGradient::EpisodeStats::train_seconds);
+    py::class_<PolicyGradient::Trainer>(m, "NativeTrainer")
+        .def(py::init<PolicyGradient::Settings const&>(), py::arg("settings") = PolicyGradient::Settings())
+        .def("get_network", &PolicyGradient::Trainer::get_network)
+        .def("get_policy_cache", &PolicyGradient::Trainer::get_policy_cache)
+        .def("get_baseline", &PolicyGradient::Trainer::get_baseline)
+        .def("train_episode", &PolicyGradient::Trainer::train_episode, py::call_guard<py::gil_scoped_release>())
+        // Takes the (states, actions, returns, legal_masks) arrays of RecordFile.decode and OfflineDataset, actions and masks one-hot
+        .def("train_on_batch", [](PolicyGradient::Trainer& t, py::array_t<float, py::array::c_style | py::array::forcecast> const& states,
+                py::array_t<float, py::array::c_style | py::array::forcecast> const& actions, py::array_t<float, py::array::c_style | py::array::forcecast> const& returns,
+                py::array_t<float, py::array::c_style | py::array::forcecast> const& legal_masks) {
+            size_t const rows = returns.size();
+            if ((states.size() != rows*Dataset::state_size) or (actions.size() != rows*32) or (legal_masks.size() != rows*32)) {
+                throw std::runtime_error("Batch arrays don't have matching rows");
+            }
+            std::vector<uint8_t> action_ids(rows);
+            std::vector<Cards::CardMask> legal_cards(rows, 0);
+            for (size_t r=0; r<rows; r++) {
+                float const* a = actions.data() + r*32;
+                action_ids[r] = std::max_element(a, a + 32) - a;
+                for (int c=0; c<32; c++) {
+                    if (legal_masks.data()[r*32 + c] > 0.f) {
+                        legal_cards[r] |= Cards::CardMask(1) << c;
+                    }
+                }
+                legal_cards[r] |= Cards::CardMask(1) << action_ids[r]; // Recorded actions count as legal
+            }
+            py::gil_scoped_release release;
+            return t.train_on_batch(states.data(), action_ids.data(), returns.data(), legal_cards.data(), rows);
+        });
+
+    // Differential check bindings
+    py::class_<Differential::Settings>(m, "DifferentialSettings")
+        .def(py::init<>())
+        .def_readwrite("positions", &Differential::Settings::positions)
+        .def_readwrite("rounds", &Differential::Settings::rounds)
+        .def_readwrite("exhaustive", &Differential::Settings::exhaustive)
+        .def_readwrite("threads", &Differential::Settings::threads)
+        .def_readwrite("seed", &Differential::Settings::seed)
+        .def_readwrite("max_divergences", &Differential::Settings::max_divergences);
+    py::class_<Differential::Divergence>(m, "Divergence")
+        .def_property_readonly("original", [](Differential::Divergence const& d) { return Differential::to_string(d.original); })
+        .def_property_readonly("reduced", [](Differential::Divergence const& d) { return Differential::to_string(d.reduced); })
+        .def_readonly("description", &Differential::Divergence::description)
+        .def("__repr__", [](Differential::Divergence const& d) { return Differential::to_string(d.reduced) + ": " + d.description; });
+    py::class_<Differential::Report>(m, "DifferentialReport")
+        // Checks per kind: legal_cards, trick_winner, game_level, deal, round
+        .def_readonly("checks", &Differential::Report::checks)
+        .def_readonly("divergences", &Differential::Report::divergences)
+        .def_readonly("seed", &Differential::Report::seed);
+    m.def("run_differential", &Differential::run, py::arg("settings") = Differential::Settings(), py::call_guard<py::gil_scoped_release>());
+
+    // Tournament bindings
+    py::enum_<Tournament::Schedule>(m, "Schedule")
+        .value("round_robin", Tournament::Schedule::round_robin)
+        .value("gauntlet", Tournament::Schedule::gauntlet);
+    py::enum_<Tournament::SprtState>(m, "SprtState")
+        .value("off", Tournament::SprtState::sprt_off)
+        .value("running", Tournament::SprtState::sprt_running)
+        .value("accept_h0", Tournament::SprtState::sprt_accept_h0)
+        .value("accept_h1", Tournament::SprtState::sprt_accept_h1);
+    py::class_<Tournament::Settings>(m, "TournamentSettings")
+        .def(py::init<>())
+        .def_readwrite("schedule", &Tournament::Settings::schedule)
+        .def_readwrite("rounds_per_match", &Tournament::Settings::rounds_per_match)
+        .def_readwrite("max_matches", &Tournament::Settings::max_matches)
+        .def_readwrite("threads", &Tournament::Settings::threads)
+        .def_readwrite("retry_on_illegal_action", &Tournament::Settings::retry_on_illegal_action)
+        .def_readwrite("sprt", &Tournament::Settings::sprt)
+        .def_readwrite("elo0", &Tournament::Settings::elo0)
+        .def_readwrite("elo1", &Tournament::Settings::elo1)
+        .def_readwrite("alpha", &Tournament::Settings::alpha)
+        .def_readwrite("beta", &Tournament::Settings::beta);
+    py::class_<Tournament::PairResult>(m, "PairResult")
+        .def_readonly("wins", &Tournament::PairResult::wins)
+        .def_readonly("draws", &Tournament::PairResult::draws)
+        .def_readonly("losses", &Tournament::PairResult::losses)
+        .def_readonly("samples", &Tournament::PairResult::samples)
+        .def_readonly("sum", &Tournament::PairResult::sum)
+        .def_readonly("sum_squares", &Tournament::PairResult::sum_squares);
+    py::class_<Tournament::Result>(m, "TournamentResult")
+        .def_readonly("names", &Tournament::Result::names)
+        .def_readonly("elo", &Tournament::Result::elo)
+        .def_readonly("elo_error", &Tournament::Result::elo_error)
+        .def_readonly("points", &Tournament::Result::points)
+        .def_readonly("rounds", &Tournament::Result::rounds)
+        .def_readonly("pairs", &Tournament::Result::pairs)
+        .def_readonly("first_against_field", &Tournament::Result::first_against_field)
+        .def_readonly("matches", &Tournament::Result::matches)
+        .def_readonly("aborted_rounds", &Tournament::Result::aborted_rounds)
+        .def_readonly("llr", &Tournament::Result::llr)
+        .def_readonly("llr_lower", &Tournament::Result::llr_lower)
+        .def_readonly("llr_upper", &Tournament::Result::llr_upper)
+        .def_readonly("sprt", &Tournament::Result::sprt);
+    // Rosters are lists of (name, factory) tuples, factories are callables returning a Player (e.g. a player class)
+    m.def("run_tournament", [](std::vector<std::pair<std::string, py::object>> const& roster, Tournament::Settings const& settings) {
+        std::vector<Tournament::Entrant> entrants = wrap_roster(roster);
+        py::gil_scoped_release release;
+        return Tournament::run(entrants, settings);
+    }, py::arg("roster"), py::arg("settings") = Tournament::Settings());
+    py::class_<Tournament::DuplicateSettings>(m, "DuplicateSettings")
+        .def(py::init<>())
+        .def_readwrite("deals", &Tournament::DuplicateSettings::deals)
+        .def_readwrite("threads", &Tournament::DuplicateSettings::threads)
+        .def_readwrite("retry_on_illegal_action", &Tournament::DuplicateSettings::retry_on_illegal_action)
+        .def_readwrite("seed", &Tournament::DuplicateSettings::seed);
+    py::class_<Tournament::DuplicateResult>(m, "DuplicateResult")
+        .def_readonly("names", &Tournament::DuplicateResult::names)
+        .def_property_readonly("deal_scores", [](Tournament::DuplicateResult const& r) {
+            py::array_t<double> scores({r.deal_scores.size(), r.names.size()});
+            auto s = scores.mutable_unchecked<2>();
+            for (size_t d=0; d<r.deal_scores.size(); d++) {
+                for (size_t i=0; i<r.names.size(); i++) {
+                    s(d, i) = r.deal_scores[d][i];
+                }
+            }
+            return scores;
+        })
+        .def_readonly("mean_difference", &Tournament::DuplicateResult::mean_difference)
+        .def_readonly("difference_error", &Tournament::DuplicateResult::difference_error)
+        .def_readonly("deals", &Tournament::DuplicateResult::deals)
+        .def_readonly("aborted_deals", &Tournament::DuplicateResult::aborted_deals)
+        .def_readonly("aborts", &Tournament::DuplicateResult::aborts)
+        .def_readonly("seed", &Tournament::DuplicateResult::seed);
+    m.def("get_duplicate_seatings", &Tournament::get_duplicate_seatings);
+    m.def("run_duplicate", [](std::vector<std::pair<std::string, py::object>> const& roster, Tournament::DuplicateSettings const& settings) {
+        std::vector<Tournament::Entrant> entrants = wrap_roster(roster);
+        py::gil_scoped_release release;
+        return Tournament::run_duplicate(entrants, settings);
+    }, py::arg("roster"), py::arg("settings") = Tournament::DuplicateSettings());
+
     m.def("run_all_tests", &Tests::run_all_tests);
 }
\ No newline at end of file
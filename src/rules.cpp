@@ -0,0 +1,57 @@
+#include <algorithm>
+
+#include "rules.hpp"
+
+using namespace HalfSkat;
+
+int HalfSkat::get_base_value(Contract const& contract) {
+    return with_rules(contract, [](auto rules) { return decltype(rules)::tables.base_value; });
+}
+
+int HalfSkat::get_matadors(Contract const& contract, Cards::CardMask const cards) {
+    return with_rules(contract, [cards](auto rules) { return decltype(rules)::get_matadors(cards); });
+}
+
+Cards::CardMask HalfSkat::get_trumps(Contract const& contract) {
+    return with_rules(contract, [](auto rules) { return decltype(rules)::tables.trumps; });
+}
+
+std::vector<int> const& HalfSkat::get_bid_values() {
+    static std::vector<int> const values = []() {
+        std::vector<int> v = {23, 35}; // Null and null hand
+        for (int const base : {9, 10, 11, 12, 24}) {
+            for (int level=2; level<=18; level++) { // Up to eleven matadors, game, hand, schneider and schwarz
+                v.push_back(base*level);
+            }
+        }
+        std::sort(v.begin(), v.end());
+        v.erase(std::unique(v.begin(), v.end()), v.end());
+        return v;
+    }();
+    return values;
+}
+
+int HalfSkat::get_highest_bid(int const limit) {
+    std::vector<int> const& values = get_bid_values();
+    auto it = std::upper_bound(values.begin(), values.end(), limit);
+    return (it == values.begin()) ? 0 : *(it - 1);
+}
+
+int HalfSkat::get_next_bid(int const value) {
+    std::vector<int> const& values = get_bid_values();
+    auto it = std::upper_bound(values.begin(), values.end(), value);
+    return (it == values.end()) ? values.back() : *it;
+}
+
+Contract HalfSkat::get_longest_suit_contract(Cards::CardMask const hand) {
+    Contract best(clubs_game);
+    int most = -1;
+    for (GameType const type : {clubs_game, spades_game, hearts_game, diamonds_game}) {
+        int const trumps = Cards::count_cards(hand & get_trumps(Contract(type)));
+        if (trumps > most) {
+            best = Contract(type);
+            most = trumps;
+        }
+    }
+    return best;
+}
@@ -0,0 +1,171 @@
+#pragma once
+
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+#include "cards.hpp"
+
+// Card play rules of the Skat game types as compile-time policies with per-card tables
+namespace HalfSkat {
+
+// Suit games come first, ordered like the color blocks of Cards::AllCards
+enum GameType { clubs_game = 0, spades_game = 1, hearts_game = 2, diamonds_game = 3, grand_game = 4, null_game = 5 };
+
+struct Contract {
+    GameType type = clubs_game;
+    bool hand = false; // Declarer plays without picking up the Skat
+    Contract() = default;
+    Contract(GameType const type, bool const hand = false) : type(type), hand(hand) {}
+    bool operator==(Contract const& c) const { return (type == c.type) and (hand == c.hand); }
+};
+
+// Tables of one game type, indexed by card id
+struct RuleTables {
+    Cards::CardMask trumps = 0;
+    Cards::CardMask suits[32] = {}; // Cards that follow suit if the card is led
+    int8_t order[32] = {}; // Rank within its suit, trumps rank above all other cards
+    int8_t matadors[11] = {}; // Trumps from highest to lowest, counted for the game level
+    int num_matadors = 0;
+    int base_value = 0;
+};
+
+namespace detail {
+
+// Offsets within a color block of AllCards: Seven, Eight, Nine, Ten, Jack, Queen, King, Ace
+constexpr int8_t trick_order[8] = {0, 1, 2, 5, -1, 3, 4, 6}; // Jacks are trumps in suit and grand games
+constexpr int8_t null_order[8] = {0, 1, 2, 3, 4, 5, 6, 7};
+constexpr int8_t matador_offsets[7] = {7, 3, 6, 5, 2, 1, 0}; // Ace, Ten, King, Queen, Nine, Eight, Seven
+constexpr int base_values[6] = {12, 11, 10, 9, 24, 23};
+
+constexpr RuleTables make_tables(GameType const type) {
+    RuleTables t;
+    bool const is_null = (type == null_game);
+    bool const is_suit = (type < grand_game);
+    for (int block=0; block<4; block++) {
+        Cards::CardMask const color = Cards::CardMask(0xff) << 8*block;
+        for (int offset=0; offset<8; offset++) {
+            int const id = 8*block + offset;
+            bool const jack = (offset == 4);
+            if ((not is_null) and (jack or (is_suit and (block == type)))) {
+                t.trumps |= Cards::CardMask(1) << id;
+                // Jacks follow the order of the blocks, clubs highest
+                t.order[id] = 16 + (jack ? (10 - block) : trick_order[offset]);
+            }
+            else {
+                t.order[id] = is_null ? null_order[offset] : trick_order[offset];
+            }
+            t.suits[id] = is_null ? color : (color & ~Cards::CardMask(0x10101010)); // Jacks are trumps, not of their color
+        }
+    }
+    for (int id=0; id<32; id++) {
+        if (t.trumps & (Cards::CardMask(1) << id)) {
+            t.suits[id] = t.trumps;
+        }
+    }
+    if (not is_null) {
+        for (int block=0; block<4; block++) {
+            t.matadors[t.num_matadors++] = 8*block + 4;
+        }
+        if (is_suit) {
+            for (int i=0; i<7; i++) {
+                t.matadors[t.num_matadors++] = 8*type + matador_offsets[i];
+            }
+        }
+    }
+    t.base_value = base_values[type];
+    return t;
+}
+
+} // namespace detail
+
+template<GameType Type>
+struct Rules {
+    static constexpr GameType type = Type;
+    static constexpr RuleTables tables = detail::make_tables(Type);
+
+    static Cards::CardMask get_legal_mask(Cards::CardMask const hand, Cards::Card const& lead) {
+        Cards::CardMask const follow = hand & tables.suits[Cards::get_card_id(lead)];
+        return (follow != 0) ? follow : hand; // Player must follow suit if possible
+    }
+    // Key of card in a trick with the given lead, the highest key wins and -1 can't win
+    static int get_key(int const card_id, int const lead_id) {
+        if ((tables.trumps >> card_id) & 1) {
+            return tables.order[card_id];
+        }
+        return ((tables.suits[lead_id] >> card_id) & 1) ? tables.order[card_id] : -1;
+    }
+    // Index of the winning card of a (partial) trick of Cards::Card
+    template<typename Trick>
+    static size_t get_winner_index(Trick const& trick) {
+        int const lead = Cards::get_card_id(trick[0]);
+        size_t winner = 0;
+        int best = get_key(lead, lead);
+        for (size_t i=1; i<trick.size(); i++) {
+            int const key = get_key(Cards::get_card_id(trick[i]), lead);
+            if (key > best) {
+                best = key;
+                winner = i;
+            }
+        }
+        return winner;
+    }
+    static bool has_trump(Cards::CardMask const cards) { return (cards & tables.trumps) != 0; }
+    // Length of the unbroken sequence of top trumps held ("with") or missing ("without")
+    static int get_matadors(Cards::CardMask const cards) {
+        if (tables.num_matadors == 0) {
+            return 0;
+        }
+        bool const with = (cards >> tables.matadors[0]) & 1;
+        int count = 1;
+        while ((count < tables.num_matadors) and ((((cards >> tables.matadors[count]) & 1) != 0) == with)) {
+            count++;
+        }
+        return count;
+    }
+};
+
+template<GameType Type>
+constexpr RuleTables Rules<Type>::tables;
+
+// Calls f with the Rules of the contract, for game types only known at runtime
+template<typename F>
+auto with_rules(Contract const& contract, F&& f) -> decltype(f(Rules<clubs_game>())) {
+    switch (contract.type) {
+        case clubs_game: return f(Rules<clubs_game>());
+        case spades_game: return f(Rules<spades_game>());
+        case hearts_game: return f(Rules<hearts_game>());
+        case diamonds_game: return f(Rules<diamonds_game>());
+        case grand_game: return f(Rules<grand_game>());
+        case null_game: return f(Rules<null_game>());
+    }
+    throw std::runtime_error("Unknown game type");
+}
+
+// Original HalfSkat: clubs are always trump, the declarer rotates without bidding and the game value is base value times matadors
+struct HalfSkatVariant {
+    static constexpr bool has_bidding = false;
+    template<typename F>
+    static auto dispatch(Contract const&, F&& f) -> decltype(f(Rules<clubs_game>())) { return f(Rules<clubs_game>()); }
+};
+
+// Skat: bidding, Skat pickup and all suit, grand and null games (hand games included, ouvert and announcements are not)
+struct SkatVariant {
+    static constexpr bool has_bidding = true;
+    template<typename F>
+    static auto dispatch(Contract const& contract, F&& f) -> decltype(f(Rules<clubs_game>())) { return with_rules(contract, f); }
+};
+
+int get_base_value(Contract const& contract);
+int get_matadors(Contract const& contract, Cards::CardMask const cards);
+Cards::CardMask get_trumps(Contract const& contract);
+// Valid bids in ascending order
+std::vector<int> const& get_bid_values();
+// Highest valid bid not above limit, zero if there is none
+int get_highest_bid(int const limit);
+// Lowest valid bid above value
+int get_next_bid(int const value);
+// Suit game with the most trumps in hand, ties go to the higher suit
+Contract get_longest_suit_contract(Cards::CardMask const hand);
+
+} // namespace HalfSkat
@@ -0,0 +1,476 @@
+#include <algorithm>
+#include <cstdlib>
+#include <map>
+#include <stdexcept>
+
+#include "scenario.hpp"
+#include "rules.hpp"
+
+using namespace Scenario;
+
+namespace {
+
+static const std::array<int, num_roles> role_sizes = {{10, 10, 10, 2}};
+static const int num_groups = 5; // Jacks, then clubs, spades, hearts and diamonds without their jacks
+static const Cards::CardMask trumps_mask = Cards::jacks_mask | 0xff;
+static const Cards::CardMask suit_pattern = 0xef; // Color block without its jack
+static const uint32_t factorials[9] = {1, 1, 2, 6, 24, 120, 720, 5040, 40320}; // Groups have at most eight cards
+
+// Counts per role, packed into four nibbles
+using Counts = uint16_t;
+inline int get_role_count(Counts const counts, int const role) { return (counts >> 4*role) & 0xf; }
+inline Counts get_unit(int const role) { return Counts(1) << 4*role; }
+
+Cards::CardMask get_group_mask(int const group) {
+    return (group == 0) ? Cards::jacks_mask : (suit_pattern << 8*(group - 1));
+}
+
+int get_group_total(Counts const counts) {
+    int total = 0;
+    for (int d=0; d<num_roles; d++) {
+        total += get_role_count(counts, d);
+    }
+    return total;
+}
+
+uint32_t compute_multinomial(Counts const counts) {
+    uint32_t ways = factorials[get_group_total(counts)];
+    for (int d=0; d<num_roles; d++) {
+        ways /= factorials[get_role_count(counts, d)];
+    }
+    return ways;
+}
+
+// Arrangements of a group's cards with the given counts, looked up since unranking needs them for every card
+uint32_t get_multinomial(Counts const counts) {
+    static const std::vector<uint32_t> table = []() {
+        std::vector<uint32_t> t(1 << 16, 0);
+        for (int c=0; c<(1 << 16); c++) {
+            if (get_group_total(Counts(c)) <= 8) {
+                t[c] = compute_multinomial(Counts(c));
+            }
+        }
+        return t;
+    }();
+    return table[counts];
+}
+
+// Calls f for every way to split n cards among the roles in the bit set roles, without exceeding limits
+template<typename F>
+void for_each_split(int const n, int const roles, std::array<int, num_roles> const& limits, F&& f, int const role = 0, Counts const counts = 0) {
+    if (role == num_roles - 1) {
+        if ((n == 0) or (((roles >> role) & 1) and (n <= limits[role]))) {
+            f(Counts(counts + n*get_unit(role)));
+        }
+        return;
+    }
+    int const max_count = ((roles >> role) & 1) ? std::min(n, limits[role]) : 0;
+    for (int k=0; k<=max_count; k++) {
+        for_each_split(n - k, roles, limits, f, role + 1, Counts(counts + k*get_unit(role)));
+    }
+}
+
+// Cards of a group that may go to the same roles
+struct Subclass {
+    int roles = 0; // Bit set of roles
+    std::vector<uint8_t> cards;
+};
+
+struct Option {
+    Counts counts;
+    uint32_t ways; // Assignments of the group's free cards with these counts, at most 4^8
+    std::array<int8_t, num_roles> roles; // Unpacked counts
+    int state_delta; // Change of the state index when the group is dealt like this
+};
+
+struct Group {
+    std::vector<Subclass> subclasses;
+    std::vector<Option> options; // Counts within the role's constraints
+    std::vector<std::vector<Option>> suffix_ways; // Ways of subclasses s+1 and later per counts, sorted
+};
+
+uint32_t find_ways(std::vector<Option> const& ways, Counts const counts) {
+    auto it = std::lower_bound(ways.begin(), ways.end(), counts, [](Option const& o, Counts const c) { return o.counts < c; });
+    return ((it != ways.end()) and (it->counts == counts)) ? it->ways : 0;
+}
+
+// Assigns the index-th arrangement (in lexicographic role order) of cards with the given counts
+void unrank_subclass(std::vector<uint8_t> const& cards, Counts counts, uint32_t index, Hands& hands) {
+    // Exact division by the remaining cards (at most eight) for numerators below 2^19, 2^32 / k rounded up
+    static const uint64_t reciprocals[9] = {0, 4294967296u, 2147483648u, 1431655766u, 1073741824u, 858993460u, 715827883u, 613566757u, 536870912u};
+    uint32_t arrangements = get_multinomial(counts);
+    for (size_t i=0; i<cards.size(); i++) {
+        if (arrangements == 1) { // Only one role left
+            for (int d=0; d<num_roles; d++) {
+                if (get_role_count(counts, d) > 0) {
+                    for (; i<cards.size(); i++) {
+                        hands[d] |= Cards::CardMask(1) << cards[i];
+                    }
+                    return;
+                }
+            }
+        }
+        uint64_t const reciprocal = reciprocals[cards.size() - i];
+        for (int d=0; d<num_roles; d++) {
+            // Arrangements of the other cards if this one goes to d
+            uint32_t const ways = (uint64_t(arrangements*get_role_count(counts, d))*reciprocal) >> 32;
+            if (index < ways) {
+                hands[d] |= Cards::CardMask(1) << cards[i];
+                counts -= get_unit(d);
+                arrangements = ways;
+                break;
+            }
+            index -= ways;
+        }
+    }
+}
+
+} // namespace
+
+struct Generator::Cell {
+    Hands fixed = {{0, 0, 0, 0}}; // Required cards
+    std::array<int, num_roles> capacity; // Free slots per role
+    std::array<int, num_roles> fixed_trumps;
+    std::array<Range, num_roles> trumps;
+    std::array<Group, num_groups> groups;
+    std::array<int, num_groups + 1> free_slots; // Total free slots before each group
+    std::vector<uint64_t> counts; // Completions of the deal from each state before each group
+    uint64_t total = 0;
+    // Options with completions from each reachable state, cumulative so sampling can bisect
+    struct Transition {
+        uint64_t end;
+        Option const* option;
+    };
+    std::vector<Transition> transitions;
+    std::vector<uint32_t> first_transition; // Per group and state, followed by the end of the last state
+
+    // States before a group are the free slots per role, the third follows from their total
+    static const int states_per_group = 11*11*3;
+    static int get_state(std::array<int, num_roles> const& slots) { return (slots[0]*11 + slots[1])*3 + slots[3]; }
+
+    Cell(Hands const& required, Hands const& forbidden, Constraints const& constraints);
+    bool trumps_fit(std::array<int, num_roles> const& slots) const;
+    uint64_t get_completions(int const group, std::array<int, num_roles> const& slots, int const state, Option const& option) const;
+    void place(int const group, Counts const counts, uint32_t index, Hands& hands) const;
+};
+
+Generator::Cell::Cell(Hands const& required, Hands const& forbidden, Constraints const& constraints) : fixed(required) {
+    Cards::CardMask taken = 0;
+    for (int d=0; d<num_roles; d++) {
+        if ((required[d] & (taken | forbidden[d])) != 0) {
+            return;
+        }
+        taken |= required[d];
+        capacity[d] = role_sizes[d] - Cards::count_cards(required[d]);
+        if (capacity[d] < 0) {
+            return;
+        }
+        fixed_trumps[d] = Cards::count_cards(required[d] & trumps_mask);
+        trumps[d] = constraints[d].trumps;
+    }
+    free_slots[0] = 0;
+    for (int d=0; d<num_roles; d++) {
+        free_slots[0] += capacity[d];
+    }
+    for (int g=0; g<num_groups; g++) {
+        Group& group = groups[g];
+        Cards::CardMask const mask = get_group_mask(g);
+        int n = 0;
+        for (int id=0; id<32; id++) {
+            if ((not ((mask >> id) & 1)) or ((taken >> id) & 1)) {
+                continue;
+            }
+            int roles = 0;
+            for (int d=0; d<num_roles; d++) {
+                roles |= ((forbidden[d] >> id) & 1) ? 0 : (1 << d);
+            }
+            if (roles == 0) {
+                return;
+            }
+            auto it = std::find_if(group.subclasses.begin(), group.subclasses.end(), [roles](Subclass const& s) { return s.roles == roles; });
+            if (it == group.subclasses.end()) {
+                group.subclasses.push_back(Subclass());
+                group.subclasses.back().roles = roles;
+                it = group.subclasses.end() - 1;
+            }
+            it->cards.push_back(id);
+            n++;
+        }
+        free_slots[g+1] = free_slots[g] - n;
+        // Ways to deal subclasses s and later, built from the last subclass
+        size_t const num_subclasses = group.subclasses.size();
+        group.suffix_ways.resize(num_subclasses);
+        std::vector<Option> ways = {{0, 1, {{0, 0, 0, 0}}, 0}};
+        for (size_t s=num_subclasses; s-->0;) {
+            group.suffix_ways[s] = ways;
+            std::map<Counts, uint32_t> next;
+            for (auto const& w : ways) {
+                std::array<int, num_roles> limits;
+                for (int d=0; d<num_roles; d++) {
+                    limits[d] = capacity[d] - get_role_count(w.counts, d);
+                }
+                Subclass const& sub = group.subclasses[s];
+                for_each_split(sub.cards.size(), sub.roles, limits, [&](Counts const split) {
+                    next[w.counts + split] += get_multinomial(split) * w.ways;
+                });
+            }
+            ways.clear();
+            for (auto const& e : next) {
+                ways.push_back({e.first, e.second, {{0, 0, 0, 0}}, 0});
+            }
+        }
+        for (auto const& w : ways) {
+            bool fits = true;
+            for (int d=0; d<num_roles; d++) {
+                int const count = Cards::count_cards(required[d] & mask) + get_role_count(w.counts, d);
+                Range const& range = (g == 0) ? constraints[d].jacks : constraints[d].suits[3 - (g - 1)];
+                fits = fits and range.contains(count);
+            }
+            if (fits) {
+                Option option = w;
+                for (int d=0; d<num_roles; d++) {
+                    option.roles[d] = get_role_count(w.counts, d);
+                }
+                option.state_delta = (option.roles[0]*11 + option.roles[1])*3 + option.roles[3];
+                group.options.push_back(option);
+            }
+        }
+        // Any fixed order samples exactly, balanced splits are the most likely and are found first
+        std::stable_sort(group.options.begin(), group.options.end(), [](Option const& l, Option const& r) { return l.ways > r.ways; });
+    }
+    // Backward over the groups: completions from every reachable number of free slots
+    counts.assign((num_groups + 1)*states_per_group, 0);
+    counts[num_groups*states_per_group + get_state({{0, 0, 0, 0}})] = 1;
+    for (int g=num_groups-1; g>=0; g--) {
+        std::array<int, num_roles> slots;
+        for (slots[0]=0; slots[0]<=capacity[0]; slots[0]++) {
+            for (slots[1]=0; slots[1]<=capacity[1]; slots[1]++) {
+                for (slots[3]=0; slots[3]<=capacity[3]; slots[3]++) {
+                    slots[2] = free_slots[g] - slots[0] - slots[1] - slots[3];
+                    if ((slots[2] < 0) or (slots[2] > capacity[2])) {
+                        continue;
+                    }
+                    int const state = get_state(slots);
+                    uint64_t sum = 0;
+                    for (auto const& option : groups[g].options) {
+                        sum += get_completions(g, slots, state, option);
+                    }
+                    counts[g*states_per_group + state] = sum;
+                }
+            }
+        }
+    }
+    total = counts[get_state(capacity)];
+    if (total == 0) {
+        return;
+    }
+    // Forward over the groups from the initial free slots, reachable states get their transitions
+    first_transition.assign(num_groups*states_per_group + 1, 0);
+    std::vector<bool> reachable(num_groups*states_per_group, false);
+    reachable[get_state(capacity)] = true;
+    for (int g=0; g<num_groups; g++) {
+        for (int state=0; state<states_per_group; state++) {
+            first_transition[g*states_per_group + state] = transitions.size();
+            if (not reachable[g*states_per_group + state]) {
+                continue;
+            }
+            std::array<int, num_roles> slots = {{state / 33, (state / 3) % 11, 0, state % 3}};
+            slots[2] = free_slots[g] - slots[0] - slots[1] - slots[3];
+            uint64_t end = 0;
+            for (auto const& option : groups[g].options) {
+                uint64_t const completions = get_completions(g, slots, state, option);
+                if (completions > 0) {
+                    end += completions;
+                    transitions.push_back({end, &option});
+                    if (g + 1 < num_groups) {
+                        reachable[(g + 1)*states_per_group + state - option.state_delta] = true;
+                    }
+                }
+            }
+        }
+    }
+    first_transition.back() = transitions.size();
+}
+
+// Trumps are complete once jacks and clubs are dealt
+bool Generator::Cell::trumps_fit(std::array<int, num_roles> const& slots) const {
+    for (int d=0; d<num_roles; d++) {
+        if (not trumps[d].contains(fixed_trumps[d] + capacity[d] - slots[d])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Matching deals that deal the group as given by option from the free slots with the given state index
+uint64_t Generator::Cell::get_completions(int const group, std::array<int, num_roles> const& slots, int const state, Option const& option) const {
+    if ((slots[0] < option.roles[0]) or (slots[1] < option.roles[1]) or (slots[2] < option.roles[2]) or (slots[3] < option.roles[3])) {
+        return 0;
+    }
+    if (group == 1) {
+        std::array<int, num_roles> const next = {{slots[0] - option.roles[0], slots[1] - option.roles[1], slots[2] - option.roles[2], slots[3] - option.roles[3]}};
+        if (not trumps_fit(next)) {
+            return 0;
+        }
+    }
+    return option.ways * counts[(group + 1)*states_per_group + state - option.state_delta];
+}
+
+// Deals the index-th of the group's arrangements with the given counts
+void Generator::Cell::place(int const group, Counts counts, uint32_t index, Hands& hands) const {
+    Group const& g = groups[group];
+    if (g.subclasses.size() == 1) {
+        unrank_subclass(g.subclasses[0].cards, counts, index, hands);
+        return;
+    }
+    for (size_t s=0; s<g.subclasses.size(); s++) {
+        Subclass const& sub = g.subclasses[s];
+        std::array<int, num_roles> limits;
+        for (int d=0; d<num_roles; d++) {
+            limits[d] = get_role_count(counts, d);
+        }
+        bool placed = false;
+        for_each_split(sub.cards.size(), sub.roles, limits, [&](Counts const split) {
+            if (placed) {
+                return;
+            }
+            uint32_t const arrangements = get_multinomial(split);
+            uint32_t const ways = arrangements * find_ways(g.suffix_ways[s], Counts(counts - split));
+            if (index < ways) {
+                unrank_subclass(sub.cards, split, index % arrangements, hands);
+                index /= arrangements;
+                counts -= split;
+                placed = true;
+            }
+            else {
+                index -= ways;
+            }
+        });
+    }
+}
+
+int Scenario::get_matadors(Cards::CardMask const cards) {
+    using Rules = HalfSkat::Rules<HalfSkat::clubs_game>;
+    int const count = Rules::get_matadors(cards);
+    return ((cards >> Rules::tables.matadors[0]) & 1) ? count : -count;
+}
+
+bool Scenario::satisfies(Constraints const& constraints, Hands const& hands) {
+    Cards::CardMask all = 0;
+    for (int d=0; d<num_roles; d++) {
+        HandConstraints const& c = constraints[d];
+        Cards::CardMask const cards = hands[d];
+        if ((Cards::count_cards(cards) != role_sizes[d]) or ((all & cards) != 0)) {
+            return false;
+        }
+        all |= cards;
+        if (((cards & c.required) != c.required) or ((cards & c.forbidden) != 0)) {
+            return false;
+        }
+        if ((not c.jacks.contains(Cards::count_cards(cards & Cards::jacks_mask))) or (not c.trumps.contains(Cards::count_cards(cards & trumps_mask)))) {
+            return false;
+        }
+        for (auto const color : Cards::AllColors) {
+            if (not c.suits[color].contains(Cards::count_cards(cards & (suit_pattern << 8*(3 - color))))) {
+                return false;
+            }
+        }
+        if ((d != skat) and (not c.matadors.contains(get_matadors(cards)))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::vector<Cards::Card> Scenario::get_deck(Hands const& hands, int const declarer) {
+    std::vector<Cards::Card> deck;
+    deck.reserve(32);
+    for (int seat=0; seat<3; seat++) {
+        for (auto const& card : Cards::get_cards_from_mask(hands[(seat - declarer + 3) % 3])) {
+            deck.push_back(card);
+        }
+    }
+    for (auto const& card : Cards::get_cards_from_mask(hands[skat])) {
+        deck.push_back(card);
+    }
+    return deck;
+}
+
+Generator::Generator(Constraints const& constraints, unsigned const seed) : constraints(constraints), engine(seed ? seed : std::random_device{}()) {
+    // Matador ranges split into disjoint patterns of required and forbidden top trumps
+    using Rules = HalfSkat::Rules<HalfSkat::clubs_game>;
+    std::array<std::vector<std::pair<Cards::CardMask, Cards::CardMask>>, 3> patterns;
+    for (int d=0; d<3; d++) {
+        Range const& range = constraints[d].matadors;
+        if ((range.min <= -Rules::tables.num_matadors) and (range.max >= Rules::tables.num_matadors)) {
+            patterns[d].push_back({0, 0});
+            continue;
+        }
+        for (int level=std::max(range.min, -Rules::tables.num_matadors); level<=std::min(range.max, Rules::tables.num_matadors); level++) {
+            int const count = std::abs(level);
+            if (count == 0) {
+                continue;
+            }
+            Cards::CardMask top = 0;
+            for (int i=0; i<count; i++) {
+                top |= Cards::CardMask(1) << Rules::tables.matadors[i];
+            }
+            Cards::CardMask const next = (count < Rules::tables.num_matadors) ? (Cards::CardMask(1) << Rules::tables.matadors[count]) : 0;
+            patterns[d].push_back((level > 0) ? std::make_pair(top, next) : std::make_pair(next, top));
+        }
+    }
+    Hands required, forbidden;
+    for (int d=0; d<num_roles; d++) {
+        required[d] = constraints[d].required;
+        forbidden[d] = constraints[d].forbidden;
+    }
+    for (auto const& p0 : patterns[0]) {
+        for (auto const& p1 : patterns[1]) {
+            for (auto const& p2 : patterns[2]) {
+                Hands cell_required = required;
+                Hands cell_forbidden = forbidden;
+                std::array<std::pair<Cards::CardMask, Cards::CardMask>, 3> const chosen = {{p0, p1, p2}};
+                for (int d=0; d<3; d++) {
+                    cell_required[d] |= chosen[d].first;
+                    cell_forbidden[d] |= chosen[d].second;
+                }
+                auto cell = std::make_shared<Cell>(cell_required, cell_forbidden, constraints);
+                if (cell->total > 0) {
+                    total += cell->total;
+                    cells.push_back(cell);
+                    cell_ends.push_back(total);
+                }
+            }
+        }
+    }
+    if (total == 0) {
+        throw std::runtime_error("No deal satisfies the scenario constraints.");
+    }
+}
+
+double Generator::get_probability() const {
+    static const double all_deals = 2753294408504640.; // 32! / (10!^3 2!)
+    return total / all_deals;
+}
+
+Hands Generator::sample(std::mt19937_64& engine) const {
+    // A single uniform index over all matching deals, decoded group by group
+    uint64_t index = std::uniform_int_distribution<uint64_t>(0, total - 1)(engine);
+    size_t const c = std::upper_bound(cell_ends.begin(), cell_ends.end(), index) - cell_ends.begin();
+    index -= (c > 0) ? cell_ends[c-1] : 0;
+    Cell const& cell = *cells[c];
+    Hands hands = cell.fixed;
+    int state = Cell::get_state(cell.capacity);
+    for (int g=0; g<num_groups; g++) {
+        int const at = g*Cell::states_per_group + state;
+        auto const first = cell.transitions.begin() + cell.first_transition[at];
+        auto const it = std::upper_bound(first, cell.transitions.begin() + cell.first_transition[at + 1], index,
+            [](uint64_t const i, Cell::Transition const& t) { return i < t.end; });
+        index -= (it != first) ? (it - 1)->end : 0;
+        Option const& option = *it->option;
+        cell.place(g, option.counts, index % option.ways, hands);
+        index /= option.ways;
+        state -= option.state_delta;
+    }
+    return hands;
+}
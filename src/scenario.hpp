@@ -0,0 +1,77 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "cards.hpp"
+
+// Deals satisfying declarative constraints on the hands and the Skat, drawn uniformly from all matching deals
+namespace Scenario {
+
+// Constraints refer to roles relative to the declarer: the declarer, the next two seats in order of play and the Skat
+enum Role { declarer = 0, first_defender = 1, second_defender = 2, skat = 3 };
+static const int num_roles = 4;
+
+// Inclusive bounds of a count
+struct Range {
+    int min = 0;
+    int max = 32;
+    Range() = default;
+    Range(int const min, int const max) : min(min), max(max) {}
+    bool contains(int const value) const { return (min <= value) and (value <= max); }
+};
+
+// Constraints on the cards of one role, trumps and matadors as in Game (clubs are trump)
+struct HandConstraints {
+    Cards::CardMask required = 0; // Cards the role must hold
+    Cards::CardMask forbidden = 0; // Cards the role must not hold
+    Range jacks;
+    Range trumps; // Jacks and clubs
+    std::array<Range, 4> suits; // Cards of each Cards::Color without its jack, {0, 0} is void
+    Range matadors{-11, 11}; // Game level of the cards, positive "with" and negative "without" (ignored for the Skat)
+};
+
+using Constraints = std::array<HandConstraints, num_roles>;
+using Hands = std::array<Cards::CardMask, num_roles>; // Cards by role
+
+// Supplies the decks of new rounds to a Game instead of a uniform shuffle
+class DealSource {
+    public:
+        virtual ~DealSource() = default;
+        // Ten cards per seat in seat order, then the Skat. Variants with bidding pass forehand as declarer.
+        virtual std::vector<Cards::Card> get_deck(int const declarer) = 0;
+};
+
+// Signed matador count of cards as used by HandConstraints
+int get_matadors(Cards::CardMask const cards);
+bool satisfies(Constraints const& constraints, Hands const& hands);
+// Deck for Game::deal_round with the roles seated relative to declarer
+std::vector<Cards::Card> get_deck(Hands const& hands, int const declarer);
+
+// Counts the matching deals per card category (jacks, then the other cards of each color) and samples by walking the
+// counts, so every matching deal is equally likely and no deal is rejected. Matador constraints are split into
+// disjoint cells of required and forbidden top trumps.
+class Generator : public DealSource {
+    public:
+        // Throws if no deal satisfies the constraints
+        Generator(Constraints const& constraints, unsigned const seed = 0);
+        Constraints const& get_constraints() const { return constraints; }
+        uint64_t get_count() const { return total; } // Matching deals, hands and Skat as sets
+        double get_probability() const; // Of a uniformly shuffled deck matching
+        // The counts are read-only, threads may sample concurrently with their own engines
+        Hands sample(std::mt19937_64& engine) const;
+        Hands sample() { return sample(engine); }
+        std::vector<Cards::Card> get_deck(int const declarer) override { return Scenario::get_deck(sample(), declarer); }
+    private:
+        struct Cell;
+        Constraints constraints;
+        std::vector<std::shared_ptr<Cell const>> cells;
+        std::vector<uint64_t> cell_ends; // Cumulative counts of the cells
+        uint64_t total = 0;
+        std::mt19937_64 engine;
+};
+
+} // namespace Scenario
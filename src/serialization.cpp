@@ -0,0 +1,152 @@
+#include <stdexcept>
+
+#include "serialization.hpp"
+
+using namespace Serialization;
+
+void Writer::put_u32(uint32_t const value) {
+    for (int i=0; i<4; i++) {
+        put_u8((value >> (8*i)) & 0xff);
+    }
+}
+
+void Reader::require(size_t const size) const {
+    if (pos + size > buffer.size()) {
+        throw std::runtime_error("Serialized data is truncated");
+    }
+}
+
+uint8_t Reader::get_u8() {
+    require(1);
+    return static_cast<uint8_t>(buffer[pos++]);
+}
+
+uint32_t Reader::get_u32() {
+    uint32_t value = 0;
+    for (int i=0; i<4; i++) {
+        value |= static_cast<uint32_t>(get_u8()) << (8*i);
+    }
+    return value;
+}
+
+void Reader::get_bytes(void* data, size_t const size) {
+    require(size);
+    buffer.copy(static_cast<char*>(data), size, pos);
+    pos += size;
+}
+
+uint8_t Serialization::pack_card(Cards::Card const& card) {
+    return Cards::get_card_id(card) | ((card.played_by + 1) << 5);
+}
+
+Cards::Card Serialization::unpack_card(uint8_t const packed) {
+    Cards::Card card(packed & 0x1f);
+    card.played_by = ((packed >> 5) & 0x3) - 1;
+    return card;
+}
+
+void Serialization::write_card(Writer& writer, Cards::Card const& card) {
+    writer.put_u8(pack_card(card));
+}
+
+Cards::Card Serialization::read_card(Reader& reader) {
+    return unpack_card(reader.get_u8());
+}
+
+void Serialization::write_state(Writer& writer, HalfSkat::PlayerState const& state) {
+    if (state.trick.size() > 3) {
+        throw std::runtime_error("Trick is too full");
+    }
+    writer.put_u32(state.hole_cards);
+    writer.put_u32(state.won_friendly);
+    writer.put_u32(state.won_hostile);
+    writer.put_u32(state.legal_cards);
+    // Contract shares the flags byte, HalfSkat states (clubs, no hand) keep their old encoding
+    writer.put_u8((state.is_declarer ? 1 : 0) | (state.trick.size() << 1) | (state.contract.type << 3) | (state.contract.hand ? 0x40 : 0));
+    // Fixed size: unused trick slots are zero
+    for (size_t i=0; i<3; i++) {
+        uint8_t packed = 0;
+        if (i < state.trick.size()) {
+            packed = pack_card(state.trick[i]) | (state.trick_played_by_friend[i] ? 0x80 : 0);
+        }
+        writer.put_u8(packed);
+    }
+}
+
+HalfSkat::PlayerState Serialization::read_state(Reader& reader) {
+    HalfSkat::PlayerState state;
+    state.hole_cards = reader.get_u32();
+    state.won_friendly = reader.get_u32();
+    state.won_hostile = reader.get_u32();
+    state.legal_cards = reader.get_u32();
+    uint8_t const flags = reader.get_u8();
+    state.is_declarer = (flags & 1);
+    size_t const trick_size = (flags >> 1) & 0x3;
+    state.contract = HalfSkat::Contract(static_cast<HalfSkat::GameType>((flags >> 3) & 0x7), flags & 0x40);
+    for (size_t i=0; i<3; i++) {
+        uint8_t const packed = reader.get_u8();
+        if (i < trick_size) {
+            state.trick.push_back(unpack_card(packed & 0x7f));
+            state.trick_played_by_friend[i] = (packed & 0x80);
+        }
+    }
+    return state;
+}
+
+void Serialization::write_transition(Writer& writer, HalfSkat::Transition const& transition) {
+    write_state(writer, transition.before);
+    write_state(writer, transition.after);
+    writer.put_i32(transition.reward);
+    write_card(writer, transition.action);
+}
+
+HalfSkat::Transition Serialization::read_transition(Reader& reader) {
+    HalfSkat::PlayerState before = read_state(reader);
+    HalfSkat::PlayerState after = read_state(reader);
+    int const reward = reader.get_i32();
+    Cards::Card const action = read_card(reader);
+    return HalfSkat::Transition(before, after, reward, action);
+}
+
+std::string Serialization::serialize_card(Cards::Card const& card) {
+    Writer writer;
+    write_card(writer, card);
+    return writer.str();
+}
+
+Cards::Card Serialization::deserialize_card(std::string const& data) {
+    Reader reader(data);
+    return read_card(reader);
+}
+
+std::string Serialization::serialize_state(HalfSkat::PlayerState const& state) {
+    Writer writer;
+    write_state(writer, state);
+    return writer.str();
+}
+
+HalfSkat::PlayerState Serialization::deserialize_state(std::string const& data) {
+    Reader reader(data);
+    return read_state(reader);
+}
+
+std::string Serialization::serialize_transitions(std::vector<HalfSkat::Transition> const& transitions) {
+    Writer writer;
+    for (auto const& t : transitions) {
+        write_transition(writer, t);
+    }
+    return writer.str();
+}
+
+std::vector<HalfSkat::Transition> Serialization::deserialize_transitions(std::string const& data) {
+    if (data.size() % transition_bytes != 0) {
+        throw std::runtime_error("Serialized transitions have wrong size");
+    }
+    Reader reader(data);
+    std::vector<HalfSkat::Transition> transitions;
+    transitions.reserve(data.size() / transition_bytes);
+    while (not reader.at_end()) {
+        transitions.push_back(read_transition(reader));
+    }
+    return transitions;
+}
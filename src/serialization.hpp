@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "cards.hpp"
+#include "halfskat.hpp"
+
+// Compact little-endian binary encoding of cards, states and transitions
+namespace Serialization {
+
+static const size_t card_bytes = 1;
+static const size_t state_bytes = 20;
+static const size_t transition_bytes = 2*state_bytes + 4 + card_bytes;
+
+class Writer {
+    public:
+        void put_u8(uint8_t const value) { buffer.push_back(static_cast<char>(value)); }
+        void put_u32(uint32_t const value);
+        void put_i32(int32_t const value) { put_u32(static_cast<uint32_t>(value)); }
+        void put_bytes(void const* data, size_t const size) { buffer.append(static_cast<char const*>(data), size); }
+        std::string const& str() const { return buffer; }
+    private:
+        std::string buffer;
+};
+
+class Reader {
+    public:
+        Reader(std::string const& buffer) : buffer(buffer) {}
+        uint8_t get_u8();
+        uint32_t get_u32();
+        int32_t get_i32() { return static_cast<int32_t>(get_u32()); }
+        void get_bytes(void* data, size_t const size);
+        bool at_end() const { return pos == buffer.size(); }
+    private:
+        std::string const& buffer;
+        size_t pos = 0;
+        void require(size_t const size) const;
+};
+
+// Card id in the lower five bits, played_by+1 in the next two
+uint8_t pack_card(Cards::Card const& card);
+Cards::Card unpack_card(uint8_t const packed);
+
+void write_card(Writer& writer, Cards::Card const& card);
+Cards::Card read_card(Reader& reader);
+void write_state(Writer& writer, HalfSkat::PlayerState const& state);
+HalfSkat::PlayerState read_state(Reader& reader);
+void write_transition(Writer& writer, HalfSkat::Transition const& transition);
+HalfSkat::Transition read_transition(Reader& reader);
+
+std::string serialize_card(Cards::Card const& card);
+Cards::Card deserialize_card(std::string const& data);
+std::string serialize_state(HalfSkat::PlayerState const& state);
+HalfSkat::PlayerState deserialize_state(std::string const& data);
+std::string serialize_transitions(std::vector<HalfSkat::Transition> const& transitions);
+std::vector<HalfSkat::Transition> deserialize_transitions(std::string const& data);
+
+} // namespace Serialization
@@ -0,0 +1,150 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <new>
+#include <stdexcept>
+#include <utility>
+
+#include "stats.hpp"
+
+using namespace Stats;
+
+namespace {
+
+std::atomic<uint64_t> next_collector_id{1};
+
+} // namespace
+
+Snapshot& Snapshot::operator+=(Snapshot const& other) {
+    for (size_t i=0; i<counts.size(); i++) {
+        counts[i] += other.counts[i];
+    }
+    return *this;
+}
+
+double Snapshot::get_declarer_win_rate(int const seat) const {
+    uint64_t won = 0;
+    uint64_t played = 0;
+    for (int level=0; level<=max_level; level++) {
+        won += get_declarer_rounds(seat, level, true);
+        played += get_declarer_rounds(seat, level, false) + get_declarer_rounds(seat, level, true);
+    }
+    return (played > 0) ? double(won) / played : std::nan("");
+}
+
+double Snapshot::get_abort_rate() const {
+    uint64_t aborts = 0;
+    for (int seat=0; seat<3; seat++) {
+        aborts += counts[Layout::aborts + seat];
+    }
+    return (get_games() > 0) ? double(aborts) / get_games() : std::nan("");
+}
+
+ThreadCounters::ThreadCounters() {
+    for (auto& c : counts) {
+        c.store(0, std::memory_order_relaxed);
+    }
+}
+
+void ThreadCounters::count_round(int const declarer, int const level, int const declarer_points, bool const won) {
+    add(Layout::rounds);
+    add(Layout::declarer_rounds + (declarer*(max_level + 1) + std::min(level, max_level))*2 + won);
+    add(Layout::declarer_points + declarer_points);
+}
+
+void ThreadCounters::add_to(Snapshot& snapshot) const {
+    for (size_t i=0; i<Layout::size; i++) {
+        snapshot.counts[i] += counts[i].load(std::memory_order_relaxed);
+    }
+}
+
+// Counter blocks by slot, allocated by the first thread claiming a slot and kept for the threads reusing it
+struct Collector::Slots {
+    std::vector<std::atomic<ThreadCounters*>> counters;
+    std::vector<std::atomic<bool>> claimed;
+    std::atomic<int> num_counters{0};
+    Slots(int const size) : counters(size), claimed(size) {
+        for (int i=0; i<size; i++) {
+            counters[i].store(nullptr);
+            claimed[i].store(false);
+        }
+    }
+    ~Slots() {
+        for (auto& c : counters) {
+            ThreadCounters* t = c.load();
+            if (t) {
+                t->~ThreadCounters();
+                std::free(t);
+            }
+        }
+    }
+};
+
+Collector::Collector(int const max_threads) : id(next_collector_id++), slots(std::make_shared<Slots>(max_threads)) {}
+
+ThreadCounters& Collector::local() {
+    // Slots the thread has claimed, looked up linearly since threads rarely use more than a few collectors
+    struct Claims {
+        struct Claim {
+            uint64_t id;
+            std::weak_ptr<Slots> slots;
+            int idx;
+            ThreadCounters* counters;
+        };
+        std::vector<Claim> claims;
+        ~Claims() {
+            for (auto const& claim : claims) {
+                if (auto s = claim.slots.lock()) {
+                    // Publishes the counts of this thread to the next owner of the slot
+                    s->claimed[claim.idx].store(false, std::memory_order_release);
+                }
+            }
+        }
+    };
+    static thread_local Claims local_claims;
+    auto& claims = local_claims.claims;
+    for (auto const& claim : claims) {
+        if (claim.id == id) {
+            return *claim.counters;
+        }
+    }
+    // Claims of destroyed collectors won't be looked up again
+    claims.erase(std::remove_if(claims.begin(), claims.end(), [](Claims::Claim const& c) { return c.slots.expired(); }), claims.end());
+    for (size_t i=0; i<slots->claimed.size(); i++) {
+        bool expected = false;
+        if (slots->claimed[i].load(std::memory_order_relaxed) or
+            not slots->claimed[i].compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+            continue;
+        }
+        ThreadCounters* counters = slots->counters[i].load(std::memory_order_relaxed);
+        if (not counters) {
+            void* memory = nullptr;
+            if (posix_memalign(&memory, alignof(ThreadCounters), sizeof(ThreadCounters)) != 0) {
+                slots->claimed[i].store(false, std::memory_order_release);
+                throw std::bad_alloc();
+            }
+            counters = new (memory) ThreadCounters();
+            slots->counters[i].store(counters, std::memory_order_release);
+            slots->num_counters++;
+        }
+        claims.push_back({id, slots, static_cast<int>(i), counters});
+        return *counters;
+    }
+    throw std::runtime_error("Too many threads count into the same Collector at the same time.");
+}
+
+Snapshot Collector::get_snapshot() const {
+    Snapshot snapshot;
+    for (auto const& c : slots->counters) {
+        // Counters are published after their slot is claimed, a thread that just started counting may still be missing
+        ThreadCounters const* t = c.load(std::memory_order_acquire);
+        if (t) {
+            t->add_to(snapshot);
+        }
+    }
+    return snapshot;
+}
+
+int Collector::get_threads() const {
+    return slots->num_counters.load();
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Outcome statistics of many games, counted per thread without locks and merged on demand
+namespace Stats {
+
+static const int max_level = 11; // Matadors of a clubs game
+static const int max_points = 120;
+static const int tricks_per_round = 10;
+
+// All counters live in one flat array, these are the offsets of the tables and their shapes
+namespace Layout {
+static const size_t games = 0;
+static const size_t rounds = 1;
+static const size_t passed_rounds = 2; // Skat rounds in which all players passed, they count as played
+static const size_t game_winners = 3; // [seat]
+static const size_t aborts = game_winners + 3; // Games ended by an illegal card [seat]
+static const size_t declarer_rounds = aborts + 3; // [seat][level][won]
+static const size_t declarer_points = declarer_rounds + 3*(max_level + 1)*2; // Card points of the declarer [points]
+static const size_t trick_winners = declarer_points + max_points + 1; // [lead card id][position of the winner in the trick]
+static const size_t card_plays = trick_winners + 32*3; // [trick][card id]
+static const size_t size = card_plays + tricks_per_round*32;
+} // namespace Layout
+
+// Merged counters, snapshots of several collectors or processes add up
+struct Snapshot {
+    std::vector<uint64_t> counts = std::vector<uint64_t>(Layout::size, 0);
+    Snapshot& operator+=(Snapshot const& other);
+    uint64_t get_games() const { return counts[Layout::games]; }
+    uint64_t get_rounds() const { return counts[Layout::rounds]; }
+    uint64_t get_passed_rounds() const { return counts[Layout::passed_rounds]; }
+    uint64_t get_declarer_rounds(int const seat, int const level, bool const won) const { return counts[Layout::declarer_rounds + (seat*(max_level + 1) + level)*2 + won]; }
+    double get_declarer_win_rate(int const seat) const; // Over all levels, NaN without rounds
+    double get_abort_rate() const; // Fraction of games ended by an illegal card
+};
+
+// Counters written by a single thread. Writers increment with plain relaxed loads and stores, readers may load at any time.
+// Blocks are cache-line aligned, so threads never write to the same line.
+class alignas(64) ThreadCounters {
+    public:
+        ThreadCounters();
+        void count_game(int const winner) { add(Layout::games); add(Layout::game_winners + winner); }
+        void count_abort(int const seat) { add(Layout::games); add(Layout::aborts + seat); }
+        void count_round(int const declarer, int const level, int const declarer_points, bool const won);
+        void count_passed_round() { add(Layout::passed_rounds); }
+        void count_trick(int const lead_card, int const winner_position) { add(Layout::trick_winners + 3*lead_card + winner_position); }
+        void count_play(int const trick, int const card) { add(Layout::card_plays + 32*trick + card); }
+        void add_to(Snapshot& snapshot) const;
+    private:
+        std::array<std::atomic<uint64_t>, Layout::size> counts;
+        void add(size_t const idx) {
+            // Only the owning thread writes, so no atomic read-modify-write is needed
+            counts[idx].store(counts[idx].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        }
+};
+
+// Shared by games on any number of threads, each thread gets its own counters on first use. A thread hands its
+// counters back when it exits and a later thread keeps counting into them, max_threads bounds the threads counting
+// at the same time.
+class Collector {
+    public:
+        Collector(int const max_threads = 1024);
+        Collector(Collector const&) = delete;
+        Collector& operator=(Collector const&) = delete;
+        ThreadCounters& local();
+        // Sums the counters of all threads, may run while games are counting
+        Snapshot get_snapshot() const;
+        // Counter blocks handed out so far, at most the number of threads that counted at the same time
+        int get_threads() const;
+    private:
+        struct Slots;
+        uint64_t const id; // Unique over the process lifetime, threads cache their counters by it
+        std::shared_ptr<Slots> slots; // Threads keep weak references to release their slot on exit
+};
+
+} // namespace Stats
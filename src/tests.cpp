@@ -1,10 +1,32 @@
 #include <gtest/gtest.h>
+#include <chrono>
 #include <cmath>
+#include <cstring>
+#include <fstream>
+#include <numeric>
+#include <thread>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 #include <boost/log/trivial.hpp>
 #include <boost/log/core.hpp>
 #include <boost/log/expressions.hpp>
 #include "cards.hpp"
 #include "halfskat.hpp"
+#include "bots.hpp"
+#include "dataset.hpp"
+#include "differential.hpp"
+#include "handstrength.hpp"
+#include "leadbook.hpp"
+#include "pipeline.hpp"
+#include "policycache.hpp"
+#include "policygradient.hpp"
+#include "scenario.hpp"
+#include "serialization.hpp"
+#include "stats.hpp"
+#include "tournament.hpp"
 #include "tests.hpp"
 
 namespace logging = boost::log;
@@ -97,6 +119,20 @@ TEST(CardsTest, MultiHotWorks) {
     ASSERT_EQ(multihot.at(idx3), true);
 }
 
+TEST(CardsTest, CardMasksWork) {
+    for (size_t i=0; i<AllCards.size(); i++) {
+        ASSERT_EQ(get_card_id(AllCards[i]), i);
+    }
+    std::vector<Card> const cards = {{Clubs, Jack}, {Hearts, Ten}, {Diamonds, Nine}, {Diamonds, Ace}, {Spades, King}, {Hearts, Queen}};
+    CardMask const mask = get_card_mask(cards);
+    ASSERT_EQ(count_cards(mask), cards.size());
+    ASSERT_EQ(get_card_points(mask), get_card_points(cards));
+    ASSERT_EQ(get_multi_hot(mask), get_multi_hot(cards));
+    ASSERT_EQ(get_card_mask(get_cards_from_mask(mask)), mask);
+    ASSERT_TRUE(in_mask(mask, Card(Hearts, Ten)));
+    ASSERT_FALSE(in_mask(mask, Card(Hearts, Nine)));
+}
+
 TEST(HalfSkatTest, RandomGameLegalActions) {
     Game game;
     std::vector<Card> cards = {{Clubs, Jack}, {Hearts, Ten}, {Diamonds, Nine}, {Clubs, Ten}, {Spades, King}};
@@ -116,7 +152,7 @@ TEST(HalfSkatTest, RandomGameLegalActions) {
     legals = game.get_legal_cards(cards);  
     Card trick_card = game.get_trick()[0];
     bool need_trump;
-    if ((trick_card.rank == Jack) or (trick_card.color == game.trump)) {
+    if ((trick_card.rank == Jack) or (trick_card.color == Clubs)) {
         need_trump = true;
     }
     else {
@@ -125,7 +161,7 @@ TEST(HalfSkatTest, RandomGameLegalActions) {
     bool is_correct = false;
     for (auto l : legals) {
         if (need_trump) {
-            is_correct = ((l.rank == Jack) or (l.color == game.trump));
+            is_correct = ((l.rank == Jack) or (l.color == Clubs));
         }
         else {
             is_correct = (trick_card.color == l.color);
@@ -134,6 +170,20 @@ TEST(HalfSkatTest, RandomGameLegalActions) {
     }
 }
 
+// Jacks are trumps, so the jack of the led color doesn't follow suit (the original rules engine let it follow)
+TEST(HalfSkatTest, JacksDontFollowTheirColor) {
+    Game game;
+    Trick trick;
+    trick.push_back(Card(Spades, Seven));
+    std::vector<Card> const hand = {{Spades, Jack}, {Spades, Ace}, {Hearts, Seven}};
+    ASSERT_EQ(game.get_legal_cards(hand, trick), std::vector<Card>({{Spades, Ace}}));
+    std::vector<Card> const only_jack = {{Spades, Jack}, {Hearts, Seven}};
+    ASSERT_EQ(game.get_legal_cards(only_jack, trick), only_jack); // Void in spades
+    trick.clear();
+    trick.push_back(Card(Diamonds, Jack));
+    ASSERT_EQ(game.get_legal_cards(only_jack, trick), std::vector<Card>({{Spades, Jack}}));
+}
+
 TEST(HalfSkatTest, RandomGameTricksWork) {
     Game game(1000, true);
     int initial_round = game.get_round();
@@ -158,6 +208,40 @@ TEST(HalfSkatTest, RandomGameWholeGame) {
     ASSERT_EQ(game.get_round(), game.get_max_rounds()+1);
 }
 
+// Plays the first legal card, hence always respects the mask
+class FirstLegalPlayer : public Player {
+    public:
+        Card query_policy() override {
+            for (auto const& c : m_cards) {
+                if (in_mask(m_last_state.legal_cards, c)) {
+                    return c;
+                }
+            }
+            throw std::runtime_error("No legal card");
+        }
+};
+
+TEST(HalfSkatTest, LegalMaskMatchesLegalCards) {
+    auto first = std::make_shared<FirstLegalPlayer>();
+    auto second = std::make_shared<FirstLegalPlayer>();
+    auto third = std::make_shared<FirstLegalPlayer>();
+    Game game(first, second, third, 10, false, true);
+    for (int i=0; i<30; i++) {
+        game.step_by_trick();
+        ASSERT_EQ(game.get_state(), ongoing);
+    }
+    for (auto const& t : first->get_transitions()) {
+        PlayerState const& s = t.before;
+        ASSERT_EQ(s.legal_cards, get_card_mask(game.get_legal_cards(get_cards_from_mask(s.hole_cards), s.trick)));
+        ASSERT_TRUE(in_mask(s.legal_cards, t.action));
+    }
+}
+
+TEST(HalfSkatTest, RandomIgnoresMaskWhenLegalExpected) {
+    Game game(1000, false, true);
+    ASSERT_THROW(for (int i=0; i<300; i++) game.step_by_trick(), std::runtime_error);
+}
+
 TEST(HalfSkatTest, RandomNoPlayerBias) {
     constexpr int n = 1e3;
     std::array<int, 3> games_won = {{-n/3, -n/3, -n/3}};
@@ -177,6 +261,1094 @@ TEST(HalfSkatTest, RandomNoPlayerBias) {
     EXPECT_GE(games_won[2], -2*expected_sigma);
 }
 
+TEST(VariantTest, RuleTablesFollowGameTypes) {
+    std::vector<Card> trick = {{Hearts, Ace}, {Hearts, Ten}, {Clubs, Seven}};
+    ASSERT_EQ(Rules<clubs_game>::get_winner_index(trick), 2);
+    ASSERT_EQ(Rules<spades_game>::get_winner_index(trick), 0);
+    trick = {{Spades, Ace}, {Diamonds, Jack}, {Spades, Ten}};
+    ASSERT_EQ(Rules<grand_game>::get_winner_index(trick), 1);
+    ASSERT_EQ(Rules<null_game>::get_winner_index(trick), 0);
+    trick = {{Hearts, Ten}, {Hearts, Jack}, {Hearts, Nine}};
+    ASSERT_EQ(Rules<null_game>::get_winner_index(trick), 1); // Jack ranks above ten in null
+    CardMask const hand = get_card_mask({{Hearts, Jack}, {Clubs, Jack}, {Clubs, Ace}});
+    ASSERT_EQ(Rules<null_game>::get_legal_mask(hand, {Hearts, Seven}), get_card_bit({Hearts, Jack}));
+    ASSERT_EQ(Rules<grand_game>::get_legal_mask(hand, {Spades, Jack}), get_card_mask({{Hearts, Jack}, {Clubs, Jack}}));
+    ASSERT_EQ(Rules<hearts_game>::get_legal_mask(hand, {Clubs, Seven}), get_card_bit({Clubs, Ace}));
+    ASSERT_EQ(Rules<clubs_game>::get_matadors(hand), 1);
+    ASSERT_EQ(Rules<grand_game>::get_matadors(get_card_bit({Diamonds, Jack})), 3); // Without three
+    ASSERT_EQ(Rules<null_game>::get_matadors(hand), 0);
+}
+
+// Smears with a fixed bid limit and always declares grand
+class GrandBidder : public SmearPlayer {
+    public:
+        GrandBidder(int const limit) : limit(limit) {}
+        int query_bid_limit() override { return limit; }
+        Contract query_contract(bool const hand) override { return Contract(grand_game, hand); }
+        int limit;
+};
+
+TEST(VariantTest, SkatGameRunsAuction) {
+    std::array<std::shared_ptr<Player>, 3> players = {{std::make_shared<GrandBidder>(35), std::make_shared<GrandBidder>(30), std::make_shared<GrandBidder>(40)}};
+    SkatGame game(players[0], players[1], players[2], 10, false, true);
+    // Dealer 0: forehand 1 holds to 30, middlehand 2 takes over with 33, rearhand 0 bids 35 and middlehand holds
+    game.deal_round(get_full_shuffled_deck(), 0, 0);
+    game.step_by_trick();
+    ASSERT_EQ(game.get_observable_state().declarer, 2);
+    ASSERT_EQ(game.get_bid(), 35);
+    ASSERT_EQ(game.get_contract(), Contract(grand_game));
+    ASSERT_EQ(players[2]->get_cards().size(), 10); // Picked up and put away the Skat
+    ASSERT_EQ(game.get_trick().size(), 1);
+    game.step_by_round();
+    std::array<int, 3> const points = game.get_points();
+    ASSERT_EQ(points[0], 0);
+    ASSERT_EQ(points[1], 0);
+    ASSERT_NE(points[2], 0);
+    ASSERT_EQ(std::abs(points[2]) % 24, 0);
+}
+
+TEST(VariantTest, SkatGamePlaysToTheEnd) {
+    SkatGame game(std::make_shared<SmearPlayer>(), std::make_shared<TrumpPullingPlayer>(), std::make_shared<HighestCardPlayer>(), 200, false, true);
+    auto collector = std::make_shared<Stats::Collector>();
+    game.set_stats(collector);
+    game.run_new_game();
+    ASSERT_EQ(game.get_state(), finished);
+    std::array<int, 3> const points = game.get_points();
+    ASSERT_NE(std::abs(points[0]) + std::abs(points[1]) + std::abs(points[2]), 0);
+    // Passed rounds are used up like played ones
+    Stats::Snapshot const snapshot = collector->get_snapshot();
+    ASSERT_EQ(snapshot.get_rounds() + snapshot.get_passed_rounds(), 201);
+    // Records can't hold the contract
+    std::string const path = testing::TempDir() + "pyskat_skat_record_test.bin";
+    ASSERT_THROW(game.set_recorder(std::make_shared<Dataset::RecordWriter>(path)), std::runtime_error);
+    std::remove(path.c_str());
+}
+
+TEST(BotsTest, BotsRespectLegalMask) {
+    Game game(std::make_shared<HighestCardPlayer>(), std::make_shared<TrumpPullingPlayer>(), std::make_shared<WeightedHeuristicPlayer>(), 100, false, true);
+    game.run_new_game();
+    ASSERT_EQ(game.get_state(), finished);
+    Game other(std::make_shared<SmearPlayer>(), std::make_shared<SmearPlayer>(), std::make_shared<HighestCardPlayer>(), 100, false, true);
+    other.run_new_game();
+    ASSERT_EQ(other.get_state(), finished);
+}
+
+TEST(BotsTest, BotsBeatRandomPlayers) {
+    std::array<std::shared_ptr<Player>, 4> bots = {{std::make_shared<HighestCardPlayer>(), std::make_shared<SmearPlayer>(),
+        std::make_shared<TrumpPullingPlayer>(), std::make_shared<WeightedHeuristicPlayer>()}};
+    for (auto const& bot : bots) {
+        Game game(bot, std::make_shared<RandomPlayer>(), std::make_shared<RandomPlayer>(), 999, true);
+        game.run_new_game();
+        EXPECT_EQ(game.get_game_winner(), 0);
+        bot->clear_transitions();
+    }
+}
+
+TEST(BotsTest, CardStrengthFollowsTrickRules) {
+    Trick trick;
+    trick.push_back({Hearts, Ten});
+    ASSERT_GT(get_card_strength({Hearts, Ace}, trick), get_card_strength({Hearts, Ten}, trick));
+    ASSERT_EQ(get_card_strength({Spades, Ace}, trick), 0); // Doesn't follow suit
+    ASSERT_GT(get_card_strength({Clubs, Seven}, trick), get_card_strength({Hearts, Ace}, trick)); // Trump
+    ASSERT_GT(get_card_strength({Diamonds, Jack}, trick), get_card_strength({Clubs, Ace}, trick));
+    ASSERT_GT(get_card_strength({Clubs, Jack}, trick), get_card_strength({Spades, Jack}, trick));
+    trick.push_back({Diamonds, Jack});
+    trick.push_back({Hearts, Ace});
+    ASSERT_EQ(get_leading_index(trick), 1);
+    // Trumps and order follow the contract
+    Contract const hearts(hearts_game);
+    ASSERT_EQ(get_leading_index(trick, hearts), 1);
+    trick.clear();
+    trick.push_back({Clubs, Ace});
+    ASSERT_GT(get_card_strength({Hearts, Seven}, trick, hearts), get_card_strength({Clubs, Ace}, trick, hearts));
+    ASSERT_EQ(get_card_strength({Spades, Jack}, trick, Contract(null_game)), 0);
+    ASSERT_LT(get_card_strength({Clubs, Jack}, trick, Contract(null_game)), get_card_strength({Clubs, Ace}, trick, Contract(null_game)));
+    ASSERT_GT(get_card_strength({Spades, Jack}, trick, Contract(grand_game)), get_card_strength({Clubs, Ace}, trick, Contract(grand_game)));
+    trick.push_back({Hearts, Seven});
+    ASSERT_EQ(get_leading_index(trick, hearts), 1);
+    ASSERT_EQ(get_leading_index(trick), 0);
+}
+
+TEST(TournamentTest, SeatingsCoverAllSeats) {
+    auto const seatings = Tournament::get_seatings(4, Tournament::round_robin);
+    ASSERT_EQ(seatings.size(), 4*3);
+    std::array<std::array<int, 3>, 4> seat_counts = {};
+    for (auto const& s : seatings) {
+        for (size_t i=0; i<3; i++) {
+            seat_counts[s[i]][i]++;
+        }
+    }
+    for (auto const& c : seat_counts) {
+        ASSERT_EQ(c[0], 3);
+        ASSERT_EQ(c[1], 3);
+        ASSERT_EQ(c[2], 3);
+    }
+    for (auto const& s : Tournament::get_seatings(3, Tournament::gauntlet)) {
+        ASSERT_EQ(std::count(s.begin(), s.end(), 0), 1);
+    }
+}
+
+TEST(TournamentTest, RoundRobinRatesBotsAboveRandom) {
+    std::vector<Tournament::Entrant> roster = {
+        {"random", []() { return std::make_shared<RandomPlayer>(); }},
+        {"highest", []() { return std::make_shared<HighestCardPlayer>(); }},
+        {"trump", []() { return std::make_shared<TrumpPullingPlayer>(); }}};
+    Tournament::Settings settings;
+    settings.rounds_per_match = 50;
+    ASSERT_THROW(Tournament::run(roster, settings), std::runtime_error); // Seats wouldn't declare equally often
+    settings.rounds_per_match = 51;
+    settings.max_matches = 60;
+    settings.threads = 4;
+    Tournament::Result const result = Tournament::run(roster, settings);
+    ASSERT_EQ(result.matches, 60);
+    ASSERT_EQ(result.rounds[0], 60*51);
+    ASSERT_EQ(result.pairs[0][1].wins, result.pairs[1][0].losses);
+    ASSERT_EQ(result.pairs[1][2].draws, result.pairs[2][1].draws);
+    EXPECT_NEAR(result.elo[0] + result.elo[1] + result.elo[2], 0., 1e-6);
+    EXPECT_LT(result.elo[0], result.elo[1]);
+    EXPECT_LT(result.elo[0], result.elo[2]);
+    EXPECT_GT(result.elo_error[0], 0.);
+}
+
+TEST(TournamentTest, SprtStopsEarly) {
+    std::vector<Tournament::Entrant> roster = {
+        {"smear", []() { return std::make_shared<SmearPlayer>(); }},
+        {"random", []() { return std::make_shared<RandomPlayer>(); }}};
+    Tournament::Settings settings;
+    settings.schedule = Tournament::gauntlet;
+    settings.rounds_per_match = 21;
+    settings.max_matches = 10000;
+    settings.threads = 2;
+    settings.sprt = true;
+    settings.elo0 = -10.;
+    settings.elo1 = 10.;
+    settings.alpha = 0.01;
+    settings.beta = 0.01;
+    Tournament::Result const result = Tournament::run(roster, settings);
+    ASSERT_EQ(result.sprt, Tournament::sprt_accept_h1);
+    ASSERT_GE(result.llr, result.llr_upper);
+    ASSERT_LT(result.matches, settings.max_matches);
+}
+
+TEST(TournamentTest, SprtKeepsErrorRateForEqualEntrants) {
+    std::vector<Tournament::Entrant> roster = {
+        {"random", []() { return std::make_shared<RandomPlayer>(); }},
+        {"random too", []() { return std::make_shared<RandomPlayer>(); }}};
+    Tournament::Settings settings;
+    settings.schedule = Tournament::gauntlet;
+    settings.rounds_per_match = 3;
+    settings.max_matches = 100000;
+    settings.threads = 1;
+    settings.sprt = true;
+    settings.elo0 = 0.;
+    settings.elo1 = 100.;
+    int const runs = 400;
+    int false_positives = 0;
+    for (int r=0; r<runs; r++) {
+        Tournament::Result const result = Tournament::run(roster, settings);
+        ASSERT_NE(result.sprt, Tournament::sprt_running);
+        ASSERT_EQ(result.first_against_field.samples, result.matches);
+        if (result.sprt == Tournament::sprt_accept_h1) {
+            false_positives++;
+        }
+    }
+    // Expected are alpha * runs = 20 with a standard deviation of 4.4
+    EXPECT_LT(false_positives, 36);
+}
+
+TEST(TournamentTest, DuplicateSeatingsArePermutations) {
+    auto const seatings = Tournament::get_duplicate_seatings(2);
+    ASSERT_EQ(seatings.size(), 6);
+    std::array<std::array<int, 3>, 2> seat_counts = {};
+    for (auto const& s : seatings) {
+        for (size_t i=0; i<3; i++) {
+            seat_counts[s[i]][i]++;
+        }
+    }
+    for (auto const& c : seat_counts) {
+        ASSERT_EQ(c[0], 3);
+        ASSERT_EQ(c[1], 3);
+        ASSERT_EQ(c[2], 3);
+    }
+    ASSERT_EQ(Tournament::get_duplicate_seatings(3).size(), 6);
+}
+
+TEST(TournamentTest, DuplicateCancelsCardLuck) {
+    // Identical deterministic players get identical results on every deal
+    std::vector<Tournament::Entrant> mirror = {
+        {"smear", []() { return std::make_shared<SmearPlayer>(); }},
+        {"smear too", []() { return std::make_shared<SmearPlayer>(); }}};
+    Tournament::DuplicateSettings settings;
+    settings.deals = 200;
+    settings.threads = 4;
+    settings.seed = 42;
+    Tournament::DuplicateResult const result = Tournament::run_duplicate(mirror, settings);
+    ASSERT_EQ(result.deals, 200);
+    ASSERT_EQ(result.mean_difference[0][1], 0.);
+    ASSERT_EQ(result.difference_error[0][1], 0.);
+    // Same seed plays the same deals
+    ASSERT_EQ(Tournament::run_duplicate(mirror, settings).deal_scores, result.deal_scores);
+    std::vector<Tournament::Entrant> roster = {
+        {"trump", []() { return std::make_shared<TrumpPullingPlayer>(); }},
+        {"random", []() { return std::make_shared<RandomPlayer>(); }}};
+    Tournament::DuplicateResult const versus = Tournament::run_duplicate(roster, settings);
+    EXPECT_GT(versus.mean_difference[0][1], 0.);
+    EXPECT_EQ(versus.mean_difference[0][1], -versus.mean_difference[1][0]);
+}
+
+TEST(TournamentTest, DuplicateDealsArePortable) {
+    std::vector<Card> deck;
+    int declarer, dealer;
+    Tournament::get_duplicate_deal(42, 7, deck, declarer, dealer);
+    std::vector<int> ids;
+    for (auto const& c : deck) {
+        ids.push_back(get_card_id(c));
+    }
+    std::vector<int> const expected = {29, 24, 2, 1, 6, 4, 30, 7, 19, 14, 11, 31, 27, 28, 18, 8,
+                                       0, 26, 5, 12, 15, 3, 17, 16, 13, 23, 22, 10, 20, 9, 25, 21};
+    ASSERT_EQ(ids, expected);
+    ASSERT_EQ(declarer, 2);
+    ASSERT_EQ(dealer, 0);
+}
+
+TEST(TournamentTest, DuplicateCountsAbortsByEntrant) {
+    // Random players ignore the legal card mask
+    std::vector<Tournament::Entrant> roster = {
+        {"smear", []() { return std::make_shared<SmearPlayer>(); }},
+        {"random", []() { return std::make_shared<RandomPlayer>(); }}};
+    Tournament::DuplicateSettings settings;
+    settings.deals = 100;
+    settings.threads = 2;
+    settings.retry_on_illegal_action = false;
+    Tournament::DuplicateResult const result = Tournament::run_duplicate(roster, settings);
+    ASSERT_EQ(result.aborts.size(), 2);
+    ASSERT_EQ(result.aborts[0], 0);
+    ASSERT_GT(result.aborts[1], 0);
+    ASSERT_EQ(result.aborted_deals, result.aborts[1]);
+    ASSERT_EQ(result.deals + result.aborted_deals, 100);
+}
+
+TEST(DatasetTest, RecordedRoundsReplay) {
+    std::string const path = testing::TempDir() + "pyskat_dataset_test.bin";
+    std::remove(path.c_str());
+    constexpr int rounds = 20;
+    {
+        auto writer = std::make_shared<Dataset::RecordWriter>(path);
+        Game game(rounds-1, true);
+        game.set_recorder(writer);
+        game.run_new_game();
+        ASSERT_EQ(writer->get_written(), rounds);
+    }
+    Dataset::RecordFile file(path);
+    ASSERT_EQ(file.size(), rounds);
+    std::vector<size_t> indices = {3, 0, 19};
+    size_t const rows = indices.size() * Dataset::decisions_per_round;
+    std::vector<float> states(rows*Dataset::state_size), actions(rows*32), returns(rows), masks(rows*32);
+    Dataset::decode_rounds(file, indices, states.data(), actions.data(), returns.data(), masks.data());
+    for (size_t row=0; row<rows; row++) {
+        float const* state = &states[row*Dataset::state_size];
+        int const hand_size = std::count(state, state+32, 1.f);
+        ASSERT_EQ(hand_size, cards_per_player - (row % Dataset::decisions_per_round)/3);
+        ASSERT_EQ(std::count(&actions[row*32], &actions[row*32]+32, 1.f), 1);
+        int const action = std::distance(&actions[row*32], std::find(&actions[row*32], &actions[row*32]+32, 1.f));
+        ASSERT_EQ(state[action], 1.f); // Played card was held
+        ASSERT_EQ(masks[row*32 + action], 1.f); // Played card was legal
+        ASSERT_TRUE((returns[row] == 1.f) or (returns[row] == -1.f));
+    }
+    std::remove(path.c_str());
+}
+
+TEST(HandStrengthTest, CanonicalHandsIgnoreSuitOrder) {
+    CardMask const hand = get_card_mask({{Clubs, Jack}, {Diamonds, Jack}, {Clubs, Ace}, {Spades, Ten}, {Hearts, Ace},
+        {Hearts, King}, {Diamonds, Seven}, {Diamonds, Eight}, {Diamonds, Nine}, {Diamonds, Queen}});
+    // Swap hearts and diamonds, jacks stay
+    CardMask const swapped = get_card_mask({{Clubs, Jack}, {Diamonds, Jack}, {Clubs, Ace}, {Spades, Ten}, {Diamonds, Ace},
+        {Diamonds, King}, {Hearts, Seven}, {Hearts, Eight}, {Hearts, Nine}, {Hearts, Queen}});
+    CardMask const canonical = HandStrength::canonicalize(hand);
+    ASSERT_EQ(HandStrength::canonicalize(swapped), canonical);
+    ASSERT_EQ(HandStrength::canonicalize(canonical), canonical);
+    ASSERT_EQ(count_cards(canonical), 10);
+    ASSERT_EQ(canonical & (0xff | jacks_mask), hand & (0xff | jacks_mask));
+}
+
+TEST(HandStrengthTest, TableFindsEvaluatedHands) {
+    std::string const path = testing::TempDir() + "pyskat_hand_table_test.bin";
+    CardMask const strong = get_card_mask({{Clubs, Jack}, {Spades, Jack}, {Hearts, Jack}, {Diamonds, Jack}, {Clubs, Ace},
+        {Clubs, Ten}, {Clubs, King}, {Clubs, Queen}, {Spades, Ace}, {Hearts, Ace}});
+    CardMask const weak = get_card_mask({{Spades, Seven}, {Spades, Eight}, {Spades, Nine}, {Hearts, Seven}, {Hearts, Eight},
+        {Hearts, Nine}, {Diamonds, Seven}, {Diamonds, Eight}, {Diamonds, Nine}, {Diamonds, Queen}});
+    HandStrength::Settings settings;
+    settings.hands = {strong, weak};
+    settings.deals_per_hand = 50;
+    settings.threads = 2;
+    settings.seed = 7;
+    HandStrength::build_table(path, settings);
+    HandStrength::Table table(path);
+    ASSERT_EQ(table.size(), 2);
+    ASSERT_EQ(table.get_deals_per_hand(), 50);
+    HandStrength::Entry const* s = table.find(strong);
+    HandStrength::Entry const* w = table.find(weak);
+    ASSERT_NE(s, nullptr);
+    ASSERT_NE(w, nullptr);
+    EXPECT_GT(s->win_rate, 0.9f);
+    EXPECT_LT(w->win_rate, 0.1f);
+    EXPECT_GT(s->expected_score, w->expected_score);
+    EXPECT_GT(s->expected_value, 0.f);
+    ASSERT_EQ(table.find(get_card_mask({{Spades, Seven}, {Spades, Eight}, {Spades, Nine}, {Hearts, Seven}, {Hearts, Eight},
+        {Hearts, Nine}, {Diamonds, Seven}, {Diamonds, Eight}, {Diamonds, Nine}, {Hearts, Queen}})), w); // Same hand up to suit order
+    ASSERT_EQ(table.find(strong ^ get_card_mask({{Hearts, Ace}, {Hearts, Ten}})), nullptr);
+    // Corrupt copies: more entries than slots, and slots without an empty one
+    std::ifstream in(path, std::ios::binary);
+    std::string const data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    size_t const header = 24;
+    std::string overfull = data;
+    uint32_t const num_entries = (data.size() - header) / sizeof(HandStrength::Entry);
+    std::memcpy(&overfull[header - sizeof(num_entries)], &num_entries, sizeof(num_entries));
+    std::string no_empty_slot = data;
+    for (size_t offset=header; offset<data.size(); offset+=sizeof(HandStrength::Entry)) {
+        CardMask hand;
+        std::memcpy(&hand, &data[offset], sizeof(hand));
+        if (hand == 0) {
+            hand = 0x3ff; // Matches neither lookup below
+            std::memcpy(&no_empty_slot[offset], &hand, sizeof(hand));
+        }
+    }
+    std::ofstream(path, std::ios::binary | std::ios::trunc) << overfull;
+    ASSERT_THROW(HandStrength::Table{path}, std::runtime_error);
+    std::ofstream(path, std::ios::binary | std::ios::trunc) << no_empty_slot;
+    HandStrength::Table full(path);
+    ASSERT_NE(full.find(strong), nullptr);
+    ASSERT_EQ(full.find(strong ^ get_card_mask({{Hearts, Ace}, {Hearts, Ten}})), nullptr);
+    std::remove(path.c_str());
+}
+
+TEST(PipelineTest, ActorsStreamToLearner) {
+    std::string const name = "pyskat_pipeline_test_" + std::to_string(getpid());
+    Pipeline::Config config;
+    config.max_actors = 2;
+    config.ring_slots = 4;
+    config.slot_size = 64;
+    config.weights_capacity = 1024;
+    Pipeline::Learner learner(name, config);
+    Pipeline::Actor first(name);
+    Pipeline::Actor second(name);
+    ASSERT_THROW(Pipeline::Actor third(name), std::runtime_error);
+    ASSERT_THROW(first.try_push(std::string(64, 'x')), std::runtime_error);
+    for (int i=0; i<4; i++) {
+        ASSERT_TRUE(first.try_push("a" + std::to_string(i)));
+    }
+    ASSERT_FALSE(first.try_push("a4")); // Ring full
+    ASSERT_FALSE(first.push("a4", 0.01));
+    ASSERT_TRUE(second.push("b0"));
+    std::vector<std::string> messages = learner.pop(3);
+    ASSERT_EQ(messages, std::vector<std::string>({"a0", "b0", "a1"})); // Actors take turns
+    // Blocked actor continues once the learner catches up
+    std::thread producer([&]() {
+        for (int i=4; i<20; i++) {
+            ASSERT_TRUE(first.push("a" + std::to_string(i)));
+        }
+    });
+    std::vector<std::string> received;
+    auto const deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while ((received.size() < 18) and (std::chrono::steady_clock::now() < deadline)) {
+        for (auto const& m : learner.pop_wait(5, 1.)) {
+            received.push_back(m);
+        }
+    }
+    if (received.size() < 18) {
+        learner.close(); // Lets the producer give up
+    }
+    producer.join();
+    ASSERT_EQ(received.size(), 18);
+    for (int i=0; i<18; i++) {
+        ASSERT_EQ(received[i], "a" + std::to_string(i+2));
+    }
+    std::vector<Pipeline::ActorStats> const stats = learner.get_stats();
+    ASSERT_EQ(stats.size(), 2);
+    ASSERT_EQ(stats[0].pushed, 20);
+    ASSERT_EQ(stats[0].popped, 20);
+    ASSERT_GT(stats[0].full_waits, 0);
+    ASSERT_EQ(stats[1].pushed, 1);
+    // Weights flow back
+    std::string weights;
+    ASSERT_FALSE(second.poll_weights(weights));
+    learner.publish_weights(std::string(1000, 'w'));
+    ASSERT_TRUE(second.poll_weights(weights));
+    ASSERT_EQ(weights, std::string(1000, 'w'));
+    ASSERT_EQ(second.get_weights_version(), 1);
+    ASSERT_FALSE(second.poll_weights(weights));
+    ASSERT_THROW(learner.publish_weights(std::string(1025, 'w')), std::runtime_error);
+    learner.close();
+    ASSERT_TRUE(first.is_closed());
+    ASSERT_FALSE(first.try_push("c"));
+    ASSERT_FALSE(first.push("c")); // Doesn't wait for a closed learner
+    ASSERT_TRUE(learner.pop(1).empty());
+}
+
+TEST(PipelineTest, RingsOfDeadActorsAreReclaimed) {
+    std::string const name = "pyskat_pipeline_reclaim_test_" + std::to_string(getpid());
+    Pipeline::Config config;
+    config.max_actors = 1;
+    config.ring_slots = 4;
+    config.slot_size = 64;
+    config.weights_capacity = 1024;
+    Pipeline::Learner learner(name, config);
+    pid_t const child = fork();
+    ASSERT_GE(child, 0);
+    if (child == 0) {
+        // Crashes while holding the ring, without running any destructors
+        Pipeline::Actor* actor = new Pipeline::Actor(name);
+        actor->try_push("left behind");
+        _exit(0);
+    }
+    int status = 0;
+    ASSERT_EQ(waitpid(child, &status, 0), child);
+    Pipeline::Actor replacement(name);
+    ASSERT_EQ(replacement.get_index(), 0);
+    ASSERT_THROW(Pipeline::Actor other(name), std::runtime_error); // Owner is alive
+    ASSERT_TRUE(replacement.try_push("new"));
+    ASSERT_EQ(learner.pop(2), std::vector<std::string>({"left behind", "new"}));
+}
+
+TEST(PipelineTest, LearnerSkipsMalformedMessages) {
+    std::string const name = "pyskat_pipeline_malformed_test_" + std::to_string(getpid());
+    Pipeline::Config config;
+    config.max_actors = 1;
+    config.ring_slots = 4;
+    config.slot_size = 64;
+    config.weights_capacity = 1024;
+    Pipeline::Learner learner(name, config);
+    Pipeline::Actor actor(name);
+    std::string const marker = "length to be corrupted";
+    ASSERT_TRUE(actor.try_push(marker));
+    ASSERT_TRUE(actor.try_push("intact"));
+    // Overwrite the length of the first message in the shared memory like a broken actor would
+    int const fd = shm_open(("/" + name).c_str(), O_RDWR, 0600);
+    ASSERT_GE(fd, 0);
+    struct stat st;
+    ASSERT_EQ(fstat(fd, &st), 0);
+    void* data = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    ASSERT_NE(data, MAP_FAILED);
+    char* const begin = static_cast<char*>(data);
+    char* const found = std::search(begin, begin + st.st_size, marker.begin(), marker.end());
+    ASSERT_NE(found, begin + st.st_size);
+    uint32_t const length = 1u << 30;
+    std::memcpy(found - sizeof(length), &length, sizeof(length));
+    munmap(data, st.st_size);
+    ASSERT_EQ(learner.pop(2), std::vector<std::string>({"intact"}));
+    std::vector<Pipeline::ActorStats> const stats = learner.get_stats();
+    ASSERT_EQ(stats.size(), 1);
+    ASSERT_EQ(stats[0].malformed, 1);
+    ASSERT_EQ(stats[0].popped, 2);
+}
+
+TEST(PolicyGradientTest, GradientsMatchFiniteDifferences) {
+    PolicyGradient::Network network({Dataset::state_size, 8, 32}, 3);
+    std::mt19937 engine(5);
+    std::bernoulli_distribution bit(0.2);
+    std::vector<float> states(4*Dataset::state_size);
+    for (auto& x : states) {
+        x = bit(engine) ? 1.f : 0.f;
+    }
+    std::vector<uint8_t> const actions = {0, 5, 17, 31};
+    std::vector<float> const advantages = {1.f, -1.f, 0.5f, 2.f};
+    std::vector<CardMask> const legal = {0x21, 0xffff, 0x00020001, 0x80000100};
+    PolicyGradient::Batch batch;
+    batch.states = states.data();
+    batch.actions = actions.data();
+    batch.advantages = advantages.data();
+    batch.legal_cards = legal.data();
+    batch.rows = 4;
+    std::vector<float> grads;
+    network.accumulate_gradients(batch, 1.f, grads);
+    std::vector<float>& params = network.get_parameters();
+    ASSERT_EQ(grads.size(), params.size());
+    std::vector<float> unused;
+    for (size_t i=0; i<params.size(); i+=37) {
+        float const original = params[i];
+        params[i] = original + 1e-3f;
+        double const plus = network.accumulate_gradients(batch, 1.f, unused);
+        params[i] = original - 1e-3f;
+        double const minus = network.accumulate_gradients(batch, 1.f, unused);
+        params[i] = original;
+        EXPECT_NEAR(grads[i], (plus - minus) / 2e-3, 1e-2) << "parameter " << i;
+    }
+}
+
+TEST(PolicyGradientTest, WeightsUseKerasLayout) {
+    PolicyGradient::Network network;
+    std::vector<std::vector<size_t>> const shapes = network.get_weight_shapes();
+    ASSERT_EQ(shapes.size(), 10);
+    ASSERT_EQ(shapes[0], std::vector<size_t>({161, 161}));
+    ASSERT_EQ(shapes[8], std::vector<size_t>({100, 32}));
+    ASSERT_EQ(shapes[9], std::vector<size_t>({32}));
+    std::vector<std::vector<float>> weights = network.get_weights();
+    weights[9][3] = 100.f; // Bias of the card with id 3
+    PolicyGradient::Network copy;
+    copy.set_weights(weights);
+    ASSERT_EQ(copy.get_weights(), weights);
+    std::vector<float> const state(Dataset::state_size, 0.f);
+    float probs[32];
+    copy.get_probabilities(state.data(), 0xf, probs);
+    ASSERT_GT(probs[3], 0.99f);
+    copy.get_probabilities(state.data(), 0x7, probs); // Masked out
+    ASSERT_EQ(probs[3], 0.f);
+    ASSERT_NEAR(probs[0] + probs[1] + probs[2], 1.f, 1e-5f);
+    weights.pop_back();
+    ASSERT_THROW(copy.set_weights(weights), std::runtime_error);
+}
+
+TEST(PolicyGradientTest, RewardedActionsBecomeLikelier) {
+    for (auto const optimizer : {PolicyGradient::OptimizerType::rmsprop, PolicyGradient::OptimizerType::adam}) {
+        PolicyGradient::Settings settings;
+        settings.optimizer = optimizer;
+        settings.learning_rate = 0.01f;
+        settings.threads = 2;
+        settings.seed = 11;
+        PolicyGradient::Trainer trainer(settings);
+        std::vector<float> const states(256*Dataset::state_size, 0.f);
+        std::vector<uint8_t> actions(256);
+        std::vector<float> returns(256);
+        std::vector<CardMask> const legal(256, 0xff);
+        for (size_t r=0; r<256; r++) {
+            actions[r] = r % 8;
+            returns[r] = (actions[r] == 6) ? 1.f : 0.f; // Only card 6 pays off
+        }
+        for (int step=0; step<100; step++) {
+            trainer.train_on_batch(states.data(), actions.data(), returns.data(), legal.data(), 256);
+        }
+        float probs[32];
+        trainer.get_network()->get_probabilities(states.data(), 0xff, probs);
+        EXPECT_GT(probs[6], 0.5f);
+    }
+}
+
+TEST(PolicyGradientTest, SelfPlayEpisodeTrains) {
+    PolicyGradient::Settings settings;
+    settings.games_per_episode = 6;
+    settings.max_rounds = 2;
+    settings.threads = 3;
+    settings.seed = 13;
+    PolicyGradient::Trainer trainer(settings);
+    std::vector<float> const before = trainer.get_network()->get_parameters();
+    PolicyGradient::EpisodeStats const stats = trainer.train_episode();
+    ASSERT_GT(stats.decisions, 6*3*10);
+    ASSERT_TRUE(std::isfinite(stats.loss));
+    ASSERT_LT(stats.mean_reward, 0.); // One winner and two losers per game
+    ASSERT_NE(trainer.get_network()->get_parameters(), before);
+}
+
+TEST(DifferentialTest, EngineMatchesReference) {
+    Differential::Settings settings;
+    settings.positions = 5000;
+    settings.rounds = 500;
+    settings.threads = 2;
+    settings.seed = 17;
+    Differential::Report const report = Differential::run(settings);
+    for (auto const& d : report.divergences) {
+        ADD_FAILURE() << Differential::to_string(d.reduced) << ": " << d.description;
+    }
+    ASSERT_EQ(report.checks[static_cast<int>(Differential::CheckKind::trick_winner)], 5000 + 32*31*30*3);
+    ASSERT_EQ(report.checks[static_cast<int>(Differential::CheckKind::round)], 500);
+}
+
+TEST(DifferentialTest, JacksDontFollowTheirColor) {
+    std::vector<Card> const hand = {{Spades, Jack}, {Hearts, Seven}};
+    Card lead(Spades, Seven);
+    ASSERT_EQ(Differential::Reference::get_legal_cards(hand, {lead}), hand);
+    lead = Card(Diamonds, Jack);
+    ASSERT_EQ(Differential::Reference::get_legal_cards(hand, {lead}), std::vector<Card>({{Spades, Jack}}));
+    Differential::Case c;
+    c.kind = Differential::CheckKind::legal_cards;
+    c.cards = hand;
+    c.trick = {Card(Spades, Seven)};
+    ASSERT_EQ(Differential::compare(c), "");
+    ASSERT_EQ(Differential::shrink(c).cards, hand); // Nothing to shrink without a divergence
+}
+
+TEST(DifferentialTest, ShrinkReducesInjectedDivergence) {
+    // Mutated reference with the original rule: the jack of a led plain suit follows it
+    Differential::Comparison const mutated = [](Differential::Case const& c) -> std::string {
+        Card const& lead = c.trick.front();
+        std::vector<Card> expected;
+        for (auto const& card : c.cards) {
+            if ((lead.color != Clubs) and (lead.rank != Jack) and (card.color == lead.color)) {
+                expected.push_back(card);
+            }
+        }
+        if (expected.empty()) {
+            expected = Differential::Reference::get_legal_cards(c.cards, c.trick);
+        }
+        Trick trick;
+        for (auto const& card : c.trick) {
+            trick.push_back(card);
+        }
+        std::vector<Card> const legal = Game().get_legal_cards(c.cards, trick);
+        return (get_card_mask(expected) == get_card_mask(legal)) ? "" : "legal cards differ";
+    };
+    Differential::Case c;
+    c.kind = Differential::CheckKind::legal_cards;
+    c.trick = {Card(Spades, Seven), Card(Spades, King)};
+    c.cards = {{Diamonds, Ace}, {Spades, Jack}, {Hearts, Ten}, {Spades, Ace}, {Clubs, Nine}, {Hearts, Seven}, {Spades, Eight}};
+    ASSERT_EQ(Differential::compare(c), "");
+    ASSERT_NE(mutated(c), "");
+    Differential::Case const reduced = Differential::shrink(c, mutated);
+    ASSERT_NE(mutated(reduced), "");
+    ASSERT_EQ(reduced.trick.size(), 1);
+    ASSERT_EQ(reduced.cards.size(), 2);
+    ASSERT_TRUE(std::find(reduced.cards.begin(), reduced.cards.end(), Card(Spades, Jack)) != reduced.cards.end());
+}
+
+TEST(ScenarioTest, CountsMatchingDeals) {
+    Scenario::Constraints constraints;
+    Scenario::Generator all(constraints, 1);
+    EXPECT_EQ(2753294408504640u, all.get_count()); // 32! / (10!^3 2!)
+    EXPECT_DOUBLE_EQ(1., all.get_probability());
+    // All four jacks, counted per card category and through the disjoint matador cells
+    constraints[Scenario::declarer].jacks = {4, 4};
+    EXPECT_EQ(16078749326640u, Scenario::Generator(constraints, 1).get_count());
+    constraints[Scenario::declarer].jacks = Scenario::Range();
+    constraints[Scenario::declarer].matadors = {4, 11};
+    EXPECT_EQ(16078749326640u, Scenario::Generator(constraints, 1).get_count());
+    constraints[Scenario::skat].required = jacks_mask;
+    EXPECT_THROW(Scenario::Generator(constraints, 1), std::runtime_error);
+}
+
+TEST(ScenarioTest, SamplesSatisfyConstraints) {
+    Scenario::Constraints constraints;
+    constraints[Scenario::declarer].matadors = {3, 11};
+    constraints[Scenario::declarer].trumps = {6, 10};
+    constraints[Scenario::first_defender].suits[Hearts] = {0, 0};
+    constraints[Scenario::second_defender].forbidden = get_card_bit(Card(Diamonds, Ace));
+    constraints[Scenario::skat].required = get_card_bit(Card(Spades, Ace));
+    Scenario::Generator generator(constraints, 3);
+    for (int i=0; i<20000; i++) {
+        Scenario::Hands const hands = generator.sample();
+        ASSERT_TRUE(Scenario::satisfies(constraints, hands));
+        std::vector<Card> const deck = Scenario::get_deck(hands, i % 3);
+        ASSERT_EQ(0xffffffffu, get_card_mask(deck));
+        ASSERT_EQ(hands[Scenario::declarer], get_card_mask(std::vector<Card>(deck.begin() + 10*(i % 3), deck.begin() + 10*(i % 3) + 10)));
+    }
+}
+
+TEST(ScenarioTest, SamplesAreUniform) {
+    // Two free cards per role, restricted by matadors, a forbidden card and a void, small enough to enumerate
+    CardMask const free_cards = (1u << 9) | (1u << 12) | (1u << 15) | (1u << 17) | (1u << 20) | (1u << 23) | (1u << 28) | (1u << 31);
+    Scenario::Constraints constraints;
+    int filled = 0;
+    for (int id=0; id<32; id++) {
+        if (not ((free_cards >> id) & 1)) {
+            constraints[filled++ / 8].required |= 1u << id;
+        }
+    }
+    constraints[Scenario::declarer].matadors = {2, 11};
+    constraints[Scenario::skat].forbidden = get_card_bit(Card(Diamonds, Jack));
+    constraints[Scenario::first_defender].jacks = {0, 0};
+    std::map<Scenario::Hands, int> frequencies;
+    std::vector<int> free_ids;
+    for (int id=0; id<32; id++) {
+        if ((free_cards >> id) & 1) {
+            free_ids.push_back(id);
+        }
+    }
+    for (int assignment=0; assignment<(1 << 16); assignment++) {
+        Scenario::Hands hands;
+        for (int d=0; d<Scenario::num_roles; d++) {
+            hands[d] = constraints[d].required;
+        }
+        for (size_t i=0; i<free_ids.size(); i++) {
+            hands[(assignment >> 2*i) & 3] |= 1u << free_ids[i];
+        }
+        if (Scenario::satisfies(constraints, hands)) {
+            frequencies[hands] = 0;
+        }
+    }
+    Scenario::Generator generator(constraints, 5);
+    ASSERT_EQ(frequencies.size(), generator.get_count());
+    int const expected = 400;
+    for (size_t i=0; i<expected*frequencies.size(); i++) {
+        auto it = frequencies.find(generator.sample());
+        ASSERT_NE(frequencies.end(), it);
+        it->second++;
+    }
+    for (auto const& f : frequencies) {
+        EXPECT_NEAR(expected, f.second, 0.3*expected);
+    }
+}
+
+TEST(ScenarioTest, GameDealsFromSource) {
+    Scenario::Constraints constraints;
+    constraints[Scenario::declarer].jacks = {4, 4};
+    std::array<std::shared_ptr<Player>, 3> players = {{std::make_shared<SmearPlayer>(), std::make_shared<SmearPlayer>(), std::make_shared<SmearPlayer>()}};
+    Game game(players[0], players[1], players[2], 20);
+    game.set_log_level_to_warning();
+    game.set_deal_source(std::make_shared<Scenario::Generator>(constraints, 7));
+    game.step_by_round(); // The current round was dealt before
+    for (int round=0; round<10; round++) {
+        int const declarer = game.get_observable_state().declarer;
+        EXPECT_EQ(4, count_cards(get_card_mask(players[declarer]->get_cards()) & jacks_mask));
+        game.step_by_round();
+    }
+}
+
+TEST(StatsTest, ThreadsMergeWithoutLoss) {
+    auto collector = std::make_shared<Stats::Collector>();
+    int const games_per_thread = 20;
+    int const max_rounds = 4;
+    std::vector<std::thread> threads;
+    for (int t=0; t<4; t++) {
+        threads.emplace_back([collector]() {
+            Game game(std::make_shared<SmearPlayer>(), std::make_shared<SmearPlayer>(), std::make_shared<SmearPlayer>(), max_rounds);
+            game.set_stats(collector);
+            for (int i=0; i<games_per_thread; i++) {
+                game.run_new_game();
+            }
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    // Threads that finished before others started hand their counters on
+    EXPECT_GE(collector->get_threads(), 1);
+    EXPECT_LE(collector->get_threads(), 4);
+    Stats::Snapshot const s = collector->get_snapshot();
+    uint64_t const rounds = 4*games_per_thread*(max_rounds + 1);
+    EXPECT_EQ(4u*games_per_thread, s.get_games());
+    EXPECT_EQ(rounds, s.get_rounds());
+    EXPECT_EQ(0., s.get_abort_rate());
+    auto sum = [&s](size_t const offset, size_t const size) {
+        return std::accumulate(s.counts.begin() + offset, s.counts.begin() + offset + size, uint64_t(0));
+    };
+    EXPECT_EQ(s.get_games(), sum(Stats::Layout::game_winners, 3));
+    EXPECT_EQ(rounds, sum(Stats::Layout::declarer_rounds, Stats::Layout::declarer_points - Stats::Layout::declarer_rounds));
+    EXPECT_EQ(rounds, sum(Stats::Layout::declarer_points, Stats::max_points + 1));
+    EXPECT_EQ(10*rounds, sum(Stats::Layout::trick_winners, 32*3));
+    EXPECT_EQ(30*rounds, sum(Stats::Layout::card_plays, Stats::tricks_per_round*32));
+    for (int card=0; card<32; card++) { // Every card is played at most once per round, the Skat stays
+        uint64_t plays = 0;
+        for (int trick=0; trick<Stats::tricks_per_round; trick++) {
+            plays += s.counts[Stats::Layout::card_plays + 32*trick + card];
+        }
+        EXPECT_LE(plays, rounds);
+    }
+    Stats::Snapshot doubled = s;
+    doubled += s;
+    EXPECT_EQ(2*rounds, doubled.get_rounds());
+    EXPECT_DOUBLE_EQ(s.get_declarer_win_rate(0), doubled.get_declarer_win_rate(0));
+}
+
+TEST(StatsTest, ExitedThreadsReturnTheirCounters) {
+    auto collector = std::make_shared<Stats::Collector>(2);
+    int const num_threads = 10;
+    for (int t=0; t<num_threads; t++) {
+        std::thread thread([collector]() {
+            collector->local().count_game(0);
+            Stats::Collector other(1); // Destroyed before the thread exits
+            other.local().count_game(0);
+        });
+        thread.join();
+    }
+    EXPECT_EQ(1, collector->get_threads());
+    EXPECT_EQ(uint64_t(num_threads), collector->get_snapshot().get_games());
+}
+
+TEST(StatsTest, AbortsAreCounted) {
+    auto collector = std::make_shared<Stats::Collector>();
+    Game game(std::make_shared<RandomPlayer>(), std::make_shared<RandomPlayer>(), std::make_shared<RandomPlayer>(), 10);
+    game.set_log_level_to_warning();
+    game.set_stats(collector);
+    for (int i=0; i<50; i++) {
+        game.run_new_game();
+    }
+    Stats::Snapshot const s = collector->get_snapshot();
+    EXPECT_EQ(50u, s.get_games());
+    EXPECT_GT(s.get_abort_rate(), 0.);
+    uint64_t const winners = s.counts[Stats::Layout::game_winners] + s.counts[Stats::Layout::game_winners + 1] + s.counts[Stats::Layout::game_winners + 2];
+    EXPECT_EQ(s.get_games(), winners + std::lround(s.get_abort_rate()*s.get_games()));
+}
+
+// Deals the same deck every round
+class FixedDeckSource : public Scenario::DealSource {
+    public:
+        FixedDeckSource(std::vector<Card> const& deck) : deck(deck) {}
+        std::vector<Card> get_deck(int const) override { return deck; }
+    private:
+        std::vector<Card> deck;
+};
+
+// Puts all mass on the lowest legal card and counts how often it is asked
+class CountingPlayer : public Player {
+    public:
+        int queries = 0;
+        Card query_policy() override { throw std::runtime_error("Only asked for distributions"); }
+        std::vector<float> query_distribution() override {
+            queries++;
+            std::vector<float> probs(32, 0.f);
+            probs[get_card_id(get_cards_from_mask(m_last_state.legal_cards).front())] = 1.f;
+            return probs;
+        }
+};
+
+TEST(PolicyCacheTest, ReplayedDealsHitCache) {
+    auto cache = std::make_shared<PolicyCache::Cache>(1 << 12, 4);
+    std::vector<std::shared_ptr<CountingPlayer>> players;
+    for (int i=0; i<3; i++) {
+        players.push_back(std::make_shared<CountingPlayer>());
+        players.back()->set_policy_cache(cache);
+    }
+    auto get_queries = [&]() { return players[0]->queries + players[1]->queries + players[2]->queries; };
+    std::vector<Card> deck = get_cards_from_mask(0xffffffff);
+    std::shuffle(deck.begin(), deck.end(), HalfSkat::rng);
+    Game game(players[0], players[1], players[2], 2, true);
+    game.set_log_level_to_warning();
+    game.set_deal_source(std::make_shared<FixedDeckSource>(deck));
+    // Same deck and a deterministic policy, so only the few seatings of declarer and dealer are new decisions
+    int const games = 30;
+    for (int i=0; i<games; i++) {
+        game.run_new_game();
+    }
+    PolicyCache::CacheStats const stats = cache->get_stats();
+    EXPECT_EQ(stats.misses, uint64_t(get_queries()));
+    EXPECT_EQ(stats.misses + stats.hits + stats.forced, uint64_t(games*3*30));
+    EXPECT_GE(stats.forced, uint64_t(games*3*3));
+    EXPECT_GT(stats.get_hit_rate(), 0.5);
+    // A new policy version must not be answered from the old decisions
+    int const queries = get_queries();
+    for (auto& p : players) {
+        p->set_policy_version(1);
+    }
+    game.run_new_game();
+    EXPECT_GT(get_queries(), queries);
+    EXPECT_EQ(cache->get_stats().misses, uint64_t(get_queries()));
+}
+
+TEST(PolicyCacheTest, ClockEvictsUnreferencedFirst) {
+    PolicyCache::Cache cache(4, 1);
+    PolicyCache::Probabilities probs{};
+    for (uint64_t key=1; key<=4; key++) {
+        probs[0] = key;
+        cache.insert(key, probs);
+    }
+    ASSERT_TRUE(cache.find(1, probs));
+    EXPECT_EQ(1.f, probs[0]);
+    cache.insert(5, probs);
+    EXPECT_TRUE(cache.find(1, probs));
+    EXPECT_FALSE(cache.find(2, probs));
+    EXPECT_TRUE(cache.find(5, probs));
+    for (uint64_t key=6; key<20; key++) {
+        cache.insert(key, probs);
+    }
+    PolicyCache::CacheStats const stats = cache.get_stats();
+    EXPECT_EQ(4u, stats.size);
+    EXPECT_EQ(4u, stats.capacity);
+    EXPECT_EQ(15u, stats.evictions);
+}
+
+// Declarer points of the remaining play by exhaustive minimax, for small endings
+int get_minimax_points(LeadBook::Hands& hands, int const declarer, int const player, std::vector<Card>& trick) {
+    if (trick.size() == 3) {
+        int const winner = (player + Rules<clubs_game>::get_winner_index(trick)) % 3;
+        int const points = (winner == declarer) ? get_card_points(trick) : 0;
+        if ((hands[0] | hands[1] | hands[2]) == 0) {
+            return points;
+        }
+        std::vector<Card> next;
+        return points + get_minimax_points(hands, declarer, winner, next);
+    }
+    CardMask const legal = trick.empty() ? hands[player] : Rules<clubs_game>::get_legal_mask(hands[player], trick[0]);
+    int best = (player == declarer) ? -1 : 121;
+    for (auto const& c : get_cards_from_mask(legal)) {
+        hands[player] ^= get_card_bit(c);
+        trick.push_back(c);
+        int const v = get_minimax_points(hands, declarer, (player + 1) % 3, trick);
+        trick.pop_back();
+        hands[player] ^= get_card_bit(c);
+        best = (player == declarer) ? std::max(best, v) : std::min(best, v);
+    }
+    return best;
+}
+
+TEST(LeadBookTest, SolverMatchesMinimax) {
+    std::mt19937 engine(11);
+    std::vector<Card> deck = get_cards_from_mask(0xffffffff);
+    LeadBook::Solver solver;
+    for (int position=0; position<200; position++) {
+        std::shuffle(deck.begin(), deck.end(), engine);
+        LeadBook::Hands hands = {{0, 0, 0}};
+        for (int i=0; i<12; i++) {
+            hands[i / 4] |= get_card_bit(deck[i]);
+        }
+        int const declarer = position % 3;
+        int const leader = (position / 3) % 3;
+        std::vector<Card> trick;
+        ASSERT_EQ(solver.solve(hands, declarer, leader), get_minimax_points(hands, declarer, leader, trick));
+        std::array<int, 32> points;
+        solver.solve_leads(hands, declarer, leader, points);
+        for (auto const& lead : get_cards_from_mask(hands[leader])) {
+            hands[leader] ^= get_card_bit(lead);
+            trick = {lead};
+            ASSERT_EQ(points[get_card_id(lead)], get_minimax_points(hands, declarer, (leader + 1) % 3, trick));
+            hands[leader] ^= get_card_bit(lead);
+        }
+    }
+}
+
+TEST(LeadBookTest, BookAnswersPermutedHands) {
+    std::string const path = testing::TempDir() + "pyskat_lead_book_test.bin";
+    CardMask const hand = get_card_mask({{Clubs, Jack}, {Diamonds, Jack}, {Clubs, Ace}, {Spades, Ten}, {Hearts, Ace},
+        {Hearts, King}, {Diamonds, Seven}, {Diamonds, Eight}, {Diamonds, Nine}, {Diamonds, Queen}});
+    // Swap hearts and diamonds, jacks stay
+    CardMask const swapped = get_card_mask({{Clubs, Jack}, {Diamonds, Jack}, {Clubs, Ace}, {Spades, Ten}, {Diamonds, Ace},
+        {Diamonds, King}, {Hearts, Seven}, {Hearts, Eight}, {Hearts, Nine}, {Hearts, Queen}});
+    auto swap_colors = [](Card c) {
+        if ((c.rank != Jack) and ((c.color == Hearts) or (c.color == Diamonds))) {
+            c.color = (c.color == Hearts) ? Diamonds : Hearts;
+        }
+        return c;
+    };
+    LeadBook::Settings settings;
+    settings.sample_hands = 0;
+    EXPECT_THROW(LeadBook::build_book(path, settings), std::runtime_error); // Neither a list nor a sample
+    settings.hands = {hand};
+    settings.deals_per_hand = 3;
+    settings.threads = 3;
+    settings.seed = 5;
+    LeadBook::build_book(path, settings);
+    auto book = std::make_shared<LeadBook::Book>(path);
+    ASSERT_EQ(book->size(), 3);
+    ASSERT_EQ(book->get_deals_per_hand(), 3);
+    for (auto const role : settings.roles) {
+        ASSERT_NE(book->find(hand, role), nullptr);
+        ASSERT_EQ(book->find(swapped, role), book->find(hand, role));
+        Card lead;
+        Card swapped_lead;
+        ASSERT_TRUE(book->get_best_lead(hand, role, lead));
+        ASSERT_TRUE(book->get_best_lead(swapped, role, swapped_lead));
+        ASSERT_TRUE(in_mask(hand, lead));
+        ASSERT_EQ(swap_colors(lead), swapped_lead);
+        std::array<float, 32> points;
+        std::array<float, 32> swapped_points;
+        ASSERT_TRUE(book->get_lead_points(hand, role, points));
+        ASSERT_TRUE(book->get_lead_points(swapped, role, swapped_points));
+        for (auto const& c : get_cards_from_mask(hand)) {
+            EXPECT_EQ(points[get_card_id(c)], swapped_points[get_card_id(swap_colors(c))]);
+            EXPECT_LE(points[get_card_id(c)], points[get_card_id(lead)]);
+        }
+    }
+    Card lead;
+    ASSERT_FALSE(book->get_best_lead(hand ^ get_card_mask({{Hearts, Ace}, {Hearts, Ten}}), Scenario::declarer, lead));
+    // Seat 0 leads the first trick whenever it is forehand, all other cards come from the fallback
+    std::vector<Card> deck = get_cards_from_mask(hand);
+    std::vector<Card> rest = get_cards_from_mask(~hand);
+    std::shuffle(rest.begin(), rest.end(), HalfSkat::rng);
+    deck.insert(deck.end(), rest.begin(), rest.end());
+    auto player = std::make_shared<LeadBook::BookPlayer>(book, std::make_shared<SmearPlayer>());
+    Game game(player, std::make_shared<SmearPlayer>(), std::make_shared<SmearPlayer>(), 5, false, true);
+    game.set_log_level_to_warning();
+    game.set_deal_source(std::make_shared<FixedDeckSource>(deck));
+    game.run_new_game();
+    EXPECT_EQ(game.get_round(), game.get_max_rounds() + 1);
+    EXPECT_EQ(player->get_hits(), 2u);
+    EXPECT_EQ(player->get_misses(), 0u);
+    // Corrupt copies: more entries than slots, and slots without an empty one
+    std::string const corrupt_path = path + ".corrupt";
+    std::ifstream in(path, std::ios::binary);
+    std::string const data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    size_t const header = 24;
+    std::string overfull = data;
+    uint32_t const num_entries = (data.size() - header) / sizeof(LeadBook::Entry);
+    std::memcpy(&overfull[header - sizeof(num_entries)], &num_entries, sizeof(num_entries));
+    std::string no_empty_slot = data;
+    for (size_t offset=header; offset<data.size(); offset+=sizeof(LeadBook::Entry)) {
+        CardMask hand;
+        std::memcpy(&hand, &data[offset], sizeof(hand));
+        if (hand == 0) {
+            hand = 0x3ff; // Matches neither lookup below
+            std::memcpy(&no_empty_slot[offset], &hand, sizeof(hand));
+        }
+    }
+    std::ofstream(corrupt_path, std::ios::binary | std::ios::trunc) << overfull;
+    ASSERT_THROW(LeadBook::Book{corrupt_path}, std::runtime_error);
+    std::ofstream(corrupt_path, std::ios::binary | std::ios::trunc) << no_empty_slot;
+    LeadBook::Book full(corrupt_path);
+    ASSERT_NE(full.find(hand, Scenario::declarer), nullptr);
+    ASSERT_EQ(full.find(hand ^ get_card_mask({{Hearts, Ace}, {Hearts, Ten}}), Scenario::declarer), nullptr);
+    std::remove(corrupt_path.c_str());
+    std::remove(path.c_str());
+}
+
+TEST(SerializationTest, TransitionsRoundTrip) {
+    auto player = std::make_shared<RandomPlayer>();
+    Game game(player, std::make_shared<RandomPlayer>(), std::make_shared<RandomPlayer>(), 3, true);
+    game.run_new_game();
+    std::vector<Transition> const transitions = player->get_transitions();
+    ASSERT_FALSE(transitions.empty());
+    std::string const data = Serialization::serialize_transitions(transitions);
+    ASSERT_EQ(data.size(), transitions.size()*Serialization::transition_bytes);
+    std::vector<Transition> const restored = Serialization::deserialize_transitions(data);
+    ASSERT_EQ(restored.size(), transitions.size());
+    for (size_t i=0; i<restored.size(); i++) {
+        PlayerState const& a = transitions[i].before;
+        PlayerState const& b = restored[i].before;
+        ASSERT_EQ(a.hole_cards, b.hole_cards);
+        ASSERT_EQ(a.won_friendly, b.won_friendly);
+        ASSERT_EQ(a.won_hostile, b.won_hostile);
+        ASSERT_EQ(a.trick.size(), b.trick.size());
+        for (size_t j=0; j<a.trick.size(); j++) {
+            ASSERT_EQ(a.trick[j], b.trick[j]);
+            ASSERT_EQ(a.trick[j].played_by, b.trick[j].played_by);
+            ASSERT_EQ(a.trick_played_by_friend[j], b.trick_played_by_friend[j]);
+        }
+        ASSERT_EQ(a.is_declarer, b.is_declarer);
+        ASSERT_EQ(a.legal_cards, b.legal_cards);
+        ASSERT_EQ(transitions[i].reward, restored[i].reward);
+        ASSERT_EQ(transitions[i].action, restored[i].action);
+    }
+}
+
+TEST(SerializationTest, GameCheckpointRestores) {
+    Game game(1000, true);
+    for (int i=0; i<7; i++) {
+        game.step_by_trick();
+    }
+    std::string const data = game.checkpoint();
+    Game restored(5, false);
+    restored.restore(data);
+    ASSERT_EQ(restored.checkpoint(), data);
+    ASSERT_EQ(restored.get_trick().size(), game.get_trick().size());
+    ASSERT_EQ(restored.get_points(), game.get_points());
+    ASSERT_EQ(restored.get_max_rounds(), game.get_max_rounds());
+    restored.step_by_round(); // Restored game can be continued
+    ASSERT_EQ(restored.get_round(), game.get_round()+1);
+}
+
+TEST(SerializationTest, CorruptCheckpointsThrow) {
+    Game game(1000, true);
+    for (int i=0; i<7; i++) {
+        game.step_by_trick();
+    }
+    std::string const data = game.checkpoint();
+    Game restored(5, false);
+    std::string const before = restored.checkpoint();
+    // Seat of the current player, hand of the second seat and trick size
+    size_t const current_player = 22;
+    size_t const hands = 35;
+    size_t const trick_size = hands + 7*4;
+    std::string bad_seat = data;
+    bad_seat[current_player] = 3;
+    std::string dealt_twice = data;
+    std::copy(data.begin() + hands, data.begin() + hands + 4, dealt_twice.begin() + hands + 4);
+    std::string full_trick = data;
+    full_trick[trick_size] = 7;
+    std::string old_version = data;
+    old_version[0] = 2; // Only the current version is read
+    for (auto const& bad : {bad_seat, dealt_twice, full_trick, old_version, data.substr(0, data.size() - 1)}) {
+        ASSERT_THROW(restored.restore(bad), std::runtime_error);
+        ASSERT_EQ(restored.checkpoint(), before);
+    }
+}
+
 int Tests::run_all_tests() {
     logging::core::get()->set_filter
     (
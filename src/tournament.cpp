@@ -0,0 +1,435 @@
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <mutex>
+#include <random>
+#include <stdexcept>
+
+#include "tournament.hpp"
+#include "parallel.hpp"
+
+using namespace Tournament;
+
+namespace {
+
+double get_expected_score(double const elo) {
+    return 1. / (1. + std::pow(10., -elo/400.));
+}
+
+// Results of a single match, merged into the tournament result when done
+struct MatchResult {
+    std::vector<std::vector<PairResult>> pairs;
+    std::vector<long> points;
+    std::vector<long> rounds;
+    PairResult first_against_field;
+    long aborted_rounds = 0;
+    MatchResult(size_t const n) : pairs(n, std::vector<PairResult>(n)), points(n, 0), rounds(n, 0) {}
+};
+
+// Adds one sample (all comparisons of one match) to the results
+void add_sample(PairResult const& sample, PairResult& result) {
+    if (sample.games() == 0) {
+        return;
+    }
+    double const x = sample.score() / sample.games();
+    result.wins += sample.wins;
+    result.draws += sample.draws;
+    result.losses += sample.losses;
+    result.samples++;
+    result.sum += x;
+    result.sum_squares += x*x;
+}
+
+void merge(PairResult const& other, PairResult& result) {
+    result.wins += other.wins;
+    result.draws += other.draws;
+    result.losses += other.losses;
+    result.samples += other.samples;
+    result.sum += other.sum;
+    result.sum_squares += other.sum_squares;
+}
+
+void add_comparison(long const points, long const other_points, PairResult& result) {
+    if (points > other_points) {
+        result.wins++;
+    }
+    else if (points < other_points) {
+        result.losses++;
+    }
+    else {
+        result.draws++;
+    }
+}
+
+void play_match(std::vector<Entrant> const& roster, std::array<int, 3> const& seating, Settings const& settings, MatchResult& match) {
+    std::array<std::shared_ptr<HalfSkat::Player>, 3> players;
+    for (size_t i=0; i<3; i++) {
+        players[i] = roster[seating[i]].factory();
+        if (not players[i]) {
+            throw std::runtime_error("Player factory of " + roster[seating[i]].name + " returned no player");
+        }
+    }
+    auto new_game = [&]() {
+        return std::make_shared<HalfSkat::Game>(players[0], players[1], players[2], settings.rounds_per_match, settings.retry_on_illegal_action);
+    };
+    std::shared_ptr<HalfSkat::Game> game = new_game();
+    // The first seat declares first and the seats take turns, also across aborted rounds. The dealer keeps its
+    // random offset to the declarer for the whole match.
+    int const dealer_offset = game->get_observable_state().dealer;
+    auto deal = [&](int const r) {
+        game->deal_round(Cards::get_full_shuffled_deck(), r % 3, (r + dealer_offset) % 3);
+    };
+    deal(0);
+    std::array<long, 3> seat_points = {};
+    for (int r=0; r<settings.rounds_per_match; r++) {
+        std::array<int, 3> const before = game->get_points();
+        game->step_by_round();
+        for (auto& p : players) {
+            p->clear_transitions();
+        }
+        if (game->get_state() == HalfSkat::early_abort) { // Round can't be scored, continue with a fresh game
+            match.aborted_rounds++;
+            game = new_game();
+            deal(r + 1);
+            continue;
+        }
+        std::array<int, 3> const after = game->get_points();
+        for (size_t i=0; i<3; i++) {
+            seat_points[i] += after[i] - before[i];
+            match.points[seating[i]] += after[i] - before[i];
+            match.rounds[seating[i]]++;
+        }
+    }
+    // Rounds per match are a multiple of three, so every seat declares equally often (rounds lost to aborts aside).
+    // The seats of equally strong entrants are exchangeable and comparing them is fair even if one entrant holds two.
+    std::vector<std::vector<PairResult>> compared(match.pairs.size(), std::vector<PairResult>(match.pairs.size()));
+    PairResult first;
+    for (size_t i=0; i<3; i++) {
+        for (size_t j=0; j<3; j++) {
+            int const a = seating[i];
+            int const b = seating[j];
+            if (a == b) {
+                continue;
+            }
+            add_comparison(seat_points[i], seat_points[j], compared[a][b]);
+            if (a == 0) {
+                add_comparison(seat_points[i], seat_points[j], first);
+            }
+        }
+    }
+    for (size_t a=0; a<compared.size(); a++) {
+        for (size_t b=0; b<compared.size(); b++) {
+            add_sample(compared[a][b], match.pairs[a][b]);
+        }
+    }
+    add_sample(first, match.first_against_field);
+}
+
+// Uniform integer below n from the raw engine output. Unlike std::shuffle and std::uniform_int_distribution this is
+// specified exactly, so every standard library draws the same deals.
+int draw_below(std::mt19937& engine, uint32_t const n) {
+    uint64_t const range = uint64_t(1) << 32;
+    uint64_t const limit = range - range % n;
+    uint64_t value;
+    do {
+        value = engine();
+    } while (value >= limit);
+    return static_cast<int>(value % n);
+}
+
+} // namespace
+
+std::vector<std::array<int, 3>> Tournament::get_seatings(int const num_entrants, Schedule const schedule) {
+    std::vector<std::array<int, 3>> triples;
+    if (num_entrants < 2) {
+        throw std::runtime_error("Tournament needs at least two entrants");
+    }
+    if (schedule == gauntlet) {
+        for (int i=1; i<num_entrants; i++) {
+            for (int j=i; j<num_entrants; j++) {
+                triples.push_back({{0, i, j}});
+            }
+        }
+    }
+    else if (num_entrants == 2) {
+        triples.push_back({{0, 1, 1}});
+        triples.push_back({{1, 0, 0}});
+    }
+    else {
+        for (int i=0; i<num_entrants; i++) {
+            for (int j=i+1; j<num_entrants; j++) {
+                for (int k=j+1; k<num_entrants; k++) {
+                    triples.push_back({{i, j, k}});
+                }
+            }
+        }
+    }
+    // Every entrant takes every seat
+    std::vector<std::array<int, 3>> seatings;
+    for (auto const& t : triples) {
+        seatings.push_back({{t[0], t[1], t[2]}});
+        seatings.push_back({{t[1], t[2], t[0]}});
+        seatings.push_back({{t[2], t[0], t[1]}});
+    }
+    return seatings;
+}
+
+void Tournament::compute_ratings(Result& result) {
+    size_t const n = result.pairs.size();
+    // Bradley-Terry model on the match scores, one virtual draw per pair keeps ratings finite
+    std::vector<std::vector<double>> games(n, std::vector<double>(n, 0.));
+    std::vector<double> scores(n, 0.);
+    for (size_t i=0; i<n; i++) {
+        for (size_t j=0; j<n; j++) {
+            long const g = result.pairs[i][j].samples;
+            if ((i != j) and (g > 0)) {
+                games[i][j] = g + 1.;
+                scores[i] += result.pairs[i][j].sum + 0.5;
+            }
+        }
+    }
+    std::vector<double> strength(n, 1.);
+    for (int iter=0; iter<10000; iter++) { // Minorization-maximization updates
+        double max_change = 0.;
+        for (size_t i=0; i<n; i++) {
+            double denom = 0.;
+            for (size_t j=0; j<n; j++) {
+                if (games[i][j] > 0.) {
+                    denom += games[i][j] / (strength[i] + strength[j]);
+                }
+            }
+            if (denom > 0.) {
+                double const updated = scores[i] / denom;
+                max_change = std::max(max_change, std::abs(std::log(updated / strength[i])));
+                strength[i] = updated;
+            }
+        }
+        if (max_change < 1e-10) {
+            break;
+        }
+    }
+    double const to_elo = 400. / std::log(10.);
+    double mean = 0.;
+    for (size_t i=0; i<n; i++) {
+        mean += std::log(strength[i]) / n;
+    }
+    result.elo.assign(n, 0.);
+    result.elo_error.assign(n, 0.);
+    for (size_t i=0; i<n; i++) {
+        result.elo[i] = (std::log(strength[i]) - mean) * to_elo;
+        // Diagonal of the Fisher information, correlations between ratings are neglected
+        double information = 0.;
+        for (size_t j=0; j<n; j++) {
+            if (games[i][j] > 0.) {
+                double const p = strength[i] / (strength[i] + strength[j]);
+                information += games[i][j] * p * (1. - p);
+            }
+        }
+        result.elo_error[i] = (information > 0.) ? 1.96 * to_elo / std::sqrt(information) : std::numeric_limits<double>::infinity();
+    }
+}
+
+double Tournament::get_sprt_llr(PairResult const& results, double const elo0, double const elo1) {
+    if (results.samples == 0) {
+        return 0.;
+    }
+    // One virtual won and one virtual lost match keep the variance estimate of the first few matches from collapsing
+    double const n = results.samples + 2.;
+    double const x = (results.sum + 1.) / n;
+    double const var = (results.sum_squares + 1.) / n - x*x;
+    if (var <= 0.) {
+        return 0.;
+    }
+    double const s0 = get_expected_score(elo0);
+    double const s1 = get_expected_score(elo1);
+    return n * (s1 - s0) * (2.*x - s0 - s1) / (2.*var);
+}
+
+Result Tournament::run(std::vector<Entrant> const& roster, Settings const& settings) {
+    if ((settings.rounds_per_match <= 0) or (settings.rounds_per_match % 3 != 0)) {
+        throw std::runtime_error("Rounds per match must be a positive multiple of three, so every seat declares equally often.");
+    }
+    size_t const n = roster.size();
+    std::vector<std::array<int, 3>> const seatings = get_seatings(n, settings.schedule);
+    Result result;
+    for (auto const& e : roster) {
+        result.names.push_back(e.name);
+    }
+    result.pairs.assign(n, std::vector<PairResult>(n));
+    result.points.assign(n, 0);
+    result.rounds.assign(n, 0);
+    if (settings.sprt) {
+        result.sprt = sprt_running;
+        result.llr_lower = std::log(settings.beta / (1. - settings.alpha));
+        result.llr_upper = std::log((1. - settings.beta) / settings.alpha);
+    }
+    std::atomic<int> next_match{0};
+    std::atomic<bool> stop{false};
+    std::mutex mutex;
+    Parallel::run_on_threads(Parallel::get_num_threads(settings.threads), stop, [&](int) {
+        while (not stop) {
+            int const m = next_match++;
+            if (m >= settings.max_matches) {
+                return;
+            }
+            MatchResult match(n);
+            play_match(roster, seatings[m % seatings.size()], settings, match);
+            std::lock_guard<std::mutex> lock(mutex);
+            for (size_t i=0; i<n; i++) {
+                result.points[i] += match.points[i];
+                result.rounds[i] += match.rounds[i];
+                for (size_t j=0; j<n; j++) {
+                    merge(match.pairs[i][j], result.pairs[i][j]);
+                }
+            }
+            merge(match.first_against_field, result.first_against_field);
+            result.aborted_rounds += match.aborted_rounds;
+            result.matches++;
+            if (result.sprt == sprt_running) {
+                result.llr = get_sprt_llr(result.first_against_field, settings.elo0, settings.elo1);
+                if (result.llr <= result.llr_lower) {
+                    result.sprt = sprt_accept_h0;
+                    stop = true;
+                }
+                else if (result.llr >= result.llr_upper) {
+                    result.sprt = sprt_accept_h1;
+                    stop = true;
+                }
+            }
+        }
+    });
+    compute_ratings(result);
+    return result;
+}
+
+void Tournament::get_duplicate_deal(unsigned const seed, long const index, std::vector<Cards::Card>& deck, int& declarer, int& dealer) {
+    std::seed_seq seq{seed, static_cast<unsigned>(index), static_cast<unsigned>(index >> 32)};
+    std::mt19937 engine(seq);
+    deck.assign(Cards::AllCards.begin(), Cards::AllCards.end());
+    for (int i=deck.size()-1; i>0; i--) { // Fisher-Yates
+        std::swap(deck[i], deck[draw_below(engine, i+1)]);
+    }
+    declarer = draw_below(engine, 3);
+    dealer = draw_below(engine, 3);
+}
+
+std::vector<std::array<int, 3>> Tournament::get_duplicate_seatings(int const num_entrants) {
+    std::vector<std::array<int, 3>> bases;
+    if (num_entrants == 2) {
+        bases = {{{0, 0, 1}}, {{0, 1, 1}}};
+    }
+    else if (num_entrants == 3) {
+        bases = {{{0, 1, 2}}};
+    }
+    else {
+        throw std::runtime_error("Duplicate mode needs two or three entrants");
+    }
+    std::vector<std::array<int, 3>> seatings;
+    for (auto base : bases) {
+        do {
+            seatings.push_back(base);
+        } while (std::next_permutation(base.begin(), base.end()));
+    }
+    return seatings;
+}
+
+DuplicateResult Tournament::run_duplicate(std::vector<Entrant> const& roster, DuplicateSettings const& settings) {
+    size_t const n = roster.size();
+    std::vector<std::array<int, 3>> const seatings = get_duplicate_seatings(n);
+    DuplicateResult result;
+    for (auto const& e : roster) {
+        result.names.push_back(e.name);
+    }
+    result.seed = (settings.seed != 0) ? settings.seed : std::random_device{}();
+    long const num_deals = std::max(0L, settings.deals);
+    std::vector<std::vector<double>> scores(num_deals);
+    std::vector<int> aborted_by(num_deals, -1); // Entrant playing the illegal card
+    std::atomic<long> next_deal{0};
+    std::atomic<bool> stop{false};
+    Parallel::run_on_threads(Parallel::get_num_threads(settings.threads), stop, [&](int) {
+        // One game per seating, reused for all deals of this thread
+        std::vector<std::shared_ptr<HalfSkat::Game>> games;
+        std::vector<std::array<std::shared_ptr<HalfSkat::Player>, 3>> players;
+        for (auto const& seating : seatings) {
+            std::array<std::shared_ptr<HalfSkat::Player>, 3> seated;
+            for (size_t i=0; i<3; i++) {
+                seated[i] = roster[seating[i]].factory();
+                if (not seated[i]) {
+                    throw std::runtime_error("Player factory of " + roster[seating[i]].name + " returned no player");
+                }
+            }
+            players.push_back(seated);
+            games.push_back(std::make_shared<HalfSkat::Game>(seated[0], seated[1], seated[2], std::numeric_limits<int>::max(), settings.retry_on_illegal_action));
+        }
+        std::vector<Cards::Card> deck;
+        while (not stop) {
+            long const d = next_deal++;
+            if (d >= num_deals) {
+                return;
+            }
+            int declarer, dealer;
+            get_duplicate_deal(result.seed, d, deck, declarer, dealer);
+            std::vector<double> sums(n, 0.);
+            std::vector<int> seats(n, 0);
+            for (size_t s=0; s<seatings.size(); s++) {
+                HalfSkat::Game& game = *games[s];
+                game.deal_round(deck, declarer, dealer);
+                std::array<int, 3> const before = game.get_points();
+                game.step_by_round();
+                for (auto& p : players[s]) {
+                    p->clear_transitions();
+                }
+                if (game.get_state() == HalfSkat::early_abort) {
+                    aborted_by[d] = seatings[s][game.get_current_player()];
+                    break;
+                }
+                std::array<int, 3> const after = game.get_points();
+                for (size_t i=0; i<3; i++) {
+                    sums[seatings[s][i]] += after[i] - before[i];
+                    seats[seatings[s][i]]++;
+                }
+            }
+            if (aborted_by[d] < 0) {
+                for (size_t i=0; i<n; i++) {
+                    sums[i] /= seats[i];
+                }
+                scores[d] = sums;
+            }
+        }
+    });
+    result.aborts.assign(n, 0);
+    for (long d=0; d<num_deals; d++) {
+        if (aborted_by[d] >= 0) {
+            result.aborted_deals++;
+            result.aborts[aborted_by[d]]++;
+        }
+        else {
+            result.deal_scores.push_back(scores[d]);
+        }
+    }
+    result.deals = result.deal_scores.size();
+    result.mean_difference.assign(n, std::vector<double>(n, 0.));
+    result.difference_error.assign(n, std::vector<double>(n, std::numeric_limits<double>::infinity()));
+    for (size_t i=0; i<n; i++) {
+        for (size_t j=0; j<n; j++) {
+            double sum = 0.;
+            double sum_squares = 0.;
+            for (auto const& s : result.deal_scores) {
+                double const diff = s[i] - s[j];
+                sum += diff;
+                sum_squares += diff*diff;
+            }
+            long const k = result.deals;
+            if (k > 0) {
+                result.mean_difference[i][j] = sum / k;
+            }
+            if (k > 1) {
+                double const var = std::max(0., (sum_squares - sum*sum/k) / (k - 1));
+                result.difference_error[i][j] = 1.96 * std::sqrt(var / k);
+            }
+        }
+    }
+    return result;
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <array>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "halfskat.hpp"
+
+// Plays many matches between a roster of players on all cores and rates them
+namespace Tournament {
+
+using PlayerFactory = std::function<std::shared_ptr<HalfSkat::Player>()>;
+
+struct Entrant {
+    std::string name;
+    PlayerFactory factory; // Called once per match and seat, possibly from a worker thread
+    Entrant(std::string const& name, PlayerFactory const& factory) : name(name), factory(factory) {}
+};
+
+enum Schedule { round_robin = 0, gauntlet = 1 };
+enum SprtState { sprt_off = 0, sprt_running = 1, sprt_accept_h0 = 2, sprt_accept_h1 = 3 };
+
+struct Settings {
+    Schedule schedule = round_robin; // Gauntlet: first entrant plays against all others
+    int rounds_per_match = 99; // A match is one Game between three seated entrants, a multiple of three
+    int max_matches = 1000;
+    int threads = 0; // Zero uses all cores
+    bool retry_on_illegal_action = true;
+    // Sequential probability ratio test of first entrant against the rest (H0: elo0, H1: elo1), stops early once decided
+    bool sprt = false;
+    double elo0 = 0.;
+    double elo1 = 20.;
+    double alpha = 0.05;
+    double beta = 0.05;
+};
+
+// Pairwise results: after every match each seat of one entrant is compared with each seat of the other by the points
+// of the match. The comparisons of a match are correlated and form a single sample scored by their mean.
+struct PairResult {
+    long wins = 0; // Seat comparisons
+    long draws = 0;
+    long losses = 0;
+    long samples = 0; // Matches
+    double sum = 0.; // Sum of the match scores, 1 for a match won in all comparisons
+    double sum_squares = 0.;
+    long games() const { return wins + draws + losses; }
+    double score() const { return wins + 0.5*draws; }
+};
+
+struct Result {
+    std::vector<std::string> names;
+    std::vector<double> elo; // Bradley-Terry ratings, mean is zero
+    std::vector<double> elo_error; // Half-width of 95% confidence intervals
+    std::vector<long> points; // Sum of round scores
+    std::vector<long> rounds; // Rounds played per entrant and seat
+    std::vector<std::vector<PairResult>> pairs; // pairs[i][j]: results of i against j
+    PairResult first_against_field; // First entrant against all other seats, tested by the SPRT
+    long matches = 0;
+    long aborted_rounds = 0;
+    double llr = 0.; // Log-likelihood ratio of the SPRT
+    double llr_lower = 0.;
+    double llr_upper = 0.;
+    SprtState sprt = sprt_off;
+};
+
+// Seatings of three entrants per match, cycled through in order
+std::vector<std::array<int, 3>> get_seatings(int const num_entrants, Schedule const schedule);
+// Fills elo and elo_error of result from its pairwise results
+void compute_ratings(Result& result);
+// Log-likelihood ratio of elo1 against elo0 for the match scores of results (normal approximation)
+double get_sprt_llr(PairResult const& results, double const elo0, double const elo1);
+
+Result run(std::vector<Entrant> const& roster, Settings const& settings);
+
+// Duplicate mode: every deal is replayed with the entrants in every seat permutation, which cancels most of the card luck
+struct DuplicateSettings {
+    long deals = 1000;
+    int threads = 0; // Zero uses all cores
+    bool retry_on_illegal_action = true;
+    unsigned seed = 0; // Deals are derived from seed and deal index, zero draws a random seed
+};
+
+struct DuplicateResult {
+    std::vector<std::string> names;
+    std::vector<std::vector<double>> deal_scores; // deal_scores[d][i]: mean round score of entrant i over its seats on deal d
+    std::vector<std::vector<double>> mean_difference; // mean_difference[i][j]: mean of paired per-deal differences of i and j
+    std::vector<std::vector<double>> difference_error; // Half-width of 95% confidence intervals of mean_difference
+    long deals = 0; // Deals scored, deals with an aborted replay are dropped to keep the pairing
+    long aborted_deals = 0;
+    std::vector<long> aborts; // Dropped deals by entrant playing the illegal card
+    unsigned seed = 0;
+};
+
+// Deck, declarer and dealer of a deal, which only depend on seed and deal index (the same on every platform)
+void get_duplicate_deal(unsigned const seed, long const index, std::vector<Cards::Card>& deck, int& declarer, int& dealer);
+// All distinct seat permutations of two or three entrants
+std::vector<std::array<int, 3>> get_duplicate_seatings(int const num_entrants);
+
+DuplicateResult run_duplicate(std::vector<Entrant> const& roster, DuplicateSettings const& settings);
+
+} // namespace Tournament